@@ -4,11 +4,9 @@ layout (location = 0) in vec3 vertex_position;
 layout (location = 1) in vec3 vertex_normal;
 layout (location = 2) in vec2 texture_coords;
 
-uniform mat4 model_matrix;
-uniform mat4 view_matrix;
-uniform mat4 projection_matrix;
+uniform mat4 mvp_matrix;
 
 void main()
 {
-	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(vertex_position, 1.0);
+	gl_Position = mvp_matrix * vec4(vertex_position, 1.0);
 }
\ No newline at end of file
@@ -5,11 +5,10 @@ layout (location = 1) in vec4 vertex_color;
 
 out vec4 f_color;
 
-uniform mat4 view_matrix;
-uniform mat4 projection_matrix;
+uniform mat4 view_projection_matrix;
 
 void main()
 {
-	gl_Position = projection_matrix * view_matrix * vec4(vertex_position, 1.0);
+	gl_Position = view_projection_matrix * vec4(vertex_position, 1.0);
 	f_color = vertex_color;
 }
\ No newline at end of file
@@ -1,8 +1,22 @@
 #version 330 core
 
+// Feature defines, injected by graphics_shader_create_with_defines:
+// USE_DIFFUSE_MAP  - sample diffuse_info.diffuse_map instead of using diffuse_info.diffuse_color
+// USE_NORMAL_MAP   - sample normal_mapping_info.normal_map_texture instead of using the interpolated normal
+// TANGENT_SPACE_NORMAL_MAP - the normal map is relative to the tangent frame of the vertices instead of object space
+// NORMAL_MAP_XY    - the tangent space normal map only stores x and y (BC5), z is rebuilt from them
+// USE_ATLAS_BATCH  - instanced draw; the diffuse color is sampled from a layer of diffuse_atlas
+// LIGHT_QUANTITY   - number of lights, known at compile time so the light loop can be unrolled
+#ifndef LIGHT_QUANTITY
+#define LIGHT_QUANTITY 1
+#endif
+
 in vec3 fragment_position;
 in vec3 fragment_normal;
 in vec2 fragment_texture_coords;
+#ifdef USE_NORMAL_MAP
+in vec4 fragment_tangent;
+#endif
 
 // Light
 struct Light
@@ -16,22 +30,27 @@ struct Light
 // Normal Mapping
 struct Normal_Mapping_Info
 {
-	bool use_normal_map;
-	bool tangent_space;	// @not implemented
 	sampler2D normal_map_texture;
 };
 
 // Diffuse Info
 struct Diffuse_Info
 {
-	bool use_diffuse_map;
 	vec4 diffuse_color;
 	sampler2D diffuse_map;
 };
 
-uniform mat4 model_matrix;
-uniform Light lights[16];
-uniform int light_quantity;
+#ifdef USE_ATLAS_BATCH
+in vec2 fragment_atlas_coords;
+flat in float fragment_atlas_layer;
+flat in mat3 fragment_normal_matrix;
+uniform sampler2DArray diffuse_atlas;
+#else
+uniform mat3 normal_matrix;
+#endif
+#if LIGHT_QUANTITY > 0
+uniform Light lights[LIGHT_QUANTITY];
+#endif
 uniform Normal_Mapping_Info normal_mapping_info;
 uniform vec3 camera_position;
 uniform float object_shineness;
@@ -44,31 +63,52 @@ vec3 get_correct_normal()
 {
 	vec3 normal;
 
-	if (normal_mapping_info.use_normal_map)
-	{
-		// Sample normal map (range [0, 1])
-		normal = texture(normal_mapping_info.normal_map_texture, fragment_texture_coords).xyz;
-		// Transform normal vector to range [-1, 1]
-		// normal = normal * 2.0 - 1.0;
-
-		// Normalize normal
-		normal = normalize(normal);
-
-		normal = mat3(inverse(transpose(model_matrix))) * normal;
-		normal = normalize(normal);
-	}
-	else
-		normal = normalize(fragment_normal);
+#ifdef USE_NORMAL_MAP
+	// Sample normal map (range [0, 1])
+	normal = texture(normal_mapping_info.normal_map_texture, fragment_texture_coords).xyz;
+
+#ifdef TANGENT_SPACE_NORMAL_MAP
+	// MikkTSpace convention: the interpolated frame is used as is, without normalizing it first.
+	normal = normal * 2.0 - 1.0;
+#ifdef NORMAL_MAP_XY
+	normal.z = sqrt(max(0.0, 1.0 - dot(normal.xy, normal.xy)));
+#endif
+	vec3 bitangent = fragment_tangent.w * cross(fragment_normal, fragment_tangent.xyz);
+	normal = normalize(normal.x * fragment_tangent.xyz + normal.y * bitangent + normal.z * fragment_normal);
+#else
+	// Transform normal vector to range [-1, 1]
+	// normal = normal * 2.0 - 1.0;
+
+	// Normalize normal
+	normal = normalize(normal);
+
+#ifdef USE_ATLAS_BATCH
+	normal = fragment_normal_matrix * normal;
+#else
+	normal = normal_matrix * normal;
+#endif
+	normal = normalize(normal);
+#endif
+#else
+	normal = normalize(fragment_normal);
+#endif
 
 	return normal;
 }
 
-vec3 get_point_color_of_light(Light light)
+vec4 get_real_diffuse_color()
 {
-	vec3 normal = get_correct_normal();
-	vec4 real_diffuse_color = diffuse_info.use_diffuse_map ? texture(diffuse_info.diffuse_map, fragment_texture_coords) :
-		diffuse_info.diffuse_color;
+#if defined(USE_ATLAS_BATCH)
+	return texture(diffuse_atlas, vec3(fragment_atlas_coords, fragment_atlas_layer));
+#elif defined(USE_DIFFUSE_MAP)
+	return texture(diffuse_info.diffuse_map, fragment_texture_coords);
+#else
+	return diffuse_info.diffuse_color;
+#endif
+}
 
+vec3 get_point_color_of_light(Light light, vec3 normal, vec4 real_diffuse_color)
+{
 	vec3 fragment_to_point_light_vec = normalize(light.position - fragment_position);
 
 	// Ambient Color
@@ -101,11 +141,17 @@ void main()
 {
 	final_color = vec4(0.0, 0.0, 0.0, 1.0);
 
-	for (int i = 0; i < light_quantity; ++i)
+#if LIGHT_QUANTITY > 0
+	// Normal and diffuse color do not depend on the light, so they are fetched only once.
+	vec3 normal = get_correct_normal();
+	vec4 real_diffuse_color = get_real_diffuse_color();
+
+	for (int i = 0; i < LIGHT_QUANTITY; ++i)
 	{
-		vec3 point_color = get_point_color_of_light(lights[i]);
+		vec3 point_color = get_point_color_of_light(lights[i], normal, real_diffuse_color);
 		final_color.x += point_color.x;
 		final_color.y += point_color.y;
 		final_color.z += point_color.z;
 	}
+#endif
 }
\ No newline at end of file
@@ -3,19 +3,69 @@
 layout (location = 0) in vec3 vertex_position;
 layout (location = 1) in vec3 vertex_normal;
 layout (location = 2) in vec2 vertex_texture_coords;
+// Tangent frame quaternion (QTangent), see mesh/tangents.h. The sign of w is the handedness of the frame.
+layout (location = 3) in vec4 vertex_tangent_frame;
 
 out vec3 fragment_position;
 out vec3 fragment_normal;
 out vec2 fragment_texture_coords;
+#ifdef USE_NORMAL_MAP
+// xyz: tangent, w: handedness
+out vec4 fragment_tangent;
+#endif
 
+#ifdef USE_ATLAS_BATCH
+// Per-instance data, see graphics_entities_render_phong_shader_batched.
+layout (location = 4) in mat4 instance_model_matrix;
+layout (location = 8) in mat3 instance_normal_matrix;
+layout (location = 11) in vec4 instance_atlas_uv_transform;	// xy: offset, zw: scale
+layout (location = 12) in float instance_atlas_layer;
+
+out vec2 fragment_atlas_coords;
+flat out float fragment_atlas_layer;
+flat out mat3 fragment_normal_matrix;
+
+uniform mat4 view_projection_matrix;
+#else
+// normal_matrix and mvp_matrix are precomputed on the CPU once per entity.
 uniform mat4 model_matrix;
-uniform mat4 view_matrix;
-uniform mat4 projection_matrix;
+uniform mat3 normal_matrix;
+uniform mat4 mvp_matrix;
+#endif
+
+#ifdef USE_NORMAL_MAP
+vec4 get_tangent()
+{
+	vec4 q = vertex_tangent_frame;
+	// First column of the rotation matrix of q.
+	vec3 tangent = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	return vec4(tangent, q.w < 0.0 ? -1.0 : 1.0);
+}
+#endif
 
 void main()
 {
-	fragment_normal = mat3(inverse(transpose(model_matrix))) * vertex_normal;
 	fragment_texture_coords = vertex_texture_coords;
+#ifdef USE_NORMAL_MAP
+	vec4 tangent = get_tangent();
+#endif
+#ifdef USE_ATLAS_BATCH
+	vec4 world_position = instance_model_matrix * vec4(vertex_position, 1.0);
+	fragment_normal = instance_normal_matrix * vertex_normal;
+#ifdef USE_NORMAL_MAP
+	fragment_tangent = vec4(mat3(instance_model_matrix) * tangent.xyz, tangent.w);
+#endif
+	fragment_normal_matrix = instance_normal_matrix;
+	fragment_atlas_coords = vertex_texture_coords * instance_atlas_uv_transform.zw + instance_atlas_uv_transform.xy;
+	fragment_atlas_layer = instance_atlas_layer;
+	fragment_position = world_position.xyz;
+	gl_Position = view_projection_matrix * world_position;
+#else
+	fragment_normal = normal_matrix * vertex_normal;
+#ifdef USE_NORMAL_MAP
+	fragment_tangent = vec4(mat3(model_matrix) * tangent.xyz, tangent.w);
+#endif
 	fragment_position = (model_matrix * vec4(vertex_position, 1.0)).xyz;
-	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(vertex_position, 1.0);
+	gl_Position = mvp_matrix * vec4(vertex_position, 1.0);
+#endif
 }
\ No newline at end of file
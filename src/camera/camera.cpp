@@ -4,6 +4,8 @@
 
 extern dvec2 window_size;
 
+static u32 next_matrices_version = 1;
+
 vec3 camera_get_view(const Camera* camera)
 {
 	mat4 view_matrix = camera->view_matrix;
@@ -153,6 +155,7 @@ void camera_recalculate_view_matrix(Camera* camera)
 
 	mat4 rotation_matrix = quaternion_get_matrix(&camera_rotation);
 	camera->view_matrix = gm_mat4_multiply(&rotation_matrix, &translation_matrix);
+	camera->matrices_version = next_matrices_version++;
 }
 
 void camera_recalculate_projection_matrix(Camera* camera)
@@ -182,4 +185,5 @@ void camera_recalculate_projection_matrix(Camera* camera)
 	// Need to transpose when sending to shader
 	mat4 mp = gm_mat4_multiply(&m, &p);
 	camera->projection_matrix = gm_mat4_scalar_product(-1.0f, &mp);
+	camera->matrices_version = next_matrices_version++;
 }
\ No newline at end of file
@@ -33,6 +33,9 @@ typedef struct {
 	r32 movement_speed;
 	mat4 view_matrix;
 	mat4 projection_matrix;
+	// Changes (to a globally unique value) every time view_matrix or projection_matrix is recalculated.
+	// Used to detect when matrices that were derived from the camera need to be refreshed.
+	u32 matrices_version;
 	union {
 		Free_Camera free_camera;
 		Lookat_Camera lookat_camera;
@@ -7,10 +7,13 @@
 #include "obj.h"
 #include "ui.h"
 #include "util.h"
+#include "texture_stream.h"
+#include "frame_capture.h"
 #include "camera/lookat.h"
 #include "camera/free.h"
 
 #define USE_LOOKAT_CAMERA true
+#define CORE_RECORDING_FRAMES_PER_SECOND 60
 
 extern dvec2 window_size;
 extern dvec2 framebuffer_size;
@@ -87,10 +90,14 @@ void core_destroy(Core_Ctx* ctx)
 {
 	array_free(ctx->lights);
 	ui_destroy(&ctx->ui_ctx);
+	texture_stream_destroy();
+	frame_capture_destroy();
 }
 
 void core_update(Core_Ctx* ctx, r32 delta_time)
 {
+	texture_stream_update(TEXTURE_STREAM_DEFAULT_UPLOAD_BUDGET);
+	graphics_entities_update_mvp(&ctx->camera, &ctx->e, 1);
 }
 
 void core_render(Core_Ctx* ctx)
@@ -99,6 +106,7 @@ void core_render(Core_Ctx* ctx)
 	graphics_renderer_debug_vector((vec3){0.0f, 0.0f, 0.0f}, (vec3){1.0f, 0.0f, 0.0f}, (vec4){1.0f, 0.0f, 0.0f, 1.0f});
 	graphics_renderer_primitives_flush(&ctx->camera);
 	ui_render(&ctx->ui_ctx, ctx->is_ui_active);
+	frame_capture_update();
 }
 
 void core_input_process(Core_Ctx* ctx, r32 delta_time)
@@ -191,6 +199,26 @@ void core_input_process(Core_Ctx* ctx, r32 delta_time)
 			ctx->is_panning_camera = true;
 	}
 	
+	if (ctx->key_state[GLFW_KEY_F12])
+	{
+		frame_capture_screenshot_timestamped();
+		ctx->key_state[GLFW_KEY_F12] = false;
+	}
+
+	if (ctx->key_state[GLFW_KEY_F11])
+	{
+		if (frame_capture_is_recording())
+		{
+			Frame_Capture_Statistics statistics = frame_capture_stop_recording();
+			printf("Recording stopped: %lld frames written, %lld dropped (readback), %lld dropped (write queue)\n",
+				(long long)statistics.frames_written, (long long)statistics.frames_dropped_readback,
+				(long long)statistics.frames_dropped_queue);
+		}
+		else
+			frame_capture_start_recording_timestamped(CORE_RECORDING_FRAMES_PER_SECOND);
+		ctx->key_state[GLFW_KEY_F11] = false;
+	}
+
 	if (ctx->key_state[GLFW_KEY_ESCAPE])
 	{
 		ctx->is_ui_active = !ctx->is_ui_active;
@@ -0,0 +1,32 @@
+#include "embedded_shaders.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const s8* get_file_name(const s8* path)
+{
+	const s8* name = path;
+	for (const s8* c = path; *c; ++c)
+		if (*c == '/' || *c == '\\')
+			name = c + 1;
+	return name;
+}
+
+s8* embedded_shader_read(const s8* path)
+{
+	if (!getenv(EMBEDDED_SHADERS_FROM_DISK_ENV))
+	{
+		const s8* name = get_file_name(path);
+		for (const Embedded_Shader* shader = embedded_shaders; shader->name; ++shader)
+		{
+			if (!strcmp(shader->name, name))
+			{
+				s8* source = (s8*)malloc(shader->length + 1);
+				memcpy(source, shader->source, shader->length + 1);
+				return source;
+			}
+		}
+	}
+
+	return util_read_file(path, 0);
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef BASIC_ENGINE_EMBEDDED_SHADERS_H
+#define BASIC_ENGINE_EMBEDDED_SHADERS_H
+#include "common.h"
+
+// Shader sources are embedded into the executable at build time (see tools/embed_shaders.cpp).
+// Set the BASIC_ENGINE_SHADERS_FROM_DISK environment variable to load them from disk instead, which allows
+// iterating on shaders without rebuilding.
+#define EMBEDDED_SHADERS_FROM_DISK_ENV "BASIC_ENGINE_SHADERS_FROM_DISK"
+
+typedef struct {
+	const s8* name;
+	const s8* source;
+	s32 length;
+} Embedded_Shader;
+
+// Null-terminated table, generated at build time.
+extern const Embedded_Shader embedded_shaders[];
+
+// Returns a copy of the shader source (to be freed with free), looking only at the file name of the path.
+// Falls back to reading the path from disk if the shader is not embedded or if loading from disk was requested.
+s8* embedded_shader_read(const s8* path);
+
+#endif
\ No newline at end of file
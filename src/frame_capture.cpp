@@ -0,0 +1,573 @@
+#include "frame_capture.h"
+#include "graphics.h"
+#include "image_convert.h"
+#include "util.h"
+#include "jobs.h"
+#include <GL/glew.h>
+#include <stb_image_write.h>
+#include <light_array.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+// Buffer of the recording file, so the writer hands large blocks to the OS.
+#define FRAME_CAPTURE_WRITE_BUFFER_SIZE (8 * 1024 * 1024)
+
+typedef enum {
+	CAPTURE_SLOT_FREE,
+	CAPTURE_SLOT_READING,		// glReadPixels issued, waiting for the fence.
+	CAPTURE_SLOT_PROCESSING,	// Buffer mapped, a worker is encoding it.
+	CAPTURE_SLOT_PROCESSED		// Worker done, the buffer must be unmapped by the render thread.
+} Capture_Slot_State;
+
+typedef enum {
+	CAPTURE_KIND_SCREENSHOT,
+	CAPTURE_KIND_RECORDING
+} Capture_Kind;
+
+typedef struct {
+	u32 pixel_buffer;
+	u32 capacity;
+	GLsync fence;
+	s32 width, height;
+	s32 frames_waited;
+	const u8* pixels;
+	Capture_Kind kind;
+	// Screenshot path or recording frame number.
+	s8* path;
+	s64 sequence;
+	// Written by the worker when processing ends, everything else is only touched by the render thread.
+	std::atomic<s32> state;
+} Capture_Slot;
+
+typedef struct {
+	s64 sequence;
+	// Frame of the pool holding the converted image, -1 if the frame was dropped.
+	s32 frame;
+} Recorded_Frame;
+
+// Frames go through readback (render thread), conversion (any worker, in any order) and writing (one worker at a
+// time, in sequence order). Everything below the mutex is protected by it.
+typedef struct {
+	FILE* file;
+	bool y4m;
+	s32 width, height;
+	size_t frame_size;
+	s64 next_sequence;
+	std::mutex mutex;
+	u8* frame_pool;
+	s32* free_frames;
+	Recorded_Frame* converted_frames;
+	s64 next_write_sequence;
+	bool writing;
+	bool flushing;
+	Frame_Capture_Statistics statistics;
+} Recording;
+
+typedef struct {
+	Capture_Slot slots[FRAME_CAPTURE_RING_SIZE];
+	s8** pending_screenshots;
+	s32 screenshot_counter;
+	Recording* recording;
+	bool initialized;
+} Frame_Capture_Ctx;
+
+static Frame_Capture_Ctx capture_ctx;
+
+extern dvec2 framebuffer_size;
+
+static void init_frame_capture()
+{
+	if (!capture_ctx.initialized)
+	{
+		for (s32 i = 0; i < FRAME_CAPTURE_RING_SIZE; ++i)
+		{
+			Capture_Slot* slot = &capture_ctx.slots[i];
+			glGenBuffers(1, &slot->pixel_buffer);
+			slot->capacity = 0;
+			slot->fence = 0;
+			slot->pixels = 0;
+			slot->path = 0;
+			slot->state = CAPTURE_SLOT_FREE;
+		}
+		capture_ctx.pending_screenshots = array_new(s8*);
+		capture_ctx.recording = 0;
+		// Rows are read bottom to top. stb keeps this setting in a global, graphics_image_save sets it the same way.
+		stbi_flip_vertically_on_write(1);
+		capture_ctx.initialized = true;
+	}
+}
+
+static bool has_extension(const s8* path, const s8* extension)
+{
+	size_t path_length = strlen(path), extension_length = strlen(extension);
+	return path_length >= extension_length && !strcmp(path + path_length - extension_length, extension);
+}
+
+static void get_timestamped_path(const s8* directory, const s8* name, const s8* extension, s8* path)
+{
+	time_t now = time(0);
+	s8 timestamp[32];
+	strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", localtime(&now));
+
+	// The counter keeps names unique when several captures are taken in the same second.
+	sprintf(path, "%s/%s_%s_%03d%s", directory, name, timestamp, capture_ctx.screenshot_counter++ % 1000, extension);
+}
+
+static void encode_screenshot_job(void* data)
+{
+	Capture_Slot* slot = (Capture_Slot*)data;
+	s32 pixel_count = slot->width * slot->height;
+
+	// The framebuffer alpha is whatever blending left there, so only the color is stored.
+	u8* rgb = (u8*)malloc((size_t)pixel_count * 3);
+	for (s32 i = 0; i < pixel_count; ++i)
+	{
+		rgb[i * 3 + 0] = slot->pixels[i * 4 + 0];
+		rgb[i * 3 + 1] = slot->pixels[i * 4 + 1];
+		rgb[i * 3 + 2] = slot->pixels[i * 4 + 2];
+	}
+
+	s32 success;
+	if (has_extension(slot->path, ".bmp"))
+		success = stbi_write_bmp(slot->path, slot->width, slot->height, 3, rgb);
+	else
+		success = stbi_write_png(slot->path, slot->width, slot->height, 3, rgb, slot->width * 3);
+
+	if (!success)
+		printf("Error writing screenshot %s\n", slot->path);
+
+	free(rgb);
+	slot->state = CAPTURE_SLOT_PROCESSED;
+}
+
+// Recording
+
+static void write_frames_job(void* data);
+
+// Takes the converted frames that directly follow the last written one, in order. Must be called with the mutex
+// locked.
+static s32 take_writable_frames(Recording* recording, Recorded_Frame* frames, s32 max_count)
+{
+	s32 count = 0;
+	bool found = true;
+	while (found && count < max_count)
+	{
+		found = false;
+		for (u32 i = 0; i < array_length(recording->converted_frames); ++i)
+		{
+			if (recording->converted_frames[i].sequence == recording->next_write_sequence)
+			{
+				frames[count++] = recording->converted_frames[i];
+				array_remove(recording->converted_frames, i);
+				++recording->next_write_sequence;
+				found = true;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+// Number of converted frames that directly follow the last written one. Must be called with the mutex locked.
+static s32 count_writable_frames(const Recording* recording)
+{
+	s32 count = 0;
+	bool found = true;
+	while (found)
+	{
+		found = false;
+		for (u32 i = 0; i < array_length(recording->converted_frames); ++i)
+		{
+			if (recording->converted_frames[i].sequence == recording->next_write_sequence + count)
+			{
+				++count;
+				found = true;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+// Must be called with the mutex locked.
+static void start_writer(Recording* recording)
+{
+	if (recording->writing)
+		return;
+	if (!recording->flushing && count_writable_frames(recording) < FRAME_CAPTURE_WRITE_BATCH_FRAMES)
+		return;
+	recording->writing = true;
+	jobs_submit(write_frames_job, recording);
+}
+
+static void write_frames_job(void* data)
+{
+	Recording* recording = (Recording*)data;
+	Recorded_Frame frames[FRAME_CAPTURE_MAX_QUEUED_FRAMES];
+
+	std::unique_lock<std::mutex> lock(recording->mutex);
+	for (;;)
+	{
+		s32 count = take_writable_frames(recording, frames, FRAME_CAPTURE_MAX_QUEUED_FRAMES);
+		if (count == 0)
+			break;
+		lock.unlock();
+
+		s32 written = 0;
+		for (s32 i = 0; i < count; ++i)
+		{
+			if (frames[i].frame < 0)
+				continue;
+			const u8* frame = recording->frame_pool + (size_t)frames[i].frame * recording->frame_size;
+			if (recording->y4m)
+				fputs("FRAME\n", recording->file);
+			if (fwrite(frame, recording->frame_size, 1, recording->file) == 1)
+				++written;
+		}
+
+		lock.lock();
+		for (s32 i = 0; i < count; ++i)
+			if (frames[i].frame >= 0)
+				array_push(recording->free_frames, frames[i].frame);
+		recording->statistics.frames_written += written;
+	}
+	recording->writing = false;
+}
+
+static void convert_frame_job(void* data)
+{
+	Capture_Slot* slot = (Capture_Slot*)data;
+	Recording* recording = capture_ctx.recording;
+
+	Recorded_Frame converted;
+	converted.sequence = slot->sequence;
+	{
+		std::lock_guard<std::mutex> lock(recording->mutex);
+		converted.frame = array_length(recording->free_frames) > 0 ? array_pop(recording->free_frames) : -1;
+	}
+
+	if (converted.frame >= 0)
+	{
+		u8* y_plane = recording->frame_pool + (size_t)converted.frame * recording->frame_size;
+		u8* u_plane = y_plane + recording->width * recording->height;
+		u8* v_plane = u_plane + recording->width * recording->height / 4;
+		// Rows are read bottom to top, video frames go top to bottom.
+		s32 stride = slot->width * 4;
+		image_convert_rgba_to_yuv420(slot->pixels + (size_t)(slot->height - 1) * stride, -stride, recording->width,
+			recording->height, y_plane, u_plane, v_plane);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(recording->mutex);
+		if (converted.frame < 0)
+			++recording->statistics.frames_dropped_queue;
+		// Dropped frames are queued too, so the writer knows not to wait for them.
+		array_push(recording->converted_frames, converted);
+		start_writer(recording);
+	}
+
+	// Last, since frame_capture_stop_recording may free the recording as soon as every slot is processed.
+	slot->state = CAPTURE_SLOT_PROCESSED;
+}
+
+// Readback
+
+static Capture_Slot* get_free_slot()
+{
+	for (s32 i = 0; i < FRAME_CAPTURE_RING_SIZE; ++i)
+		if (capture_ctx.slots[i].state == CAPTURE_SLOT_FREE)
+			return &capture_ctx.slots[i];
+	return 0;
+}
+
+static void start_readback(Capture_Slot* slot, Capture_Kind kind, s32 width, s32 height)
+{
+	slot->kind = kind;
+	slot->width = width;
+	slot->height = height;
+	slot->frames_waited = 0;
+
+	u32 size = (u32)slot->width * slot->height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pixel_buffer);
+	if (size > slot->capacity)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+		slot->capacity = size;
+	}
+
+	// With a pack buffer bound, the last parameter is an offset and the call does not wait for rendering to end.
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, slot->width, slot->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->state = CAPTURE_SLOT_READING;
+}
+
+static void release_slot(Capture_Slot* slot)
+{
+	if (slot->pixels)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pixel_buffer);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot->pixels = 0;
+	}
+	free(slot->path);
+	slot->path = 0;
+	slot->state = CAPTURE_SLOT_FREE;
+}
+
+static void finish_readback(Capture_Slot* slot)
+{
+	glDeleteSync(slot->fence);
+	slot->fence = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pixel_buffer);
+	slot->pixels = (const u8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (u32)slot->width * slot->height * 4,
+		GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (!slot->pixels)
+	{
+		printf("Error mapping frame capture buffer\n");
+		if (slot->kind == CAPTURE_KIND_RECORDING)
+		{
+			// Handed to the conversion as a dropped frame, so the writer does not wait for it.
+			Recording* recording = capture_ctx.recording;
+			std::lock_guard<std::mutex> lock(recording->mutex);
+			Recorded_Frame dropped = { slot->sequence, -1 };
+			++recording->statistics.frames_dropped_readback;
+			array_push(recording->converted_frames, dropped);
+			start_writer(recording);
+		}
+		release_slot(slot);
+		return;
+	}
+
+	// The buffer stays mapped while the worker reads it, so the pixels are never copied on the render thread.
+	slot->state = CAPTURE_SLOT_PROCESSING;
+	jobs_submit(slot->kind == CAPTURE_KIND_SCREENSHOT ? encode_screenshot_job : convert_frame_job, slot);
+}
+
+// Blocks until every slot of the given kind is done. Used when stopping, never during regular frames.
+static void finish_slots(Capture_Kind kind)
+{
+	for (s32 i = 0; i < FRAME_CAPTURE_RING_SIZE; ++i)
+	{
+		Capture_Slot* slot = &capture_ctx.slots[i];
+		if (slot->state == CAPTURE_SLOT_FREE || slot->kind != kind)
+			continue;
+		if (slot->state == CAPTURE_SLOT_READING)
+		{
+			while (glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+			finish_readback(slot);
+		}
+		while (slot->state == CAPTURE_SLOT_PROCESSING)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (slot->state == CAPTURE_SLOT_PROCESSED)
+			release_slot(slot);
+	}
+}
+
+void frame_capture_screenshot(const s8* path)
+{
+	init_frame_capture();
+	array_push(capture_ctx.pending_screenshots, strdup(path));
+}
+
+void frame_capture_screenshot_timestamped()
+{
+	if (!util_create_directory(FRAME_CAPTURE_SCREENSHOT_DIRECTORY))
+	{
+		printf("Error creating %s\n", FRAME_CAPTURE_SCREENSHOT_DIRECTORY);
+		return;
+	}
+
+	s8 path[256];
+	get_timestamped_path(FRAME_CAPTURE_SCREENSHOT_DIRECTORY, "screenshot", ".png", path);
+	frame_capture_screenshot(path);
+}
+
+bool frame_capture_start_recording(const s8* path, s32 frames_per_second)
+{
+	init_frame_capture();
+	if (capture_ctx.recording)
+		frame_capture_stop_recording();
+
+	// 4:2:0 chroma covers 2x2 blocks.
+	s32 width = (s32)framebuffer_size.x & ~1;
+	s32 height = (s32)framebuffer_size.y & ~1;
+	if (width <= 0 || height <= 0)
+		return false;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Error opening recording %s\n", path);
+		return false;
+	}
+	setvbuf(file, 0, _IOFBF, FRAME_CAPTURE_WRITE_BUFFER_SIZE);
+
+	Recording* recording = new Recording;
+	recording->file = file;
+	recording->y4m = has_extension(path, ".y4m");
+	recording->width = width;
+	recording->height = height;
+	recording->frame_size = (size_t)width * height * 3 / 2;
+	recording->next_sequence = 0;
+	recording->frame_pool = (u8*)malloc(recording->frame_size * FRAME_CAPTURE_MAX_QUEUED_FRAMES);
+	recording->free_frames = array_new(s32);
+	for (s32 i = FRAME_CAPTURE_MAX_QUEUED_FRAMES - 1; i >= 0; --i)
+		array_push(recording->free_frames, i);
+	recording->converted_frames = array_new(Recorded_Frame);
+	recording->next_write_sequence = 0;
+	recording->writing = false;
+	recording->flushing = false;
+	memset(&recording->statistics, 0, sizeof(Frame_Capture_Statistics));
+
+	// Chroma samples sit at the center of each 2x2 block, as the conversion averages them.
+	if (recording->y4m)
+		fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, frames_per_second);
+
+	capture_ctx.recording = recording;
+	return true;
+}
+
+bool frame_capture_start_recording_timestamped(s32 frames_per_second)
+{
+	if (!util_create_directory(FRAME_CAPTURE_RECORDING_DIRECTORY))
+	{
+		printf("Error creating %s\n", FRAME_CAPTURE_RECORDING_DIRECTORY);
+		return false;
+	}
+
+	s8 path[256];
+	get_timestamped_path(FRAME_CAPTURE_RECORDING_DIRECTORY, "recording", ".y4m", path);
+	return frame_capture_start_recording(path, frames_per_second);
+}
+
+Frame_Capture_Statistics frame_capture_stop_recording()
+{
+	Frame_Capture_Statistics statistics;
+	memset(&statistics, 0, sizeof(Frame_Capture_Statistics));
+
+	Recording* recording = capture_ctx.recording;
+	if (!recording)
+		return statistics;
+
+	finish_slots(CAPTURE_KIND_RECORDING);
+
+	// Everything is converted now. The writer is started even for an incomplete batch and drains the queue.
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(recording->mutex);
+			recording->flushing = true;
+			if (!recording->writing && array_length(recording->converted_frames) == 0)
+				break;
+			start_writer(recording);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	statistics = recording->statistics;
+	fclose(recording->file);
+	free(recording->frame_pool);
+	array_free(recording->free_frames);
+	array_free(recording->converted_frames);
+	delete recording;
+	capture_ctx.recording = 0;
+
+	return statistics;
+}
+
+bool frame_capture_is_recording()
+{
+	return capture_ctx.recording != 0;
+}
+
+Frame_Capture_Statistics frame_capture_get_recording_statistics()
+{
+	Frame_Capture_Statistics statistics;
+	memset(&statistics, 0, sizeof(Frame_Capture_Statistics));
+
+	if (capture_ctx.recording)
+	{
+		std::lock_guard<std::mutex> lock(capture_ctx.recording->mutex);
+		statistics = capture_ctx.recording->statistics;
+	}
+	return statistics;
+}
+
+void frame_capture_update()
+{
+	if (!capture_ctx.initialized)
+		return;
+
+	for (s32 i = 0; i < FRAME_CAPTURE_RING_SIZE; ++i)
+	{
+		Capture_Slot* slot = &capture_ctx.slots[i];
+		if (slot->state == CAPTURE_SLOT_PROCESSED)
+			release_slot(slot);
+		else if (slot->state == CAPTURE_SLOT_READING && ++slot->frames_waited >= FRAME_CAPTURE_MAP_DELAY)
+		{
+			// Only polls the fence. If the GPU is further behind, mapping is retried next frame instead of stalling.
+			GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+				finish_readback(slot);
+		}
+	}
+
+	Recording* recording = capture_ctx.recording;
+	if (recording)
+	{
+		Capture_Slot* slot = get_free_slot();
+		if (slot)
+		{
+			slot->sequence = recording->next_sequence++;
+			start_readback(slot, CAPTURE_KIND_RECORDING, recording->width, recording->height);
+		}
+		else
+		{
+			// Frames that are never read back do not get a sequence number, so the writer does not wait for them.
+			std::lock_guard<std::mutex> lock(recording->mutex);
+			++recording->statistics.frames_dropped_readback;
+		}
+	}
+
+	// Every capture of the same frame would be identical, so at most one starts per frame.
+	if (array_length(capture_ctx.pending_screenshots) > 0)
+	{
+		Capture_Slot* slot = get_free_slot();
+		if (slot)
+		{
+			slot->path = capture_ctx.pending_screenshots[0];
+			start_readback(slot, CAPTURE_KIND_SCREENSHOT, (s32)framebuffer_size.x, (s32)framebuffer_size.y);
+			array_remove_ordered(capture_ctx.pending_screenshots, 0);
+		}
+	}
+}
+
+void frame_capture_destroy()
+{
+	if (!capture_ctx.initialized)
+		return;
+
+	frame_capture_stop_recording();
+	finish_slots(CAPTURE_KIND_SCREENSHOT);
+	for (s32 i = 0; i < FRAME_CAPTURE_RING_SIZE; ++i)
+		glDeleteBuffers(1, &capture_ctx.slots[i].pixel_buffer);
+
+	// Requests that never got to read the framebuffer are dropped.
+	for (u32 i = 0; i < array_length(capture_ctx.pending_screenshots); ++i)
+		free(capture_ctx.pending_screenshots[i]);
+	array_free(capture_ctx.pending_screenshots);
+	capture_ctx.initialized = false;
+}
\ No newline at end of file
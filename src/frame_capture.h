@@ -0,0 +1,47 @@
+#ifndef BASIC_ENGINE_FRAME_CAPTURE_H
+#define BASIC_ENGINE_FRAME_CAPTURE_H
+#include "common.h"
+
+// Asynchronous framebuffer readback. glReadPixels writes into one of a ring of pixel pack buffers, so it returns
+// without waiting for the GPU; the buffer is only mapped a few frames later, once its fence has signaled, and the
+// pixels are encoded and written to disk on a job worker.
+
+#define FRAME_CAPTURE_RING_SIZE 4
+// Frames between a readback and the map of its buffer.
+#define FRAME_CAPTURE_MAP_DELAY 2
+#define FRAME_CAPTURE_SCREENSHOT_DIRECTORY "./screenshots"
+#define FRAME_CAPTURE_RECORDING_DIRECTORY "./recordings"
+// Converted frames waiting to be written. When it is full, new frames are dropped instead of waiting for the disk.
+#define FRAME_CAPTURE_MAX_QUEUED_FRAMES 16
+// Frames the writer waits for before writing them in one go.
+#define FRAME_CAPTURE_WRITE_BATCH_FRAMES 4
+
+typedef struct
+{
+	s64 frames_written;
+	// No pixel buffer was free: the GPU or the conversion is behind.
+	s64 frames_dropped_readback;
+	// The write queue was full: the disk is behind.
+	s64 frames_dropped_queue;
+} Frame_Capture_Statistics;
+
+// Captures the framebuffer at the next frame_capture_update. The format is picked from the extension (.png or .bmp).
+void frame_capture_screenshot(const s8* path);
+// Same, with a timestamped name in FRAME_CAPTURE_SCREENSHOT_DIRECTORY.
+void frame_capture_screenshot_timestamped();
+// Records every frame to path until frame_capture_stop_recording. Files ending in .y4m are written as YUV4MPEG2,
+// anything else as headerless I420 frames (ffmpeg: -f rawvideo -pix_fmt yuv420p). The frame size is the framebuffer
+// size when recording starts, rounded down to even numbers. Frames are converted to YUV and written on the workers.
+bool frame_capture_start_recording(const s8* path, s32 frames_per_second);
+// Same, with a timestamped .y4m name in FRAME_CAPTURE_RECORDING_DIRECTORY.
+bool frame_capture_start_recording_timestamped(s32 frames_per_second);
+// Waits until every captured frame is written and closes the file.
+Frame_Capture_Statistics frame_capture_stop_recording();
+bool frame_capture_is_recording();
+Frame_Capture_Statistics frame_capture_get_recording_statistics();
+// Must be called once per frame, after rendering and before swapping buffers.
+void frame_capture_update();
+// Finishes every capture that is already in flight and stops recording.
+void frame_capture_destroy();
+
+#endif
\ No newline at end of file
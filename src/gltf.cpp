@@ -0,0 +1,1040 @@
+#include "gltf.h"
+#include "util.h"
+#include "quaternion.h"
+#include "mesh/tangents.h"
+#include <GL/glew.h>
+#include <stb_image.h>
+#include <light_array.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLB_MAGIC 0x46546C67		// "glTF"
+#define GLB_VERSION 2
+#define GLB_CHUNK_JSON 0x4E4F534A	// "JSON"
+#define GLB_CHUNK_BIN 0x004E4942	// "BIN\0"
+#define GLTF_MODE_TRIANGLES 4
+#define GLTF_MAX_PATH_LENGTH 256
+// Nesting limits, so malformed files (or node cycles) cannot exhaust the stack.
+#define JSON_MAX_DEPTH 64
+#define GLTF_MAX_NODE_DEPTH 64
+#define JSON_MAX_NUMBER_LENGTH 64
+
+typedef enum {
+	JSON_NULL,
+	JSON_FALSE,
+	JSON_TRUE,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+} Json_Type;
+
+// Values are stored in one array and point into the JSON text, which must outlive them. Strings keep their escape
+// sequences, which glTF only needs in names and URIs.
+typedef struct
+{
+	Json_Type type;
+	// Set for the members of an object.
+	const s8* key;
+	u32 key_length;
+	const s8* string;
+	u32 string_length;
+	r64 number;
+	// Indexes in the value array, -1 if none.
+	s32 first_child;
+	s32 next_sibling;
+} Json_Value;
+
+typedef struct
+{
+	const s8* p;
+	const s8* end;
+	Json_Value* values;
+	u32 depth;
+} Json_Parser;
+
+typedef struct
+{
+	const u8* data;
+	u64 size;
+	// Buffers in external files are mapped on their own. The binary chunk is part of the mapped .glb.
+	bool mapped;
+} Gltf_Buffer;
+
+typedef struct
+{
+	s32 buffer;
+	u64 byte_offset;
+	u64 byte_length;
+	// 0 if tightly packed.
+	u32 byte_stride;
+} Gltf_Buffer_View;
+
+typedef struct
+{
+	s32 buffer_view;
+	u64 byte_offset;
+	// glTF uses the GL enums: GL_BYTE, GL_UNSIGNED_BYTE, GL_SHORT, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT or GL_FLOAT.
+	u32 component_type;
+	u32 component_count;
+	bool normalized;
+	u32 count;
+	bool has_bounds;
+	r32 min[3], max[3];
+} Gltf_Accessor;
+
+typedef struct
+{
+	Mesh mesh;
+	Diffuse_Info diffuse_info;
+} Gltf_Primitive;
+
+typedef struct
+{
+	const s8* path;
+	Json_Value* json;
+	Gltf_Buffer* buffers;
+	Gltf_Buffer_View* buffer_views;
+	Gltf_Accessor* accessors;
+	// Indexes of the JSON values of each array, so elements are found without walking the sibling lists.
+	s32* materials;
+	s32* textures;
+	s32* images;
+	s32* meshes;
+	s32* nodes;
+	// GL objects created so far, 0 if not yet. Textures are per image and usage, (u32)-1 if the image failed to load.
+	u32* view_buffers;
+	u32* albedo_textures;
+	u32* normal_textures;
+	// Per glTF mesh, a light_array of its triangle primitives. 0 if not yet created.
+	Gltf_Primitive** primitives;
+	Gltf_Scene* scene;
+} Gltf_Context;
+
+static const s8* json_skip_spaces(const s8* p, const s8* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		++p;
+	return p;
+}
+
+static bool json_parse_string(Json_Parser* parser, const s8** string, u32* string_length)
+{
+	if (parser->p == parser->end || *parser->p != '"')
+		return false;
+
+	const s8* start = ++parser->p;
+	while (parser->p < parser->end && *parser->p != '"')
+		parser->p += (*parser->p == '\\') ? 2 : 1;
+	if (parser->p >= parser->end)
+		return false;
+
+	*string = start;
+	*string_length = (u32)(parser->p - start);
+	++parser->p;
+	return true;
+}
+
+static bool json_parse_literal(Json_Parser* parser, const s8* literal)
+{
+	u32 length = (u32)strlen(literal);
+	if ((u64)(parser->end - parser->p) < length || memcmp(parser->p, literal, length))
+		return false;
+	parser->p += length;
+	return true;
+}
+
+static bool json_parse_number(Json_Parser* parser, r64* number)
+{
+	// The text is not null-terminated, so strtod gets a copy.
+	s8 buffer[JSON_MAX_NUMBER_LENGTH];
+	u32 length = 0;
+	while (parser->p + length < parser->end && length < JSON_MAX_NUMBER_LENGTH - 1 &&
+		strchr("+-0123456789.eE", parser->p[length]))
+		++length;
+	if (!length)
+		return false;
+
+	memcpy(buffer, parser->p, length);
+	buffer[length] = 0;
+	s8* number_end;
+	*number = strtod(buffer, &number_end);
+	if (number_end != buffer + length)
+		return false;
+
+	parser->p += length;
+	return true;
+}
+
+// Returns the index of the parsed value, or -1 if the text is not valid JSON.
+static s32 json_parse_value(Json_Parser* parser)
+{
+	parser->p = json_skip_spaces(parser->p, parser->end);
+	if (parser->p == parser->end || parser->depth == JSON_MAX_DEPTH)
+		return -1;
+
+	Json_Value value;
+	memset(&value, 0, sizeof(value));
+	value.first_child = -1;
+	value.next_sibling = -1;
+	s32 index = (s32)array_length(parser->values);
+	array_push(parser->values, value);
+
+	s8 c = *parser->p;
+	if (c == '{' || c == '[')
+	{
+		bool object = c == '{';
+		s8 close = object ? '}' : ']';
+		parser->values[index].type = object ? JSON_OBJECT : JSON_ARRAY;
+		++parser->p;
+		++parser->depth;
+
+		parser->p = json_skip_spaces(parser->p, parser->end);
+		if (parser->p < parser->end && *parser->p == close)
+		{
+			++parser->p;
+			--parser->depth;
+			return index;
+		}
+
+		s32 last_child = -1;
+		for (;;)
+		{
+			const s8* key = 0;
+			u32 key_length = 0;
+			if (object)
+			{
+				parser->p = json_skip_spaces(parser->p, parser->end);
+				if (!json_parse_string(parser, &key, &key_length))
+					return -1;
+				parser->p = json_skip_spaces(parser->p, parser->end);
+				if (parser->p == parser->end || *parser->p != ':')
+					return -1;
+				++parser->p;
+			}
+
+			s32 child = json_parse_value(parser);
+			if (child < 0)
+				return -1;
+
+			parser->values[child].key = key;
+			parser->values[child].key_length = key_length;
+			if (last_child < 0)
+				parser->values[index].first_child = child;
+			else
+				parser->values[last_child].next_sibling = child;
+			last_child = child;
+
+			parser->p = json_skip_spaces(parser->p, parser->end);
+			if (parser->p < parser->end && *parser->p == ',')
+			{
+				++parser->p;
+				continue;
+			}
+			if (parser->p < parser->end && *parser->p == close)
+			{
+				++parser->p;
+				break;
+			}
+			return -1;
+		}
+		--parser->depth;
+	}
+	else if (c == '"')
+	{
+		const s8* string;
+		u32 string_length;
+		if (!json_parse_string(parser, &string, &string_length))
+			return -1;
+		parser->values[index].type = JSON_STRING;
+		parser->values[index].string = string;
+		parser->values[index].string_length = string_length;
+	}
+	else if (json_parse_literal(parser, "true"))
+		parser->values[index].type = JSON_TRUE;
+	else if (json_parse_literal(parser, "false"))
+		parser->values[index].type = JSON_FALSE;
+	else if (json_parse_literal(parser, "null"))
+		parser->values[index].type = JSON_NULL;
+	else
+	{
+		r64 number;
+		if (!json_parse_number(parser, &number))
+			return -1;
+		parser->values[index].type = JSON_NUMBER;
+		parser->values[index].number = number;
+	}
+
+	return index;
+}
+
+// Returns a light_array of values whose first element is the root, or 0 if the text is not valid JSON.
+static Json_Value* json_parse(const s8* text, u64 length)
+{
+	Json_Parser parser;
+	parser.p = text;
+	parser.end = text + length;
+	parser.values = array_new(Json_Value);
+	parser.depth = 0;
+
+	if (json_parse_value(&parser) < 0)
+	{
+		array_free(parser.values);
+		return 0;
+	}
+
+	return parser.values;
+}
+
+// Member of an object, -1 if value is not an object or has no such member.
+static s32 json_get(const Json_Value* json, s32 value, const s8* key)
+{
+	if (value < 0 || json[value].type != JSON_OBJECT)
+		return -1;
+
+	u32 key_length = (u32)strlen(key);
+	for (s32 child = json[value].first_child; child >= 0; child = json[child].next_sibling)
+		if (json[child].key_length == key_length && !memcmp(json[child].key, key, key_length))
+			return child;
+	return -1;
+}
+
+static r64 json_get_number(const Json_Value* json, s32 value, const s8* key, r64 default_value)
+{
+	s32 member = json_get(json, value, key);
+	return (member >= 0 && json[member].type == JSON_NUMBER) ? json[member].number : default_value;
+}
+
+static bool json_string_equals(const Json_Value* json, s32 value, const s8* string)
+{
+	u32 length = (u32)strlen(string);
+	return value >= 0 && json[value].type == JSON_STRING && json[value].string_length == length &&
+		!memcmp(json[value].string, string, length);
+}
+
+// Returns a light_array with the elements of an array, empty if value is not an array.
+static s32* json_get_elements(const Json_Value* json, s32 value)
+{
+	s32* elements = array_new(s32);
+	if (value >= 0 && json[value].type == JSON_ARRAY)
+		for (s32 child = json[value].first_child; child >= 0; child = json[child].next_sibling)
+			array_push(elements, child);
+	return elements;
+}
+
+// Reads up to count numbers of an array member. Returns how many were read.
+static u32 json_get_numbers(const Json_Value* json, s32 value, const s8* key, r32* numbers, u32 count)
+{
+	s32 member = json_get(json, value, key);
+	if (member < 0 || json[member].type != JSON_ARRAY)
+		return 0;
+
+	u32 read = 0;
+	for (s32 child = json[member].first_child; child >= 0 && read < count; child = json[child].next_sibling)
+		if (json[child].type == JSON_NUMBER)
+			numbers[read++] = (r32)json[child].number;
+	return read;
+}
+
+static s32 get_element(const s32* elements, r64 index)
+{
+	if (index < 0.0 || index >= (r64)array_length(elements))
+		return -1;
+	return elements[(u32)index];
+}
+
+static void get_relative_path(const s8* base_path, const s8* name, u32 name_length, s8* path)
+{
+	const s8* directory_end = base_path + strlen(base_path);
+	while (directory_end > base_path && directory_end[-1] != '/' && directory_end[-1] != '\\')
+		--directory_end;
+	snprintf(path, GLTF_MAX_PATH_LENGTH, "%.*s%.*s", (s32)(directory_end - base_path), base_path, (s32)name_length,
+		name);
+}
+
+static u32 get_component_size(u32 component_type)
+{
+	switch (component_type)
+	{
+		case GL_BYTE:
+		case GL_UNSIGNED_BYTE: return 1;
+		case GL_SHORT:
+		case GL_UNSIGNED_SHORT: return 2;
+		case GL_UNSIGNED_INT:
+		case GL_FLOAT: return 4;
+	}
+	return 0;
+}
+
+static u32 get_component_count(const Json_Value* json, s32 type)
+{
+	if (json_string_equals(json, type, "SCALAR")) return 1;
+	if (json_string_equals(json, type, "VEC2")) return 2;
+	if (json_string_equals(json, type, "VEC3")) return 3;
+	if (json_string_equals(json, type, "VEC4")) return 4;
+	if (json_string_equals(json, type, "MAT2")) return 4;
+	if (json_string_equals(json, type, "MAT3")) return 9;
+	if (json_string_equals(json, type, "MAT4")) return 16;
+	return 0;
+}
+
+// Maps (or finds in the binary chunk) every buffer and reads the buffer views and accessors, checking that all the
+// data they reference is inside its buffer.
+static bool load_buffers(Gltf_Context* ctx, s32 root, const u8* bin_chunk, u64 bin_chunk_size)
+{
+	const Json_Value* json = ctx->json;
+
+	s32* buffers = json_get_elements(json, json_get(json, root, "buffers"));
+	for (u32 i = 0; i < array_length(buffers); ++i)
+	{
+		Gltf_Buffer buffer = {0};
+		u64 byte_length = (u64)json_get_number(json, buffers[i], "byteLength", 0.0);
+		s32 uri = json_get(json, buffers[i], "uri");
+
+		if (uri < 0 && i == 0 && bin_chunk)
+		{
+			buffer.data = bin_chunk;
+			buffer.size = bin_chunk_size;
+		}
+		else if (uri >= 0 && json[uri].type == JSON_STRING && json[uri].string_length > 5 &&
+			strncmp(json[uri].string, "data:", 5))
+		{
+			s8 buffer_path[GLTF_MAX_PATH_LENGTH];
+			get_relative_path(ctx->path, json[uri].string, json[uri].string_length, buffer_path);
+			buffer.data = util_map_file(buffer_path, &buffer.size);
+			buffer.mapped = true;
+		}
+
+		array_push(ctx->buffers, buffer);
+		if (!buffer.data || buffer.size < byte_length)
+		{
+			printf("Error loading %s: buffer %u is missing, too small or a data URI\n", ctx->path, i);
+			array_free(buffers);
+			return false;
+		}
+	}
+
+	s32* buffer_views = json_get_elements(json, json_get(json, root, "bufferViews"));
+	for (u32 i = 0; i < array_length(buffer_views); ++i)
+	{
+		Gltf_Buffer_View view;
+		r64 buffer_index = json_get_number(json, buffer_views[i], "buffer", -1.0);
+		view.buffer = get_element(buffers, buffer_index) >= 0 ? (s32)buffer_index : -1;
+		view.byte_offset = (u64)json_get_number(json, buffer_views[i], "byteOffset", 0.0);
+		view.byte_length = (u64)json_get_number(json, buffer_views[i], "byteLength", 0.0);
+		view.byte_stride = (u32)json_get_number(json, buffer_views[i], "byteStride", 0.0);
+		array_push(ctx->buffer_views, view);
+
+		if (view.buffer < 0 || view.byte_offset + view.byte_length > ctx->buffers[view.buffer].size)
+		{
+			printf("Error loading %s: buffer view %u is out of bounds\n", ctx->path, i);
+			array_free(buffers);
+			array_free(buffer_views);
+			return false;
+		}
+	}
+
+	s32* accessors = json_get_elements(json, json_get(json, root, "accessors"));
+	bool valid = true;
+	for (u32 i = 0; i < array_length(accessors) && valid; ++i)
+	{
+		Gltf_Accessor accessor = {0};
+		r64 view_index = json_get_number(json, accessors[i], "bufferView", -1.0);
+		accessor.buffer_view = get_element(buffer_views, view_index) >= 0 ? (s32)view_index : -1;
+		accessor.byte_offset = (u64)json_get_number(json, accessors[i], "byteOffset", 0.0);
+		accessor.component_type = (u32)json_get_number(json, accessors[i], "componentType", 0.0);
+		accessor.component_count = get_component_count(json, json_get(json, accessors[i], "type"));
+		s32 normalized = json_get(json, accessors[i], "normalized");
+		accessor.normalized = normalized >= 0 && json[normalized].type == JSON_TRUE;
+		accessor.count = (u32)json_get_number(json, accessors[i], "count", 0.0);
+		accessor.has_bounds = json_get_numbers(json, accessors[i], "min", accessor.min, 3) == 3 &&
+			json_get_numbers(json, accessors[i], "max", accessor.max, 3) == 3;
+
+		// Accessors without a buffer view (all zeros or sparse only) are not supported, so they are left invalid
+		// and rejected by the primitives using them.
+		if (accessor.buffer_view >= 0)
+		{
+			const Gltf_Buffer_View* view = &ctx->buffer_views[accessor.buffer_view];
+			u64 element_size = (u64)get_component_size(accessor.component_type) * accessor.component_count;
+			u64 stride = view->byte_stride ? view->byte_stride : element_size;
+			valid = element_size && accessor.count &&
+				accessor.byte_offset + (accessor.count - 1) * stride + element_size <= view->byte_length;
+			if (!valid)
+				printf("Error loading %s: accessor %u is out of bounds or has an invalid type\n", ctx->path, i);
+		}
+		array_push(ctx->accessors, accessor);
+	}
+
+	array_free(buffers);
+	array_free(buffer_views);
+	array_free(accessors);
+	return valid;
+}
+
+// Buffer views are uploaded once, straight from the mapped file, the first time an accessor needs them.
+static u32 get_view_buffer(Gltf_Context* ctx, s32 buffer_view)
+{
+	if (!ctx->view_buffers[buffer_view])
+	{
+		const Gltf_Buffer_View* view = &ctx->buffer_views[buffer_view];
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		// Not bound as GL_ELEMENT_ARRAY_BUFFER, which would change the VAO being set up.
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, view->byte_length, ctx->buffers[view->buffer].data + view->byte_offset,
+			GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		ctx->view_buffers[buffer_view] = buffer;
+		array_push(ctx->scene->buffers, buffer);
+	}
+	return ctx->view_buffers[buffer_view];
+}
+
+static const u8* get_accessor_data(const Gltf_Context* ctx, const Gltf_Accessor* accessor, u64* stride)
+{
+	const Gltf_Buffer_View* view = &ctx->buffer_views[accessor->buffer_view];
+	*stride = view->byte_stride ? view->byte_stride :
+		(u64)get_component_size(accessor->component_type) * accessor->component_count;
+	return ctx->buffers[view->buffer].data + view->byte_offset + accessor->byte_offset;
+}
+
+static void bind_attribute(Gltf_Context* ctx, GLuint location, s32 accessor_index)
+{
+	const Gltf_Accessor* accessor = &ctx->accessors[accessor_index];
+	const Gltf_Buffer_View* view = &ctx->buffer_views[accessor->buffer_view];
+	glBindBuffer(GL_ARRAY_BUFFER, get_view_buffer(ctx, accessor->buffer_view));
+	glVertexAttribPointer(location, accessor->component_count, accessor->component_type,
+		accessor->normalized ? GL_TRUE : GL_FALSE, view->byte_stride, (void*)accessor->byte_offset);
+	glEnableVertexAttribArray(location);
+}
+
+// The shaders take tangent frames as QTangents, so this is the one attribute that cannot be used as stored.
+static void bind_tangent_frames(Gltf_Context* ctx, s32 normals, s32 tangents)
+{
+	const Gltf_Accessor* normal_accessor = &ctx->accessors[normals];
+	const Gltf_Accessor* tangent_accessor = &ctx->accessors[tangents];
+	u64 normal_stride, tangent_stride;
+	const u8* normal_data = get_accessor_data(ctx, normal_accessor, &normal_stride);
+	const u8* tangent_data = get_accessor_data(ctx, tangent_accessor, &tangent_stride);
+
+	u32 count = tangent_accessor->count;
+	s16* tangent_frames = (s16*)malloc(count * 4 * sizeof(s16));
+	for (u32 i = 0; i < count; ++i)
+	{
+		vec3 normal;
+		vec4 tangent;
+		memcpy(&normal, normal_data + i * normal_stride, sizeof(normal));
+		memcpy(&tangent, tangent_data + i * tangent_stride, sizeof(tangent));
+		mesh_pack_tangent_frame((vec3){tangent.x, tangent.y, tangent.z}, normal, tangent.w, tangent_frames + 4 * i);
+	}
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(s16), tangent_frames, GL_STATIC_DRAW);
+	glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, 4 * sizeof(s16), (void*)0);
+	glEnableVertexAttribArray(3);
+	array_push(ctx->scene->buffers, buffer);
+	free(tangent_frames);
+}
+
+// Decodes an image for a texture, from a buffer view or from a file next to the .glb.
+static u32 load_image(Gltf_Context* ctx, s32 image_index, Texture_Usage usage)
+{
+	const Json_Value* json = ctx->json;
+	s32 image = ctx->images[image_index];
+	s32 view_index = (s32)json_get_number(json, image, "bufferView", -1.0);
+	s32 uri = json_get(json, image, "uri");
+
+	const u8* data = 0;
+	u64 size = 0;
+	bool mapped = false;
+	if (view_index >= 0 && view_index < (s32)array_length(ctx->buffer_views))
+	{
+		const Gltf_Buffer_View* view = &ctx->buffer_views[view_index];
+		data = ctx->buffers[view->buffer].data + view->byte_offset;
+		size = view->byte_length;
+	}
+	else if (uri >= 0 && json[uri].type == JSON_STRING && strncmp(json[uri].string, "data:", 5))
+	{
+		s8 image_path[GLTF_MAX_PATH_LENGTH];
+		get_relative_path(ctx->path, json[uri].string, json[uri].string_length, image_path);
+		data = util_map_file(image_path, &size);
+		mapped = true;
+	}
+
+	// Every loader sets the same vertical flip, since the setting is global and texture streams decode in the
+	// background (see texture_stream.h).
+	stbi_set_flip_vertically_on_load(1);
+	Image_Data image_data;
+	image_data.data = data ? stbi_load_from_memory(data, (s32)size, &image_data.width, &image_data.height,
+		&image_data.channels, 0) : 0;
+	if (mapped && data)
+		util_unmap_file(data, size);
+	if (!image_data.data)
+	{
+		printf("Warning: could not load image %d of %s\n", image_index, ctx->path);
+		return (u32)-1;
+	}
+
+	// glTF texture coordinates start at the top of the image, so the rows are put back in file order.
+	u32 row_size = (u32)(image_data.width * image_data.channels);
+	u8* row = (u8*)malloc(row_size);
+	for (s32 y = 0; y < image_data.height / 2; ++y)
+	{
+		u8* top = image_data.data + (u64)y * row_size;
+		u8* bottom = image_data.data + (u64)(image_data.height - 1 - y) * row_size;
+		memcpy(row, top, row_size);
+		memcpy(top, bottom, row_size);
+		memcpy(bottom, row, row_size);
+	}
+	free(row);
+
+	u32 texture = graphics_texture_create_from_data_with_usage(&image_data, usage);
+	stbi_image_free(image_data.data);
+	array_push(ctx->scene->textures, texture);
+	return texture;
+}
+
+// Returns (u32)-1 if the texture info is missing or its image cannot be loaded.
+static u32 get_texture(Gltf_Context* ctx, s32 texture_info, Texture_Usage usage)
+{
+	const Json_Value* json = ctx->json;
+	s32 texture = get_element(ctx->textures, json_get_number(json, texture_info, "index", -1.0));
+	r64 image_index = json_get_number(json, texture, "source", -1.0);
+	if (get_element(ctx->images, image_index) < 0)
+		return (u32)-1;
+
+	if ((u32)json_get_number(json, texture_info, "texCoord", 0.0) != 0)
+		printf("Warning: %s uses a texture coordinate set other than TEXCOORD_0, which is ignored\n", ctx->path);
+
+	u32* textures = (usage == TEXTURE_USAGE_NORMAL) ? ctx->normal_textures : ctx->albedo_textures;
+	if (!textures[(u32)image_index])
+		textures[(u32)image_index] = load_image(ctx, (s32)image_index, usage);
+	return textures[(u32)image_index];
+}
+
+static void load_material(Gltf_Context* ctx, r64 material_index, bool has_tangents, Diffuse_Info* diffuse_info,
+	Normal_Mapping_Info* normal_info)
+{
+	const Json_Value* json = ctx->json;
+	s32 material = get_element(ctx->materials, material_index);
+
+	memset(diffuse_info, 0, sizeof(*diffuse_info));
+	diffuse_info->diffuse_color = (vec4){1.0f, 1.0f, 1.0f, 1.0f};
+	memset(normal_info, 0, sizeof(*normal_info));
+	if (material < 0)
+		return;
+
+	s32 pbr = json_get(json, material, "pbrMetallicRoughness");
+	json_get_numbers(json, pbr, "baseColorFactor", (r32*)&diffuse_info->diffuse_color, 4);
+	u32 diffuse_map = get_texture(ctx, json_get(json, pbr, "baseColorTexture"), TEXTURE_USAGE_ALBEDO);
+	if (diffuse_map != (u32)-1)
+	{
+		diffuse_info->use_diffuse_map = true;
+		diffuse_info->diffuse_map = diffuse_map;
+	}
+
+	s32 normal_texture = json_get(json, material, "normalTexture");
+	if (normal_texture < 0)
+		return;
+	if (!has_tangents)
+	{
+		printf("Warning: %s has a normal map on a primitive without tangents, which is ignored\n", ctx->path);
+		return;
+	}
+	u32 normal_map = get_texture(ctx, normal_texture, TEXTURE_USAGE_NORMAL);
+	if (normal_map != (u32)-1)
+	{
+		normal_info->use_normal_map = true;
+		normal_info->tangent_space = true;
+		normal_info->normal_map_texture = normal_map;
+	}
+}
+
+static bool is_attribute_valid(const Gltf_Context* ctx, s32 accessor_index, u32 component_count, bool require_float)
+{
+	if (accessor_index < 0 || accessor_index >= (s32)array_length(ctx->accessors))
+		return false;
+	const Gltf_Accessor* accessor = &ctx->accessors[accessor_index];
+	return accessor->buffer_view >= 0 && accessor->component_count == component_count &&
+		(!require_float || accessor->component_type == GL_FLOAT);
+}
+
+// Builds the VAO of a primitive over the uploaded buffer views. Returns false if the primitive is skipped.
+static bool create_primitive(Gltf_Context* ctx, s32 primitive, Gltf_Primitive* result)
+{
+	const Json_Value* json = ctx->json;
+	s32 attributes = json_get(json, primitive, "attributes");
+	s32 positions = (s32)json_get_number(json, attributes, "POSITION", -1.0);
+	s32 normals = (s32)json_get_number(json, attributes, "NORMAL", -1.0);
+	s32 texture_coordinates = (s32)json_get_number(json, attributes, "TEXCOORD_0", -1.0);
+	s32 tangents = (s32)json_get_number(json, attributes, "TANGENT", -1.0);
+	s32 indices = (s32)json_get_number(json, primitive, "indices", -1.0);
+
+	if (json_get_number(json, primitive, "mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+	{
+		printf("Warning: %s has a primitive that is not made of triangles, which is skipped\n", ctx->path);
+		return false;
+	}
+	if (!is_attribute_valid(ctx, positions, 3, true) || !is_attribute_valid(ctx, indices, 1, false))
+	{
+		printf("Warning: %s has a primitive without valid positions or indices, which is skipped\n", ctx->path);
+		return false;
+	}
+	if (!is_attribute_valid(ctx, normals, 3, true))
+		normals = -1;
+	if (!is_attribute_valid(ctx, texture_coordinates, 2, false))
+		texture_coordinates = -1;
+	if (normals < 0 || !is_attribute_valid(ctx, tangents, 4, true) ||
+		ctx->accessors[tangents].count != ctx->accessors[normals].count)
+		tangents = -1;
+
+	const Gltf_Accessor* index_accessor = &ctx->accessors[indices];
+	u32 index_type = index_accessor->component_type;
+	if (index_type != GL_UNSIGNED_BYTE && index_type != GL_UNSIGNED_SHORT && index_type != GL_UNSIGNED_INT)
+	{
+		printf("Warning: %s has a primitive with an invalid index type, which is skipped\n", ctx->path);
+		return false;
+	}
+
+	Mesh* mesh = &result->mesh;
+	memset(mesh, 0, sizeof(*mesh));
+	glGenVertexArrays(1, &mesh->VAO);
+	glBindVertexArray(mesh->VAO);
+
+	bind_attribute(ctx, 0, positions);
+	// Attributes without data read the constant generic value instead, which is context state: every glTF mesh sets
+	// the same ones, and meshes created elsewhere always have all their attributes.
+	if (normals >= 0)
+		bind_attribute(ctx, 1, normals);
+	else
+	{
+		printf("Warning: %s has a primitive without normals, which is lit as if facing +z\n", ctx->path);
+		glVertexAttrib3f(1, 0.0f, 0.0f, 1.0f);
+	}
+	if (texture_coordinates >= 0)
+		bind_attribute(ctx, 2, texture_coordinates);
+	else
+		glVertexAttrib2f(2, 0.0f, 0.0f);
+	if (tangents >= 0)
+		bind_tangent_frames(ctx, normals, tangents);
+	else
+		glVertexAttrib4f(3, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	mesh->VBO = get_view_buffer(ctx, ctx->accessors[positions].buffer_view);
+	mesh->EBO = get_view_buffer(ctx, index_accessor->buffer_view);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	mesh->index_count = index_accessor->count;
+	mesh->index_type = index_type;
+	mesh->index_offset = index_accessor->byte_offset;
+
+	// The bounds of positions are required by the format, but the box is recomputed if they are missing.
+	const Gltf_Accessor* position_accessor = &ctx->accessors[positions];
+	r32 min[3], max[3];
+	memcpy(min, position_accessor->min, sizeof(min));
+	memcpy(max, position_accessor->max, sizeof(max));
+	if (!position_accessor->has_bounds)
+	{
+		u64 stride;
+		const u8* data = get_accessor_data(ctx, position_accessor, &stride);
+		for (u32 j = 0; j < 3; ++j)
+		{
+			min[j] = INFINITY;
+			max[j] = -INFINITY;
+		}
+		for (u32 i = 0; i < position_accessor->count; ++i)
+		{
+			r32 position[3];
+			memcpy(position, data + i * stride, sizeof(position));
+			for (u32 j = 0; j < 3; ++j)
+			{
+				min[j] = fminf(min[j], position[j]);
+				max[j] = fmaxf(max[j], position[j]);
+			}
+		}
+	}
+	vec3 extent = {fmaxf(fabsf(min[0]), fabsf(max[0])), fmaxf(fabsf(min[1]), fabsf(max[1])),
+		fmaxf(fabsf(min[2]), fabsf(max[2]))};
+	mesh->bounding_radius = gm_vec3_length(extent);
+
+	load_material(ctx, json_get_number(json, primitive, "material", -1.0), tangents >= 0, &result->diffuse_info,
+		&mesh->normal_info);
+	array_push(ctx->scene->meshes, *mesh);
+	return true;
+}
+
+static Gltf_Primitive* get_mesh_primitives(Gltf_Context* ctx, u32 mesh_index)
+{
+	if (!ctx->primitives[mesh_index])
+	{
+		Gltf_Primitive* primitives = array_new(Gltf_Primitive);
+		s32* elements = json_get_elements(ctx->json, json_get(ctx->json, ctx->meshes[mesh_index], "primitives"));
+		for (u32 i = 0; i < array_length(elements); ++i)
+		{
+			Gltf_Primitive primitive;
+			if (create_primitive(ctx, elements[i], &primitive))
+				array_push(primitives, primitive);
+		}
+		array_free(elements);
+		ctx->primitives[mesh_index] = primitives;
+	}
+	return ctx->primitives[mesh_index];
+}
+
+static mat4 get_local_transform(const Json_Value* json, s32 node)
+{
+	r32 m[16];
+	if (json_get_numbers(json, node, "matrix", m, 16) == 16)
+	{
+		// Stored column by column.
+		mat4 result;
+		for (u32 row = 0; row < 4; ++row)
+			for (u32 column = 0; column < 4; ++column)
+				result.data[row][column] = m[column * 4 + row];
+		return result;
+	}
+
+	vec3 translation = {0.0f, 0.0f, 0.0f};
+	Quaternion rotation = {0.0f, 0.0f, 0.0f, 1.0f};
+	vec3 scale = {1.0f, 1.0f, 1.0f};
+	json_get_numbers(json, node, "translation", (r32*)&translation, 3);
+	json_get_numbers(json, node, "rotation", &rotation.x, 4);
+	json_get_numbers(json, node, "scale", (r32*)&scale, 3);
+
+	mat4 translation_matrix = (mat4) {
+		1.0f, 0.0f, 0.0f, translation.x,
+		0.0f, 1.0f, 0.0f, translation.y,
+		0.0f, 0.0f, 1.0f, translation.z,
+		0.0f, 0.0f, 0.0f, 1.0f
+	};
+	mat4 rotation_matrix = quaternion_get_matrix(&rotation);
+	mat4 scale_matrix = gm_mat4_scale(scale);
+	mat4 result = gm_mat4_multiply(&rotation_matrix, &scale_matrix);
+	return gm_mat4_multiply(&translation_matrix, &result);
+}
+
+// Entities are placed with a position, rotation and scale, so the global transform is split into those. Shear, which
+// only comes from non-uniform scales above rotated children, cannot be represented and is lost.
+static void decompose_transform(const mat4* transform, vec3* position, Quaternion* rotation, vec3* scale)
+{
+	*position = (vec3){transform->data[0][3], transform->data[1][3], transform->data[2][3]};
+	r32 scales[3];
+	for (u32 column = 0; column < 3; ++column)
+		scales[column] = gm_vec3_length((vec3){transform->data[0][column], transform->data[1][column],
+			transform->data[2][column]});
+
+	r32 determinant =
+		transform->data[0][0] * (transform->data[1][1] * transform->data[2][2] - transform->data[1][2] * transform->data[2][1]) -
+		transform->data[0][1] * (transform->data[1][0] * transform->data[2][2] - transform->data[1][2] * transform->data[2][0]) +
+		transform->data[0][2] * (transform->data[1][0] * transform->data[2][1] - transform->data[1][1] * transform->data[2][0]);
+	if (determinant < 0.0f)
+		scales[0] = -scales[0];
+	*scale = (vec3){scales[0], scales[1], scales[2]};
+
+	mat4 rotation_matrix = gm_mat4_identity();
+	for (u32 row = 0; row < 3; ++row)
+		for (u32 column = 0; column < 3; ++column)
+			rotation_matrix.data[row][column] = scales[column] != 0.0f ?
+				transform->data[row][column] / scales[column] : 0.0f;
+	*rotation = quaternion_from_matrix(&rotation_matrix);
+	*rotation = quaternion_normalize(rotation);
+}
+
+static void add_node(Gltf_Context* ctx, s32 node, const mat4* parent_transform, u32 depth)
+{
+	if (depth == GLTF_MAX_NODE_DEPTH)
+	{
+		printf("Warning: %s has nodes nested too deeply, which are skipped\n", ctx->path);
+		return;
+	}
+
+	const Json_Value* json = ctx->json;
+	mat4 local_transform = get_local_transform(json, node);
+	mat4 transform = gm_mat4_multiply(parent_transform, &local_transform);
+
+	r64 mesh_index = json_get_number(json, node, "mesh", -1.0);
+	if (get_element(ctx->meshes, mesh_index) >= 0)
+	{
+		vec3 position, scale;
+		Quaternion rotation;
+		decompose_transform(&transform, &position, &rotation, &scale);
+
+		Gltf_Primitive* primitives = get_mesh_primitives(ctx, (u32)mesh_index);
+		for (u32 i = 0; i < array_length(primitives); ++i)
+		{
+			Entity entity;
+			if (primitives[i].diffuse_info.use_diffuse_map)
+				graphics_entity_create_with_texture(&entity, primitives[i].mesh, position, rotation, scale,
+					primitives[i].diffuse_info.diffuse_map);
+			else
+				graphics_entity_create_with_color(&entity, primitives[i].mesh, position, rotation, scale,
+					primitives[i].diffuse_info.diffuse_color);
+			entity.diffuse_info.diffuse_color = primitives[i].diffuse_info.diffuse_color;
+			array_push(ctx->scene->entities, entity);
+		}
+	}
+
+	s32* children = json_get_elements(json, json_get(json, node, "children"));
+	for (u32 i = 0; i < array_length(children); ++i)
+	{
+		s32 child = get_element(ctx->nodes, json[children[i]].type == JSON_NUMBER ? json[children[i]].number : -1.0);
+		if (child >= 0)
+			add_node(ctx, child, &transform, depth + 1);
+	}
+	array_free(children);
+}
+
+static void add_scene(Gltf_Context* ctx, s32 root)
+{
+	const Json_Value* json = ctx->json;
+	mat4 identity = gm_mat4_identity();
+
+	s32* scenes = json_get_elements(json, json_get(json, root, "scenes"));
+	s32 scene = get_element(scenes, json_get_number(json, root, "scene", 0.0));
+	array_free(scenes);
+
+	s32* roots = json_get_elements(json, json_get(json, scene, "nodes"));
+	for (u32 i = 0; i < array_length(roots); ++i)
+	{
+		s32 node = get_element(ctx->nodes, json[roots[i]].type == JSON_NUMBER ? json[roots[i]].number : -1.0);
+		if (node >= 0)
+			add_node(ctx, node, &identity, 0);
+	}
+	array_free(roots);
+}
+
+static u32* new_zeroed_array(u32 length)
+{
+	u32* array = array_new(u32);
+	for (u32 i = 0; i < length; ++i)
+		array_push(array, 0);
+	return array;
+}
+
+bool gltf_load_glb(const s8* path, Gltf_Scene* scene)
+{
+	u64 file_size;
+	const u8* file = util_map_file(path, &file_size);
+	if (!file)
+	{
+		printf("Error loading %s: could not open file\n", path);
+		return false;
+	}
+
+	// 12-byte header, then the JSON chunk and optionally the binary chunk, each with an 8-byte header.
+	u32 header[5];
+	if (file_size < sizeof(header))
+	{
+		printf("Error loading %s: not a binary glTF file\n", path);
+		util_unmap_file(file, file_size);
+		return false;
+	}
+	memcpy(header, file, sizeof(header));
+	u64 json_size = header[3];
+	if (header[0] != GLB_MAGIC || header[1] != GLB_VERSION || header[4] != GLB_CHUNK_JSON ||
+		sizeof(header) + json_size > file_size)
+	{
+		printf("Error loading %s: not a binary glTF 2.0 file\n", path);
+		util_unmap_file(file, file_size);
+		return false;
+	}
+
+	const u8* bin_chunk = 0;
+	u64 bin_chunk_size = 0;
+	u64 bin_chunk_header = sizeof(header) + json_size;
+	if (bin_chunk_header + 8 <= file_size)
+	{
+		u32 chunk_header[2];
+		memcpy(chunk_header, file + bin_chunk_header, sizeof(chunk_header));
+		if (chunk_header[1] == GLB_CHUNK_BIN && bin_chunk_header + 8 + chunk_header[0] <= file_size)
+		{
+			bin_chunk = file + bin_chunk_header + 8;
+			bin_chunk_size = chunk_header[0];
+		}
+	}
+
+	Gltf_Context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.path = path;
+	ctx.json = json_parse((const s8*)file + sizeof(header), json_size);
+	ctx.buffers = array_new(Gltf_Buffer);
+	ctx.buffer_views = array_new(Gltf_Buffer_View);
+	ctx.accessors = array_new(Gltf_Accessor);
+	ctx.scene = scene;
+	scene->entities = array_new(Entity);
+	scene->meshes = array_new(Mesh);
+	scene->buffers = array_new(u32);
+	scene->textures = array_new(u32);
+
+	bool loaded = false;
+	if (!ctx.json || ctx.json[0].type != JSON_OBJECT)
+		printf("Error loading %s: invalid JSON chunk\n", path);
+	else if (json_get(ctx.json, 0, "extensionsRequired") >= 0)
+		printf("Error loading %s: required extensions are not supported\n", path);
+	else if (load_buffers(&ctx, 0, bin_chunk, bin_chunk_size))
+	{
+		ctx.materials = json_get_elements(ctx.json, json_get(ctx.json, 0, "materials"));
+		ctx.textures = json_get_elements(ctx.json, json_get(ctx.json, 0, "textures"));
+		ctx.images = json_get_elements(ctx.json, json_get(ctx.json, 0, "images"));
+		ctx.meshes = json_get_elements(ctx.json, json_get(ctx.json, 0, "meshes"));
+		ctx.nodes = json_get_elements(ctx.json, json_get(ctx.json, 0, "nodes"));
+		ctx.view_buffers = new_zeroed_array(array_length(ctx.buffer_views));
+		ctx.albedo_textures = new_zeroed_array(array_length(ctx.images));
+		ctx.normal_textures = new_zeroed_array(array_length(ctx.images));
+		ctx.primitives = array_new(Gltf_Primitive*);
+		for (u32 i = 0; i < array_length(ctx.meshes); ++i)
+			array_push(ctx.primitives, 0);
+
+		add_scene(&ctx, 0);
+		loaded = true;
+
+		for (u32 i = 0; i < array_length(ctx.primitives); ++i)
+			if (ctx.primitives[i])
+				array_free(ctx.primitives[i]);
+		array_free(ctx.primitives);
+		array_free(ctx.view_buffers);
+		array_free(ctx.albedo_textures);
+		array_free(ctx.normal_textures);
+		array_free(ctx.materials);
+		array_free(ctx.textures);
+		array_free(ctx.images);
+		array_free(ctx.meshes);
+		array_free(ctx.nodes);
+	}
+
+	for (u32 i = 0; i < array_length(ctx.buffers); ++i)
+		if (ctx.buffers[i].mapped && ctx.buffers[i].data)
+			util_unmap_file(ctx.buffers[i].data, ctx.buffers[i].size);
+	array_free(ctx.buffers);
+	array_free(ctx.buffer_views);
+	array_free(ctx.accessors);
+	if (ctx.json)
+		array_free(ctx.json);
+	// GL has its own copy of everything by now.
+	util_unmap_file(file, file_size);
+
+	if (!loaded)
+		gltf_scene_destroy(scene);
+	return loaded;
+}
+
+void gltf_scene_destroy(Gltf_Scene* scene)
+{
+	for (u32 i = 0; i < array_length(scene->meshes); ++i)
+		glDeleteVertexArrays(1, &scene->meshes[i].VAO);
+	glDeleteBuffers(array_length(scene->buffers), scene->buffers);
+	for (u32 i = 0; i < array_length(scene->textures); ++i)
+		graphics_texture_delete(scene->textures[i]);
+
+	array_free(scene->entities);
+	array_free(scene->meshes);
+	array_free(scene->buffers);
+	array_free(scene->textures);
+}
\ No newline at end of file
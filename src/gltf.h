@@ -0,0 +1,30 @@
+#ifndef BASIC_ENGINE_GLTF_H
+#define BASIC_ENGINE_GLTF_H
+#include "graphics.h"
+
+#define GLTF_FILE_EXTENSION ".glb"
+
+typedef struct
+{
+	// One entity per triangle primitive of every mesh instance in the default scene, placed with the global transform
+	// of its node. Entities of the same glTF mesh share their meshes, and meshes share GPU buffers and textures: all of
+	// them are owned by the scene, so entities must not be passed to graphics_entity_destroy or
+	// graphics_entity_mesh_replace. Release everything with gltf_scene_destroy instead.
+	Entity* entities;
+	Mesh* meshes;
+	u32* buffers;
+	u32* textures;
+} Gltf_Scene;
+
+// Loads a binary glTF 2.0 file. The file is mapped and the buffer views used by the primitives are uploaded as they
+// are stored, one GL buffer each, with the accessors mapped to vertex attributes: POSITION, NORMAL and TEXCOORD_0 in
+// any component type the format allows, and indices as 8, 16 or 32 bit (see Mesh). TANGENT is the only attribute
+// converted on the CPU, since the shaders take tangent frames as QTangents (see mesh/tangents.h).
+// Materials are read as the base color factor and texture, plus the normal texture for primitives with tangents.
+// Buffers may also be external files next to the .glb. Primitives that are not indexed triangles, embedded data URIs
+// and files requiring extensions are not supported; the first two are skipped with a warning.
+// Returns false if the file cannot be loaded, with nothing left to release.
+bool gltf_load_glb(const s8* path, Gltf_Scene* scene);
+void gltf_scene_destroy(Gltf_Scene* scene);
+
+#endif
\ No newline at end of file
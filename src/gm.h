@@ -4,6 +4,10 @@
 #include <math.h>
 #include <assert.h>
 #include <stdio.h>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GM_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 #define PI_F 3.14159265358979f
 
@@ -104,6 +108,8 @@ int   gm_mat4_inverse(const mat4* m, mat4* out);
 vec4  gm_mat4_multiply_vec4(const mat4* m, vec4 v);
 vec3  gm_mat4_multiply_vec3(const mat4* m, vec3 v);
 mat4  gm_mat4_multiply(const mat4* m1, const mat4* m2);
+// out[i] = m * in[i] for every i. Uses SSE when available.
+void  gm_mat4_multiply_batch(const mat4* m, const mat4* in, mat4* out, s32 count);
 mat4  gm_mat4_transpose(const mat4* m);
 mat4  gm_mat4_identity(void);
 mat4  gm_mat4_scalar_product(r32 scalar, const mat4* m);
@@ -399,6 +405,38 @@ vec3 gm_mat3_multiply_vec3(const mat3* m, vec3 v) {
 	return result;
 }
 
+void gm_mat4_multiply_batch(const mat4* m, const mat4* in, mat4* out, s32 count)
+{
+#ifdef GM_USE_SSE
+	// Row i of the result is the sum of the rows of in[k] weighted by m[i][0..3], so the broadcasts of m
+	// are computed once and reused for the whole batch.
+	__m128 m_broadcast[4][4];
+	for (s32 i = 0; i < 4; ++i)
+		for (s32 j = 0; j < 4; ++j)
+			m_broadcast[i][j] = _mm_set1_ps(m->data[i][j]);
+
+	for (s32 k = 0; k < count; ++k)
+	{
+		__m128 row0 = _mm_loadu_ps(in[k].data[0]);
+		__m128 row1 = _mm_loadu_ps(in[k].data[1]);
+		__m128 row2 = _mm_loadu_ps(in[k].data[2]);
+		__m128 row3 = _mm_loadu_ps(in[k].data[3]);
+
+		for (s32 i = 0; i < 4; ++i)
+		{
+			__m128 r = _mm_mul_ps(m_broadcast[i][0], row0);
+			r = _mm_add_ps(r, _mm_mul_ps(m_broadcast[i][1], row1));
+			r = _mm_add_ps(r, _mm_mul_ps(m_broadcast[i][2], row2));
+			r = _mm_add_ps(r, _mm_mul_ps(m_broadcast[i][3], row3));
+			_mm_storeu_ps(out[k].data[i], r);
+		}
+	}
+#else
+	for (s32 k = 0; k < count; ++k)
+		out[k] = gm_mat4_multiply(m, &in[k]);
+#endif
+}
+
 mat3 gm_mat4_to_mat3(const mat4* m) {
 	mat3 result;
 	result.data[0][0] = m->data[0][0];
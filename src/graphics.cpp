@@ -1,37 +1,147 @@
 #include "graphics.h"
 #include "util.h"
 #include "obj.h"
+#include "shader_cache.h"
+#include "embedded_shaders.h"
+#include "texture_stream.h"
+#include "texture_compression.h"
+#include "mipmap.h"
+#include "image_convert.h"
+#include "mesh/cache.h"
+#include "mesh/optimize.h"
+#include "mesh/tangents.h"
 #include <GL/glew.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include <light_array.h>
 #include <math.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
 #define PHONG_VERTEX_SHADER_PATH "./shaders/phong_shader.vs"
 #define PHONG_FRAGMENT_SHADER_PATH "./shaders/phong_shader.fs"
 #define BASIC_VERTEX_SHADER_PATH "./shaders/basic_shader.vs"
 #define BASIC_FRAGMENT_SHADER_PATH "./shaders/basic_shader.fs"
+#define PHONG_MAX_LIGHT_QUANTITY 16
+
+extern dvec2 framebuffer_size;
+
+// Feature bits of the phong shader permutations. Each bit maps to a #define in phong_shader.fs.
+typedef enum {
+	PHONG_FEATURE_DIFFUSE_MAP = 1 << 0,
+	PHONG_FEATURE_NORMAL_MAP = 1 << 1,
+	PHONG_FEATURE_ATLAS_BATCH = 1 << 2,
+	PHONG_FEATURE_NORMAL_MAP_XY = 1 << 3,
+	PHONG_FEATURE_TANGENT_SPACE_NORMAL_MAP = 1 << 4,
+} Phong_Feature;
+
+// Per-instance attributes of the USE_ATLAS_BATCH phong variant. Matrices are stored column by column, as GLSL
+// expects for matrix attributes.
+typedef struct
+{
+	r32 model_matrix[4][4];
+	r32 normal_matrix[3][3];
+	vec4 atlas_uv_transform;
+	r32 atlas_layer;
+} Phong_Instance;
+
+#define PHONG_MAX_BATCH_INSTANCES 256
+#define PHONG_INSTANCE_ATTRIBUTE_FIRST 4
+#define PHONG_INSTANCE_ATTRIBUTE_LAST 12
+
+static u32 phong_instance_buffer;
 
 Image_Data graphics_image_load(const s8* image_path)
 {
 	Image_Data image_data;
 
 	stbi_set_flip_vertically_on_load(1);
-	image_data.data = stbi_load(image_path, &image_data.width, &image_data.height, &image_data.channels, 4);
-
-	image_data.channels = 4;	// @temporary
+	image_data.data = stbi_load(image_path, &image_data.width, &image_data.height, &image_data.channels, 0);
 
 	return image_data;
 }
 
+// Returns 0 if the image cannot be found.
+static u64 get_mip_cache_key(const s8* image_path, const Mipmap_Options* options, s8* cache_path)
+{
+	struct stat file_info;
+	if (stat(image_path, &file_info))
+		return 0;
+
+	// The cached chain is only valid for the same file contents (approximated by size and modification time)
+	// and the same filtering options.
+	u64 file_size = file_info.st_size, modification_time = file_info.st_mtime;
+	u64 key = util_hash(image_path, strlen(image_path) + 1, UTIL_HASH_SEED);
+	key = util_hash(&file_size, sizeof(file_size), key);
+	key = util_hash(&modification_time, sizeof(modification_time), key);
+	key = util_hash(&options->filter, sizeof(options->filter), key);
+	key = util_hash(&options->gamma_correct, sizeof(options->gamma_correct), key);
+
+	sprintf(cache_path, "%s/%016llx.bin", MIPMAP_CACHE_DIRECTORY, (unsigned long long)key);
+	return key;
+}
+
+Image_Data* graphics_image_load_with_mips(const s8* image_path, Texture_Usage usage)
+{
+	Mipmap_Options options = mipmap_get_default_options(usage);
+	s8 cache_path[256];
+	u64 key = get_mip_cache_key(image_path, &options, cache_path);
+	if (!key)
+	{
+		printf("Error loading texture %s\n", image_path);
+		return 0;
+	}
+
+	Image_Data* levels = mipmap_load(cache_path, key);
+	if (levels)
+		return levels;
+
+	Image_Data image_data = graphics_image_load(image_path);
+	if (!image_data.data)
+	{
+		printf("Error loading texture %s\n", image_path);
+		return 0;
+	}
+
+	levels = mipmap_generate(&image_data, &options);
+	graphics_image_free(&image_data);
+
+	if (util_create_directory(MIPMAP_CACHE_DIRECTORY))
+		mipmap_save(cache_path, key, levels);
+
+	return levels;
+}
+
+Image_Data graphics_image_load_mip_level(const s8* image_path, Texture_Usage usage, s32 level)
+{
+	Mipmap_Options options = mipmap_get_default_options(usage);
+	s8 cache_path[256];
+	u64 key = get_mip_cache_key(image_path, &options, cache_path);
+
+	Image_Data level_data;
+	if (key && mipmap_load_level(cache_path, key, level, &level_data))
+		return level_data;
+
+	// Not cached yet: the whole chain is built (and cached), and only the level is kept.
+	level_data.data = 0;
+	Image_Data* levels = graphics_image_load_with_mips(image_path, usage);
+	if (!levels)
+		return level_data;
+	if (level >= 0 && level < (s32)array_length(levels))
+	{
+		level_data = levels[level];
+		levels[level].data = 0;
+	}
+	mipmap_free(levels);
+	return level_data;
+}
+
 Float_Image_Data graphics_float_image_load(const s8* image_path)
 {
 	Image_Data image_data;
 
 	stbi_set_flip_vertically_on_load(1);
-	image_data.data = stbi_load(image_path, &image_data.width, &image_data.height, &image_data.channels, 4);
-
-	image_data.channels = 4;	// @temporary
+	image_data.data = stbi_load(image_path, &image_data.width, &image_data.height, &image_data.channels, 0);
 
 	Float_Image_Data fid = graphics_image_data_to_float_image_data(&image_data, 0);
 
@@ -75,65 +185,281 @@ void graphics_float_image_save(const s8* image_path, const Float_Image_Data* ima
 	graphics_image_free(&id);
 }
 
-Shader graphics_shader_create(const s8* vertex_shader_path, const s8* fragment_shader_path)
+typedef struct {
+	Shader program;
+	u32 vertex_shader;
+	u32 fragment_shader;
+	u64 cache_key;
+	bool failed;
+} Pending_Shader;
+
+// Programs that were submitted to the driver but whose compile/link status was not queried yet.
+static Pending_Shader* pending_shaders;
+
+// Compiles and links without querying any status, so the driver is free to do the work in the background.
+static Pending_Shader shader_program_submit(const s8* vertex_shader_code, const s8* fragment_shader_code, u64 cache_key)
 {
-	s8* vertex_shader_code = util_read_file(vertex_shader_path, 0);
-	s8* fragment_shader_code = util_read_file(fragment_shader_path, 0);
+	static bool parallel_compile_initialized = false;
+	if (!parallel_compile_initialized)
+	{
+		if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);	// Let the driver pick
+		parallel_compile_initialized = true;
+	}
 
+	Pending_Shader pending;
+	pending.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+	pending.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+	pending.cache_key = cache_key;
+	pending.failed = false;
+	glShaderSource(pending.vertex_shader, 1, (const GLchar *const*)&vertex_shader_code, 0);
+	glShaderSource(pending.fragment_shader, 1, (const GLchar *const*)&fragment_shader_code, 0);
+	glCompileShader(pending.vertex_shader);
+	glCompileShader(pending.fragment_shader);
+
+	pending.program = glCreateProgram();
+	glAttachShader(pending.program, pending.vertex_shader);
+	glAttachShader(pending.program, pending.fragment_shader);
+	shader_cache_prepare_program(pending.program);
+	glLinkProgram(pending.program);
+
+	return pending;
+}
+
+// Queries the results of a submitted program (blocking if the driver is not done yet), reports errors and
+// stores the program in the shader cache. The shader objects are released either way.
+static bool shader_program_finalize(Pending_Shader* pending)
+{
 	GLint success;
 	GLchar info_log_buffer[1024];
-	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(vertex_shader, 1, (const GLchar *const*)&vertex_shader_code, 0);
-	glShaderSource(fragment_shader, 1, (const GLchar *const*)&fragment_shader_code, 0);
 
-	glCompileShader(vertex_shader);
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(pending->vertex_shader, GL_COMPILE_STATUS, &success);
 	if (!success)
 	{
-		glGetShaderInfoLog(vertex_shader, 1024, 0, info_log_buffer);
+		glGetShaderInfoLog(pending->vertex_shader, 1024, 0, info_log_buffer);
 		printf("Error compiling vertex shader: %s\n", info_log_buffer);
 	}
 
-	glCompileShader(fragment_shader);
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(pending->fragment_shader, GL_COMPILE_STATUS, &success);
 	if (!success)
 	{
-		glGetShaderInfoLog(fragment_shader, 1024, 0, info_log_buffer);
+		glGetShaderInfoLog(pending->fragment_shader, 1024, 0, info_log_buffer);
 		printf("Error compiling fragment shader: %s\n", info_log_buffer);
 	}
 
-	GLuint shader_program = glCreateProgram();
-
-	glAttachShader(shader_program, vertex_shader);
-	glAttachShader(shader_program, fragment_shader);
-	glLinkProgram(shader_program);
-
-	glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+	glGetProgramiv(pending->program, GL_LINK_STATUS, &success);
 	if (!success)
 	{
-		glGetShaderInfoLog(shader_program, 1024, 0, info_log_buffer);
+		glGetProgramInfoLog(pending->program, 1024, 0, info_log_buffer);
 		printf("Error linking program: %s\n", info_log_buffer);
 	}
+	else
+	{
+		glDetachShader(pending->program, pending->vertex_shader);
+		glDetachShader(pending->program, pending->fragment_shader);
+		shader_cache_store(pending->cache_key, pending->program);
+	}
+
+	glDeleteShader(pending->vertex_shader);
+	glDeleteShader(pending->fragment_shader);
+	pending->vertex_shader = 0;
+	pending->fragment_shader = 0;
+	return success;
+}
+
+// Returns a new string with the defines placed right after the #version directive, which must stay the first statement.
+static s8* shader_code_inject_defines(const s8* shader_code, const s8* defines)
+{
+	const s8* version_line_end = shader_code;
+	if (strncmp(shader_code, "#version", 8) == 0)
+	{
+		version_line_end = strchr(shader_code, '\n');
+		version_line_end = version_line_end ? version_line_end + 1 : shader_code + strlen(shader_code);
+	}
+
+	// A #line directive is appended so that compile errors keep pointing to the lines in the original file.
+	const s8* line_directive = "#line 2\n";
+	size_t version_line_length = version_line_end - shader_code;
+	size_t new_length = strlen(shader_code) + strlen(defines) + strlen(line_directive) + 1;
+	s8* new_code = (s8*)malloc(new_length + 1);
+	memcpy(new_code, shader_code, version_line_length);
+	new_code[version_line_length] = '\0';
+	if (version_line_length > 0 && new_code[version_line_length - 1] != '\n')
+		strcat(new_code, "\n");
+	strcat(new_code, defines);
+	if (version_line_length > 0)
+		strcat(new_code, line_directive);
+	strcat(new_code, version_line_end);
+	return new_code;
+}
+
+Shader graphics_shader_create(const s8* vertex_shader_path, const s8* fragment_shader_path)
+{
+	return graphics_shader_create_with_defines(vertex_shader_path, fragment_shader_path, 0);
+}
+
+// Reads both shaders and injects the defines. Returns the cache key of the resulting sources.
+static u64 shader_code_load(const s8* vertex_shader_path, const s8* fragment_shader_path, const s8* defines,
+	s8** vertex_shader_code, s8** fragment_shader_code)
+{
+	*vertex_shader_code = embedded_shader_read(vertex_shader_path);
+	*fragment_shader_code = embedded_shader_read(fragment_shader_path);
+
+	if (defines && *defines)
+	{
+		s8* code = shader_code_inject_defines(*vertex_shader_code, defines);
+		free(*vertex_shader_code);
+		*vertex_shader_code = code;
+		code = shader_code_inject_defines(*fragment_shader_code, defines);
+		free(*fragment_shader_code);
+		*fragment_shader_code = code;
+	}
+
+	return shader_cache_key(*vertex_shader_code, *fragment_shader_code, defines);
+}
+
+Shader graphics_shader_create_with_defines(const s8* vertex_shader_path, const s8* fragment_shader_path, const s8* defines)
+{
+	s8* vertex_shader_code;
+	s8* fragment_shader_code;
+	u64 cache_key = shader_code_load(vertex_shader_path, fragment_shader_path, defines, &vertex_shader_code, &fragment_shader_code);
+
+	// Try the on-disk program binary first, only falling back to a full compile on a miss.
+	Shader shader_program = shader_cache_load(cache_key);
+	if (!shader_program)
+	{
+		Pending_Shader pending = shader_program_submit(vertex_shader_code, fragment_shader_code, cache_key);
+		shader_program = pending.program;
+		if (!shader_program_finalize(&pending))
+		{
+			glDeleteProgram(shader_program);
+			shader_program = 0;
+		}
+	}
+
+	free(vertex_shader_code);
+	free(fragment_shader_code);
+	return shader_program;
+}
+
+Shader graphics_shader_create_async(const s8* vertex_shader_path, const s8* fragment_shader_path, const s8* defines)
+{
+	s8* vertex_shader_code;
+	s8* fragment_shader_code;
+	u64 cache_key = shader_code_load(vertex_shader_path, fragment_shader_path, defines, &vertex_shader_code, &fragment_shader_code);
+
+	// Cached binaries are ready right away.
+	Shader shader_program = shader_cache_load(cache_key);
+	if (!shader_program)
+	{
+		Pending_Shader pending = shader_program_submit(vertex_shader_code, fragment_shader_code, cache_key);
+		if (!pending_shaders)
+			pending_shaders = array_new(Pending_Shader);
+		array_push(pending_shaders, pending);
+		shader_program = pending.program;
+	}
 
 	free(vertex_shader_code);
 	free(fragment_shader_code);
 	return shader_program;
 }
 
+bool graphics_shader_is_ready(Shader shader)
+{
+	if (!pending_shaders)
+		return true;
+
+	for (u32 i = 0; i < array_length(pending_shaders); ++i)
+	{
+		Pending_Shader* pending = &pending_shaders[i];
+		if (pending->program != shader)
+			continue;
+
+		if (pending->failed)
+			return false;
+
+		// Without GL_ARB_parallel_shader_compile there is no way to poll, so the status query below may block.
+		if (GLEW_ARB_parallel_shader_compile)
+		{
+			GLint completed;
+			glGetProgramiv(pending->program, GL_COMPLETION_STATUS_ARB, &completed);
+			if (!completed)
+				return false;
+		}
+
+		if (!shader_program_finalize(pending))
+		{
+			// Failed programs are kept around so that callers keep using their fallback.
+			pending->failed = true;
+			return false;
+		}
+
+		array_remove(pending_shaders, i);
+		return true;
+	}
+
+	return true;
+}
+
+typedef struct {
+	u32 key;
+	Shader shader;
+} Shader_Variant;
+
 typedef struct {
-	Shader phong_shader;
+	Shader_Variant* phong_variants;
 	Shader basic_shader;
 	bool initialized;
 } Predefined_Shaders;
 
 Predefined_Shaders predefined_shaders;
 
+// Phong variants are identified by their feature bits plus the number of lights.
+// Each variant is compiled the first time some material needs it and reused afterwards.
+static Shader get_phong_shader_variant(u32 features, s32 light_quantity)
+{
+	if (light_quantity > PHONG_MAX_LIGHT_QUANTITY)
+	{
+		printf("Phong shader supports at most %d lights, ignoring the remaining ones\n", PHONG_MAX_LIGHT_QUANTITY);
+		light_quantity = PHONG_MAX_LIGHT_QUANTITY;
+	}
+
+	u32 key = features | ((u32)light_quantity << 16);
+	for (u32 i = 0; i < array_length(predefined_shaders.phong_variants); ++i)
+		if (predefined_shaders.phong_variants[i].key == key)
+			return predefined_shaders.phong_variants[i].shader;
+
+	s8 defines[256];
+	s32 defines_length = sprintf(defines, "#define LIGHT_QUANTITY %d\n", light_quantity);
+	if (features & PHONG_FEATURE_DIFFUSE_MAP)
+		defines_length += sprintf(defines + defines_length, "#define USE_DIFFUSE_MAP\n");
+	if (features & PHONG_FEATURE_NORMAL_MAP)
+		defines_length += sprintf(defines + defines_length, "#define USE_NORMAL_MAP\n");
+	if (features & PHONG_FEATURE_ATLAS_BATCH)
+		defines_length += sprintf(defines + defines_length, "#define USE_ATLAS_BATCH\n");
+	if (features & PHONG_FEATURE_NORMAL_MAP_XY)
+		defines_length += sprintf(defines + defines_length, "#define NORMAL_MAP_XY\n");
+	if (features & PHONG_FEATURE_TANGENT_SPACE_NORMAL_MAP)
+		defines_length += sprintf(defines + defines_length, "#define TANGENT_SPACE_NORMAL_MAP\n");
+
+	Shader_Variant variant;
+	variant.key = key;
+	variant.shader = graphics_shader_create_async(PHONG_VERTEX_SHADER_PATH, PHONG_FRAGMENT_SHADER_PATH, defines);
+	array_push(predefined_shaders.phong_variants, variant);
+	return variant.shader;
+}
+
 static void init_predefined_shaders()
 {
 	if (!predefined_shaders.initialized)
 	{
-		predefined_shaders.phong_shader = graphics_shader_create(PHONG_VERTEX_SHADER_PATH, PHONG_FRAGMENT_SHADER_PATH);
+		// Submit the most common phong variants up front, so the driver can compile them in parallel.
+		predefined_shaders.phong_variants = array_new(Shader_Variant);
+		get_phong_shader_variant(0, 1);
+		get_phong_shader_variant(PHONG_FEATURE_DIFFUSE_MAP, 1);
+
+		// The basic shader is the fallback while the other programs are being compiled, so it is the only one
+		// that is created synchronously.
 		predefined_shaders.basic_shader = graphics_shader_create(BASIC_VERTEX_SHADER_PATH, BASIC_FRAGMENT_SHADER_PATH);
 		predefined_shaders.initialized = true;
 	}
@@ -173,35 +499,59 @@ Mesh graphics_quad_create()
 	array_push(indices, 3);
 	array_push(indices, 2);
 
+	mesh_generate_tangents(&vertices, indices);
 	return graphics_mesh_create(vertices, indices, 0);
 }
 
-Mesh graphics_mesh_create(Vertex* vertices, u32* indices, Normal_Mapping_Info* normal_info)
+// Takes ownership of buffers that are already filled.
+// BC5 normal maps (see texture_compression.h) only store x and y. In tangent space z is never negative, so the shader
+// rebuilds it; in object space its sign is lost, so such maps are rejected.
+static void check_normal_map_format(Normal_Mapping_Info* normal_info)
+{
+	normal_info->reconstruct_z = false;
+	if (!normal_info->use_normal_map)
+		return;
+
+	GLint internal_format;
+	glBindTexture(GL_TEXTURE_2D, normal_info->normal_map_texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (internal_format != GL_COMPRESSED_RG_RGTC2)
+		return;
+
+	if (!normal_info->tangent_space)
+	{
+		printf("Error: BC5 normal maps must be in tangent space, ignoring object space normal map\n");
+		normal_info->use_normal_map = false;
+		return;
+	}
+	normal_info->reconstruct_z = true;
+}
+
+static Mesh create_mesh_from_buffers(GLuint VBO, GLuint EBO, u32 index_count, Normal_Mapping_Info* normal_info)
 {
 	Mesh mesh;
-	GLuint VBO, EBO, VAO;
+	GLuint VAO;
 	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
 
 	glBindVertexArray(VAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, array_length(vertices) * sizeof(Vertex), 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, array_length(vertices) * sizeof(Vertex), vertices);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(0 * sizeof(GLfloat)));
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
 	glEnableVertexAttribArray(0);
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
 	glEnableVertexAttribArray(1);
 
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texture_coordinates));
 	glEnableVertexAttribArray(2);
 
+	// Normalized, so the shader gets the quaternion in [-1, 1].
+	glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, tangent_frame));
+	glEnableVertexAttribArray(3);
+
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, array_length(indices) * sizeof(u32), 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, array_length(indices) * sizeof(u32), indices);
 
 	glBindVertexArray(0);
 
@@ -217,13 +567,58 @@ Mesh graphics_mesh_create(Vertex* vertices, u32* indices, Normal_Mapping_Info* n
 		mesh.normal_info.tangent_space = false;
 		mesh.normal_info.use_normal_map = false;
 		mesh.normal_info.normal_map_texture = 0;
+		mesh.normal_info.reconstruct_z = false;
 	}
 	else
+	{
 		mesh.normal_info = *normal_info;
+		check_normal_map_format(&mesh.normal_info);
+	}
+
+	mesh.submeshes = 0;
+	mesh.vertices = 0;
+	mesh.indices = 0;
+	mesh.index_count = index_count;
+	mesh.index_type = GL_UNSIGNED_INT;
+	mesh.index_offset = 0;
+	mesh.bounding_radius = 0.0f;
+
+	return mesh;
+}
+
+// The data is handed to the driver as is, so it can come straight from a mapped file.
+static Mesh create_mesh_buffers(const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count,
+	Normal_Mapping_Info* normal_info)
+{
+	GLuint VBO, EBO;
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertex_count * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The element array binding belongs to the VAO, so indices are uploaded through the copy target.
+	glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)index_count * sizeof(u32), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
+	return create_mesh_from_buffers(VBO, EBO, index_count, normal_info);
+}
+
+Mesh graphics_mesh_create(Vertex* vertices, u32* indices, Normal_Mapping_Info* normal_info)
+{
+	Mesh mesh = create_mesh_buffers(vertices, array_length(vertices), indices, array_length(indices), normal_info);
 	mesh.vertices = vertices;
 	mesh.indices = indices;
 
+	for (u32 i = 0; i < array_length(vertices); ++i)
+	{
+		r32 length = gm_vec3_length(vertices[i].position);
+		if (length > mesh.bounding_radius)
+			mesh.bounding_radius = length;
+	}
+
 	return mesh;
 }
 
@@ -236,6 +631,8 @@ static s8* build_light_uniform_name(s8* buffer, s32 index, const s8* property)
 static void light_update_uniforms(const Light* lights, Shader shader)
 {
 	s32 number_of_lights = array_length(lights);
+	if (number_of_lights > PHONG_MAX_LIGHT_QUANTITY)
+		number_of_lights = PHONG_MAX_LIGHT_QUANTITY;
 	s8 buffer[64];
 	glUseProgram(shader);
 
@@ -252,17 +649,13 @@ static void light_update_uniforms(const Light* lights, Shader shader)
 		glUniform4f(specular_color_location, light.specular_color.x, light.specular_color.y, light.specular_color.z, light.specular_color.w);
 	}
 
-	GLint light_quantity_location = glGetUniformLocation(shader, "light_quantity");
-	glUniform1i(light_quantity_location, number_of_lights);
 }
 
 static void diffuse_update_uniforms(const Diffuse_Info* diffuse_info, Shader shader)
 {
 	glUseProgram(shader);
-	GLint use_diffuse_map_location = glGetUniformLocation(shader, "diffuse_info.use_diffuse_map");
 	GLint diffuse_map_location = glGetUniformLocation(shader, "diffuse_info.diffuse_map");
 	GLint diffuse_color_location = glGetUniformLocation(shader, "diffuse_info.diffuse_color");
-	glUniform1i(use_diffuse_map_location, diffuse_info->use_diffuse_map);
 	if (diffuse_info->use_diffuse_map)
 	{
 		glUniform1i(diffuse_map_location, 0);
@@ -277,44 +670,107 @@ static void diffuse_update_uniforms(const Diffuse_Info* diffuse_info, Shader sha
 static void normals_update_uniforms(const Normal_Mapping_Info* normal_info, Shader shader)
 {
 	glUseProgram(shader);
-	GLint use_normal_map_location = glGetUniformLocation(shader, "normal_mapping_info.use_normal_map");
 	GLint normal_map_texture_location = glGetUniformLocation(shader, "normal_mapping_info.normal_map_texture");
-	GLint tangent_space_location = glGetUniformLocation(shader, "normal_mapping_info.tangent_space");
-	glUniform1i(use_normal_map_location, normal_info->use_normal_map);
 	if (normal_info->use_normal_map)
 	{
 		glUniform1i(normal_map_texture_location, 2);
-		glUniform1i(tangent_space_location, normal_info->tangent_space);
 		glActiveTexture(GL_TEXTURE2);
 		glBindTexture(GL_TEXTURE_2D, normal_info->normal_map_texture);
 	}
 }
 
+// Submeshes using the same diffuse map share the texture, which is deleted once.
+static Submesh* create_submeshes(const Mesh_Cache_Submesh* submeshes, u32 submesh_count)
+{
+	if (submesh_count == 0)
+		return 0;
+
+	Submesh* result = array_new(Submesh);
+	for (u32 i = 0; i < submesh_count; ++i)
+	{
+		Submesh submesh;
+		memset(&submesh, 0, sizeof(submesh));
+		submesh.first_index = submeshes[i].first_index;
+		submesh.index_count = submeshes[i].index_count;
+		submesh.diffuse_info.diffuse_color = submeshes[i].diffuse_color;
+		for (u32 j = 0; j < i && submeshes[i].diffuse_map_path[0]; ++j)
+		{
+			if (result[j].diffuse_info.use_diffuse_map &&
+				!strcmp(submeshes[i].diffuse_map_path, submeshes[j].diffuse_map_path))
+			{
+				submesh.diffuse_info.use_diffuse_map = true;
+				submesh.diffuse_info.diffuse_map = result[j].diffuse_info.diffuse_map;
+				break;
+			}
+		}
+		if (submeshes[i].diffuse_map_path[0] && !submesh.diffuse_info.use_diffuse_map)
+		{
+			// Materials whose diffuse map cannot be loaded keep their diffuse color.
+			u32 texture = graphics_texture_create(submeshes[i].diffuse_map_path);
+			submesh.diffuse_info.use_diffuse_map = texture != (u32)-1;
+			submesh.diffuse_info.diffuse_map = texture;
+		}
+		array_push(result, submesh);
+	}
+
+	return result;
+}
+
+static void free_submeshes(Submesh* submeshes)
+{
+	if (!submeshes)
+		return;
+
+	for (u32 i = 0; i < array_length(submeshes); ++i)
+	{
+		bool shared = false;
+		for (u32 j = 0; j < i && !shared; ++j)
+			shared = submeshes[j].diffuse_info.use_diffuse_map &&
+				submeshes[j].diffuse_info.diffuse_map == submeshes[i].diffuse_info.diffuse_map;
+		if (submeshes[i].diffuse_info.use_diffuse_map && !shared)
+			graphics_texture_delete(submeshes[i].diffuse_info.diffuse_map);
+	}
+	array_free(submeshes);
+}
+
 void graphics_mesh_render(Shader shader, Mesh mesh)
 {
 	glBindVertexArray(mesh.VAO);
 	glUseProgram(shader);
 	normals_update_uniforms(&mesh.normal_info, shader);
-	glDrawElements(GL_TRIANGLES, array_length(mesh.indices), GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, mesh.index_count, mesh.index_type, (void*)mesh.index_offset);
 	glUseProgram(0);
 	glBindVertexArray(0);
 }
 
 void graphics_entity_change_diffuse_map(Entity* entity, u32 diffuse_map, bool delete_diffuse_map)
 {
-	if (delete_diffuse_map && entity->diffuse_info.use_diffuse_map)
-		glDeleteTextures(1, &entity->diffuse_info.diffuse_map);
+	if (delete_diffuse_map && entity->diffuse_info.use_diffuse_map && !entity->diffuse_info.use_atlas)
+		graphics_texture_delete(entity->diffuse_info.diffuse_map);
 
 	entity->diffuse_info.diffuse_map = diffuse_map;
 	entity->diffuse_info.use_diffuse_map = true;
+	entity->diffuse_info.use_atlas = false;
+}
+
+void graphics_entity_change_diffuse_atlas(Entity* entity, u32 atlas_texture, Texture_Atlas_Region region, bool delete_diffuse_map)
+{
+	if (delete_diffuse_map && entity->diffuse_info.use_diffuse_map && !entity->diffuse_info.use_atlas)
+		graphics_texture_delete(entity->diffuse_info.diffuse_map);
+
+	entity->diffuse_info.diffuse_map = atlas_texture;
+	entity->diffuse_info.use_diffuse_map = true;
+	entity->diffuse_info.use_atlas = true;
+	entity->diffuse_info.atlas_region = region;
 }
 
 void graphics_entity_change_color(Entity* entity, vec4 color, bool delete_diffuse_map)
 {
-	if (delete_diffuse_map && entity->diffuse_info.use_diffuse_map)
-		glDeleteTextures(1, &entity->diffuse_info.diffuse_map);
+	if (delete_diffuse_map && entity->diffuse_info.use_diffuse_map && !entity->diffuse_info.use_atlas)
+		graphics_texture_delete(entity->diffuse_info.diffuse_map);
 
 	entity->diffuse_info.use_diffuse_map = false;
+	entity->diffuse_info.use_atlas = false;
 	entity->diffuse_info.diffuse_color = color;
 }
 
@@ -340,6 +796,67 @@ static void recalculate_model_matrix(Entity* entity)
 
 	entity->model_matrix = gm_mat4_multiply(&rotation_matrix, &scale_matrix);
 	entity->model_matrix = gm_mat4_multiply(&translation_matrix, &entity->model_matrix);
+
+	mat4 inverse_model_matrix;
+	if (gm_mat4_inverse(&entity->model_matrix, &inverse_model_matrix))
+	{
+		mat4 normal_matrix = gm_mat4_transpose(&inverse_model_matrix);
+		entity->normal_matrix = gm_mat4_to_mat3(&normal_matrix);
+	}
+	else
+		entity->normal_matrix = gm_mat3_identity();
+
+	// Force the MVP matrix to be recalculated
+	entity->mvp_camera_version = 0;
+}
+
+static mat4 get_view_projection_matrix(const Camera* camera)
+{
+	mat4 view_matrix = camera_get_view_matrix(camera);
+	mat4 projection_matrix = camera_get_projection_matrix(camera);
+	return gm_mat4_multiply(&projection_matrix, &view_matrix);
+}
+
+void graphics_entities_update_mvp(const Camera* camera, Entity* entities, s32 entity_count)
+{
+	const s32 batch_size = 64;
+	mat4 model_matrices[batch_size];
+	mat4 mvp_matrices[batch_size];
+	s32 batch_entities[batch_size];
+	s32 batch_count = 0;
+
+	mat4 view_projection_matrix = get_view_projection_matrix(camera);
+
+	for (s32 i = 0; i < entity_count; ++i)
+	{
+		if (entities[i].mvp_camera_version != camera->matrices_version)
+		{
+			model_matrices[batch_count] = entities[i].model_matrix;
+			batch_entities[batch_count] = i;
+			++batch_count;
+		}
+
+		if (batch_count == batch_size || (i == entity_count - 1 && batch_count > 0))
+		{
+			gm_mat4_multiply_batch(&view_projection_matrix, model_matrices, mvp_matrices, batch_count);
+			for (s32 j = 0; j < batch_count; ++j)
+			{
+				Entity* entity = &entities[batch_entities[j]];
+				entity->mvp_matrix = mvp_matrices[j];
+				entity->mvp_camera_version = camera->matrices_version;
+			}
+			batch_count = 0;
+		}
+	}
+}
+
+static mat4 entity_get_mvp_matrix(const Camera* camera, const Entity* entity)
+{
+	if (entity->mvp_camera_version == camera->matrices_version)
+		return entity->mvp_matrix;
+
+	mat4 view_projection_matrix = get_view_projection_matrix(camera);
+	return gm_mat4_multiply(&view_projection_matrix, &entity->model_matrix);
 }
 
 void graphics_entity_create_with_color(Entity* entity, Mesh mesh, vec3 world_position, Quaternion world_rotation, vec3 world_scale, vec4 color)
@@ -350,6 +867,7 @@ void graphics_entity_create_with_color(Entity* entity, Mesh mesh, vec3 world_pos
 	entity->world_scale = world_scale;
 	entity->diffuse_info.diffuse_color = color;
 	entity->diffuse_info.use_diffuse_map = false;
+	entity->diffuse_info.use_atlas = false;
 	recalculate_model_matrix(entity);
 }
 
@@ -361,13 +879,14 @@ void graphics_entity_create_with_texture(Entity* entity, Mesh mesh, vec3 world_p
 	entity->world_scale = world_scale;
 	entity->diffuse_info.diffuse_map = texture;
 	entity->diffuse_info.use_diffuse_map = true;
+	entity->diffuse_info.use_atlas = false;
 	recalculate_model_matrix(entity);
 }
 
 void graphics_entity_destroy(Entity* entity)
 {
-	if (entity->diffuse_info.use_diffuse_map)
-		glDeleteTextures(1, &entity->diffuse_info.diffuse_map);
+	if (entity->diffuse_info.use_diffuse_map && !entity->diffuse_info.use_atlas)
+		graphics_texture_delete(entity->diffuse_info.diffuse_map);
 }
 
 void graphics_entity_mesh_replace(Entity* entity, Mesh mesh, bool delete_normal_map)
@@ -376,7 +895,8 @@ void graphics_entity_mesh_replace(Entity* entity, Mesh mesh, bool delete_normal_
 	glDeleteBuffers(1, &entity->mesh.EBO);
 	glDeleteVertexArrays(1, &entity->mesh.VAO);
 	if (delete_normal_map && entity->mesh.normal_info.use_normal_map)
-		glDeleteTextures(1, &entity->mesh.normal_info.normal_map_texture);
+		graphics_texture_delete(entity->mesh.normal_info.normal_map_texture);
+	free_submeshes(entity->mesh.submeshes);
 
 	entity->mesh = mesh;
 }
@@ -404,61 +924,388 @@ void graphics_entity_render_basic_shader(const Camera* camera, const Entity* ent
 	init_predefined_shaders();
 	Shader shader = predefined_shaders.basic_shader;
 	glUseProgram(shader);
-	GLint model_matrix_location = glGetUniformLocation(shader, "model_matrix");
-	GLint view_matrix_location = glGetUniformLocation(shader, "view_matrix");
-	GLint projection_matrix_location = glGetUniformLocation(shader, "projection_matrix");
+	GLint mvp_matrix_location = glGetUniformLocation(shader, "mvp_matrix");
 
-	mat4 view_matrix = camera_get_view_matrix(camera);
-	mat4 projection_matrix = camera_get_projection_matrix(camera);
+	mat4 mvp_matrix = entity_get_mvp_matrix(camera, entity);
 
-	glUniformMatrix4fv(model_matrix_location, 1, GL_TRUE, (GLfloat*)entity->model_matrix.data);
-	glUniformMatrix4fv(view_matrix_location, 1, GL_TRUE, (GLfloat*)view_matrix.data);
-	glUniformMatrix4fv(projection_matrix_location, 1, GL_TRUE, (GLfloat*)projection_matrix.data);
+	glUniformMatrix4fv(mvp_matrix_location, 1, GL_TRUE, (GLfloat*)mvp_matrix.data);
 	graphics_mesh_render(shader, entity->mesh);
 	glUseProgram(0);
 }
 
-void graphics_entity_render_phong_shader(const Camera* camera, const Entity* entity, const Light* lights)
+// Rough size, in pixels, of the entity on screen: the projected diameter of its bounding sphere.
+static r32 entity_get_screen_size(const Camera* camera, const Entity* entity)
+{
+	r32 scale = entity->world_scale.x;
+	if (entity->world_scale.y > scale) scale = entity->world_scale.y;
+	if (entity->world_scale.z > scale) scale = entity->world_scale.z;
+	r32 radius = entity->mesh.bounding_radius * scale;
+
+	r32 distance = gm_vec3_length(gm_vec3_subtract(entity->world_position, camera_get_position(camera)));
+	r32 pixels_per_unit = (r32)framebuffer_size.y / (2.0f * tanf(gm_radians(camera->fov) / 2.0f));
+	if (distance <= radius)
+		return 2.0f * (r32)framebuffer_size.y;
+
+	return 2.0f * radius / distance * pixels_per_unit;
+}
+
+static u32 get_index_size(u32 index_type)
+{
+	return index_type == GL_UNSIGNED_BYTE ? 1 : (index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+}
+
+// Everything but the diffuse info.
+static void phong_update_uniforms(const Camera* camera, const Entity* entity, const Light* lights, Shader shader)
 {
-	init_predefined_shaders();
-	Shader shader = predefined_shaders.phong_shader;
 	glUseProgram(shader);
 	light_update_uniforms(lights, shader);
 	GLint camera_position_location = glGetUniformLocation(shader, "camera_position");
 	GLint shineness_location = glGetUniformLocation(shader, "object_shineness");
 	GLint model_matrix_location = glGetUniformLocation(shader, "model_matrix");
-	GLint view_matrix_location = glGetUniformLocation(shader, "view_matrix");
-	GLint projection_matrix_location = glGetUniformLocation(shader, "projection_matrix");
+	GLint normal_matrix_location = glGetUniformLocation(shader, "normal_matrix");
+	GLint mvp_matrix_location = glGetUniformLocation(shader, "mvp_matrix");
 
-	mat4 view_matrix = camera_get_view_matrix(camera);
-	mat4 projection_matrix = camera_get_projection_matrix(camera);
+	mat4 mvp_matrix = entity_get_mvp_matrix(camera, entity);
 	vec3 camera_position = camera_get_position(camera);
 
 	glUniform3f(camera_position_location, camera_position.x, camera_position.y, camera_position.z);
 	glUniform1f(shineness_location, 128.0f);
 	glUniformMatrix4fv(model_matrix_location, 1, GL_TRUE, (GLfloat*)entity->model_matrix.data);
-	glUniformMatrix4fv(view_matrix_location, 1, GL_TRUE, (GLfloat*)view_matrix.data);
-	glUniformMatrix4fv(projection_matrix_location, 1, GL_TRUE, (GLfloat*)projection_matrix.data);
+	glUniformMatrix3fv(normal_matrix_location, 1, GL_TRUE, (GLfloat*)entity->normal_matrix.data);
+	glUniformMatrix4fv(mvp_matrix_location, 1, GL_TRUE, (GLfloat*)mvp_matrix.data);
+}
+
+static u32 get_phong_features(const Diffuse_Info* diffuse_info, const Mesh* mesh)
+{
+	u32 features = 0;
+	if (diffuse_info->use_diffuse_map)
+		features |= PHONG_FEATURE_DIFFUSE_MAP;
+	if (mesh->normal_info.use_normal_map)
+		features |= PHONG_FEATURE_NORMAL_MAP;
+	if (mesh->normal_info.use_normal_map && mesh->normal_info.tangent_space)
+		features |= PHONG_FEATURE_TANGENT_SPACE_NORMAL_MAP;
+	if (mesh->normal_info.use_normal_map && mesh->normal_info.reconstruct_z)
+		features |= PHONG_FEATURE_NORMAL_MAP_XY;
+	return features;
+}
+
+// The VAO is bound once and every submesh is a ranged draw. Uniforms are only set again when the shader variant
+// changes, i.e. between submeshes with and without a diffuse map.
+static void render_phong_submeshes(const Camera* camera, const Entity* entity, const Light* lights)
+{
+	init_predefined_shaders();
+	const Mesh* mesh = &entity->mesh;
+	for (u32 i = 0; i < array_length(mesh->submeshes); ++i)
+	{
+		Shader shader = get_phong_shader_variant(get_phong_features(&mesh->submeshes[i].diffuse_info, mesh),
+			array_length(lights));
+		if (!graphics_shader_is_ready(shader))
+		{
+			graphics_entity_render_basic_shader(camera, entity);
+			return;
+		}
+	}
+
+	r32 screen_size = entity_get_screen_size(camera, entity);
+	if (mesh->normal_info.use_normal_map)
+		texture_stream_request(mesh->normal_info.normal_map_texture, screen_size);
+
+	glBindVertexArray(mesh->VAO);
+	Shader current_shader = 0;
+	for (u32 i = 0; i < array_length(mesh->submeshes); ++i)
+	{
+		const Submesh* submesh = &mesh->submeshes[i];
+		Shader shader = get_phong_shader_variant(get_phong_features(&submesh->diffuse_info, mesh), array_length(lights));
+		if (shader != current_shader)
+		{
+			phong_update_uniforms(camera, entity, lights, shader);
+			normals_update_uniforms(&mesh->normal_info, shader);
+			current_shader = shader;
+		}
+
+		if (submesh->diffuse_info.use_diffuse_map)
+			texture_stream_request(submesh->diffuse_info.diffuse_map, screen_size);
+		diffuse_update_uniforms(&submesh->diffuse_info, shader);
+		glDrawElements(GL_TRIANGLES, submesh->index_count, mesh->index_type,
+			(void*)(mesh->index_offset + (u64)submesh->first_index * get_index_size(mesh->index_type)));
+	}
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+void graphics_entity_render_phong_shader(const Camera* camera, const Entity* entity, const Light* lights)
+{
+	if (entity->mesh.submeshes)
+	{
+		render_phong_submeshes(camera, entity, lights);
+		return;
+	}
+
+	if (entity->diffuse_info.use_atlas)
+	{
+		graphics_entities_render_phong_shader_batched(camera, entity, 1, lights);
+		return;
+	}
+
+	init_predefined_shaders();
+	Shader shader = get_phong_shader_variant(get_phong_features(&entity->diffuse_info, &entity->mesh),
+		array_length(lights));
+
+	// Until the variant is compiled, the entity is drawn with the basic shader.
+	if (!graphics_shader_is_ready(shader))
+	{
+		graphics_entity_render_basic_shader(camera, entity);
+		return;
+	}
+
+	// Streamed textures only bring in the mip levels that are actually needed at this size.
+	r32 screen_size = entity_get_screen_size(camera, entity);
+	if (entity->diffuse_info.use_diffuse_map)
+		texture_stream_request(entity->diffuse_info.diffuse_map, screen_size);
+	if (entity->mesh.normal_info.use_normal_map)
+		texture_stream_request(entity->mesh.normal_info.normal_map_texture, screen_size);
+
+	phong_update_uniforms(camera, entity, lights, shader);
 	diffuse_update_uniforms(&entity->diffuse_info, shader);
 	graphics_mesh_render(shader, entity->mesh);
 	glUseProgram(0);
 }
 
-u32 graphics_texture_create_from_data(const Image_Data* image_data)
+static void fill_phong_instance(const Entity* entity, Phong_Instance* instance)
+{
+	for (s32 column = 0; column < 4; ++column)
+		for (s32 row = 0; row < 4; ++row)
+			instance->model_matrix[column][row] = entity->model_matrix.data[row][column];
+	for (s32 column = 0; column < 3; ++column)
+		for (s32 row = 0; row < 3; ++row)
+			instance->normal_matrix[column][row] = entity->normal_matrix.data[row][column];
+
+	const Texture_Atlas_Region* region = &entity->diffuse_info.atlas_region;
+	instance->atlas_uv_transform = (vec4) { region->uv_offset.x, region->uv_offset.y, region->uv_scale.x, region->uv_scale.y };
+	instance->atlas_layer = (r32)region->layer;
+}
+
+static void set_phong_instance_attributes(bool enable)
+{
+	if (!enable)
+	{
+		for (u32 i = PHONG_INSTANCE_ATTRIBUTE_FIRST; i <= PHONG_INSTANCE_ATTRIBUTE_LAST; ++i)
+			glDisableVertexAttribArray(i);
+		return;
+	}
+
+	const GLsizei stride = sizeof(Phong_Instance);
+	for (u32 i = 0; i < 4; ++i)
+		glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(Phong_Instance, model_matrix) + i * 4 * sizeof(r32)));
+	for (u32 i = 0; i < 3; ++i)
+		glVertexAttribPointer(8 + i, 3, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(Phong_Instance, normal_matrix) + i * 3 * sizeof(r32)));
+	glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Phong_Instance, atlas_uv_transform));
+	glVertexAttribPointer(12, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Phong_Instance, atlas_layer));
+
+	for (u32 i = PHONG_INSTANCE_ATTRIBUTE_FIRST; i <= PHONG_INSTANCE_ATTRIBUTE_LAST; ++i)
+	{
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+}
+
+// All entities must share the mesh and the atlas.
+static void render_atlas_batch(const Camera* camera, const Entity* entities, s32 entity_count, const Light* lights)
+{
+	const Mesh* mesh = &entities[0].mesh;
+	u32 features = PHONG_FEATURE_ATLAS_BATCH;
+	if (mesh->normal_info.use_normal_map)
+		features |= PHONG_FEATURE_NORMAL_MAP;
+	if (mesh->normal_info.use_normal_map && mesh->normal_info.tangent_space)
+		features |= PHONG_FEATURE_TANGENT_SPACE_NORMAL_MAP;
+	if (mesh->normal_info.use_normal_map && mesh->normal_info.reconstruct_z)
+		features |= PHONG_FEATURE_NORMAL_MAP_XY;
+	Shader shader = get_phong_shader_variant(features, array_length(lights));
+
+	if (!graphics_shader_is_ready(shader))
+	{
+		for (s32 i = 0; i < entity_count; ++i)
+			graphics_entity_render_basic_shader(camera, &entities[i]);
+		return;
+	}
+
+	Phong_Instance instances[PHONG_MAX_BATCH_INSTANCES];
+	for (s32 i = 0; i < entity_count; ++i)
+		fill_phong_instance(&entities[i], &instances[i]);
+
+	if (!phong_instance_buffer)
+		glGenBuffers(1, &phong_instance_buffer);
+
+	glBindVertexArray(mesh->VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, phong_instance_buffer);
+	// Orphaning the buffer avoids waiting on the previous batch.
+	glBufferData(GL_ARRAY_BUFFER, sizeof(instances), 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, entity_count * sizeof(Phong_Instance), instances);
+	set_phong_instance_attributes(true);
+
+	glUseProgram(shader);
+	light_update_uniforms(lights, shader);
+	GLint camera_position_location = glGetUniformLocation(shader, "camera_position");
+	GLint shineness_location = glGetUniformLocation(shader, "object_shineness");
+	GLint view_projection_matrix_location = glGetUniformLocation(shader, "view_projection_matrix");
+	GLint diffuse_atlas_location = glGetUniformLocation(shader, "diffuse_atlas");
+
+	mat4 view_projection_matrix = get_view_projection_matrix(camera);
+	vec3 camera_position = camera_get_position(camera);
+
+	glUniform3f(camera_position_location, camera_position.x, camera_position.y, camera_position.z);
+	glUniform1f(shineness_location, 128.0f);
+	glUniformMatrix4fv(view_projection_matrix_location, 1, GL_TRUE, (GLfloat*)view_projection_matrix.data);
+	glUniform1i(diffuse_atlas_location, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, entities[0].diffuse_info.diffuse_map);
+	normals_update_uniforms(&mesh->normal_info, shader);
+
+	glDrawElementsInstanced(GL_TRIANGLES, mesh->index_count, mesh->index_type, (void*)mesh->index_offset, entity_count);
+
+	set_phong_instance_attributes(false);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+void graphics_entities_render_phong_shader_batched(const Camera* camera, const Entity* entities, s32 entity_count, const Light* lights)
+{
+	init_predefined_shaders();
+
+	for (s32 begin = 0; begin < entity_count;)
+	{
+		const Entity* first = &entities[begin];
+		if (!first->diffuse_info.use_atlas || first->mesh.submeshes)
+		{
+			graphics_entity_render_phong_shader(camera, first, lights);
+			++begin;
+			continue;
+		}
+
+		s32 end = begin + 1;
+		while (end < entity_count && end - begin < PHONG_MAX_BATCH_INSTANCES &&
+			entities[end].diffuse_info.use_atlas &&
+			entities[end].diffuse_info.diffuse_map == first->diffuse_info.diffuse_map &&
+			entities[end].mesh.VAO == first->mesh.VAO)
+			++end;
+
+		render_atlas_batch(camera, first, end - begin, lights);
+		begin = end;
+	}
+}
+
+static const GLenum client_formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+Texture_Format graphics_texture_choose_format(s32 channels, Texture_Usage usage)
+{
+	static const GLenum internal_formats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+
+	Texture_Format texture_format;
+	texture_format.channels = channels;
+	if (usage == TEXTURE_USAGE_NORMAL && channels > 3)
+		texture_format.channels = 3;
+	else if (usage == TEXTURE_USAGE_MASK)
+		texture_format.channels = 1;
+
+	texture_format.internal_format = internal_formats[texture_format.channels - 1];
+	texture_format.format = client_formats[texture_format.channels - 1];
+	texture_format.type = GL_UNSIGNED_BYTE;
+
+	texture_format.swizzle[0] = GL_RED;
+	texture_format.swizzle[1] = GL_GREEN;
+	texture_format.swizzle[2] = GL_BLUE;
+	texture_format.swizzle[3] = GL_ALPHA;
+	if (usage == TEXTURE_USAGE_ALBEDO && texture_format.channels <= 2)
+	{
+		// Gray or gray + alpha
+		texture_format.swizzle[1] = GL_RED;
+		texture_format.swizzle[2] = GL_RED;
+		texture_format.swizzle[3] = texture_format.channels == 2 ? GL_GREEN : GL_ONE;
+	}
+
+	return texture_format;
+}
+
+Texture_Format graphics_texture_choose_float_format(const Float_Image_Data* image_data, Texture_Usage usage)
+{
+	static const GLenum half_internal_formats[4] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+	static const GLenum full_internal_formats[4] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+	const r32 half_max = 65504.0f;
+	const r32 packed_float_max = 65024.0f;
+
+	// Same channel and swizzle policy as 8-bit data.
+	Texture_Format texture_format = graphics_texture_choose_format(image_data->channels, usage);
+	texture_format.type = GL_FLOAT;
+
+	r32 min = 0.0f, max = 0.0f;
+	u64 texel_count = (u64)image_data->width * image_data->height;
+	for (u64 i = 0; i < texel_count; ++i)
+	{
+		for (s32 c = 0; c < texture_format.channels; ++c)
+		{
+			r32 value = image_data->data[i * image_data->channels + c];
+			if (value < min) min = value;
+			if (value > max) max = value;
+		}
+	}
+
+	if (max > half_max || min < -half_max)
+		texture_format.internal_format = full_internal_formats[texture_format.channels - 1];
+	else if (usage == TEXTURE_USAGE_ALBEDO && texture_format.channels == 3 && min >= 0.0f && max > 1.0f && max <= packed_float_max)
+		// HDR colors. In [0, 1] the 6/5-bit mantissas would be coarser than 8-bit data, so LDR colors stay half floats.
+		texture_format.internal_format = GL_R11F_G11F_B10F;
+	else
+		texture_format.internal_format = half_internal_formats[texture_format.channels - 1];
+
+	return texture_format;
+}
+
+// Copies the first 'channels' channels of every texel. Returns 0 if nothing needs to be dropped.
+static void* drop_channels(const void* data, s32 texel_count, s32 data_channels, s32 channels, s32 channel_size)
+{
+	if (data_channels == channels)
+		return 0;
+
+	u8* result = (u8*)malloc((size_t)texel_count * channels * channel_size);
+	const u8* source = (const u8*)data;
+	for (s32 i = 0; i < texel_count; ++i)
+		memcpy(result + (size_t)i * channels * channel_size, source + (size_t)i * data_channels * channel_size, channels * channel_size);
+
+	return result;
+}
+
+// Uploads the whole mip chain. Exactly one of levels / float_levels must be given.
+static u32 texture_create(const Image_Data* levels, const Float_Image_Data* float_levels, const Texture_Format* texture_format,
+	GLenum wrap)
 {
 	u32 texture_id;
+	s32 channel_size = texture_format->type == GL_FLOAT ? sizeof(r32) : sizeof(u8);
+	u32 level_count = levels ? array_length(levels) : array_length(float_levels);
 
 	glGenTextures(1, &texture_id);
 	glBindTexture(GL_TEXTURE_2D, texture_id);
-	if (image_data->channels == 4)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image_data->width, image_data->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data->data);
-	else
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, image_data->width, image_data->height, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data->data);
-
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// Rows of 1 to 3 channel textures are not necessarily 4-byte aligned.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (u32 i = 0; i < level_count; ++i)
+	{
+		s32 width = levels ? levels[i].width : float_levels[i].width;
+		s32 height = levels ? levels[i].height : float_levels[i].height;
+		s32 data_channels = levels ? levels[i].channels : float_levels[i].channels;
+		const void* data = levels ? (const void*)levels[i].data : (const void*)float_levels[i].data;
+
+		void* packed_data = drop_channels(data, width * height, data_channels, texture_format->channels, channel_size);
+		glTexImage2D(GL_TEXTURE_2D, i, texture_format->internal_format, width, height, 0, texture_format->format, texture_format->type,
+			packed_data ? packed_data : data);
+		free(packed_data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, texture_format->swizzle);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
 
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
@@ -473,23 +1320,66 @@ u32 graphics_texture_create_from_data(const Image_Data* image_data)
 	return texture_id;
 }
 
+u32 graphics_texture_create_from_data(const Image_Data* image_data)
+{
+	return graphics_texture_create_from_data_with_usage(image_data, TEXTURE_USAGE_ALBEDO);
+}
+
+u32 graphics_texture_create_from_data_with_usage(const Image_Data* image_data, Texture_Usage usage)
+{
+	Mipmap_Options options = mipmap_get_default_options(usage);
+	Image_Data* levels = mipmap_generate(image_data, &options);
+	u32 texture_id = graphics_texture_create_from_mips(levels, usage);
+	mipmap_free(levels);
+	return texture_id;
+}
+
+u32 graphics_texture_create_from_mips(const Image_Data* levels, Texture_Usage usage)
+{
+	Texture_Format texture_format = graphics_texture_choose_format(levels[0].channels, usage);
+	return texture_create(levels, 0, &texture_format, GL_CLAMP_TO_EDGE);
+}
+
 u32 graphics_texture_create_from_float_data(const Float_Image_Data* image_data)
+{
+	return graphics_texture_create_from_float_data_with_usage(image_data, TEXTURE_USAGE_ALBEDO);
+}
+
+u32 graphics_texture_create_from_float_data_with_usage(const Float_Image_Data* image_data, Texture_Usage usage)
+{
+	Texture_Format texture_format = graphics_texture_choose_float_format(image_data, usage);
+	Mipmap_Options options = mipmap_get_default_options(usage);
+	Float_Image_Data* levels = mipmap_generate_float(image_data, &options);
+	u32 texture_id = texture_create(0, levels, &texture_format, GL_REPEAT);
+	mipmap_free_float(levels);
+	return texture_id;
+}
+
+u32 graphics_texture_create_from_compressed_data(const Compressed_Image_Data* image_data)
 {
 	u32 texture_id;
+	u32 level_count = array_length(image_data->levels);
+	GLenum internal_format;
+	switch (image_data->format)
+	{
+		case TEXTURE_COMPRESSION_BC1: internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+		case TEXTURE_COMPRESSION_BC3: internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+		default: internal_format = GL_COMPRESSED_RG_RGTC2; break;
+	}
 
 	glGenTextures(1, &texture_id);
 	glBindTexture(GL_TEXTURE_2D, texture_id);
-	if (image_data->channels == 4)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, image_data->width, image_data->height, 0, GL_RGBA, GL_FLOAT, image_data->data);
-	else
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, image_data->width, image_data->height, 0, GL_RGB, GL_FLOAT, image_data->data);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	for (u32 i = 0; i < level_count; ++i)
+	{
+		const Compressed_Image_Level* level = &image_data->levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format, level->width, level->height, 0, level->size, level->data);
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// The mip chain comes precomputed. If it is incomplete, sampling is limited to the levels that exist.
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
 
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 
@@ -501,18 +1391,44 @@ u32 graphics_texture_create_from_float_data(const Float_Image_Data* image_data)
 	return texture_id;
 }
 
+static bool has_extension(const s8* path, const s8* extension)
+{
+	size_t path_length = strlen(path), extension_length = strlen(extension);
+	return path_length >= extension_length && !strcmp(path + path_length - extension_length, extension);
+}
+
 u32 graphics_texture_create(const s8* texture_path)
 {
-	Image_Data image_data = graphics_image_load(texture_path);
-	if (image_data.data == NULL) return -1;
-	u32 texture_id = graphics_texture_create_from_data(&image_data);
-	graphics_image_free(&image_data);
+	return graphics_texture_create_with_usage(texture_path, TEXTURE_USAGE_ALBEDO);
+}
+
+u32 graphics_texture_create_with_usage(const s8* texture_path, Texture_Usage usage)
+{
+	// Block-compressed textures (see tools/compress_texture.cpp) are uploaded as they are.
+	if (has_extension(texture_path, TEXTURE_COMPRESSION_FILE_EXTENSION))
+	{
+		Compressed_Image_Data compressed_data = texture_compression_load(texture_path);
+		if (array_length(compressed_data.levels) == 0)
+		{
+			texture_compression_free(&compressed_data);
+			return -1;
+		}
+		u32 texture_id = graphics_texture_create_from_compressed_data(&compressed_data);
+		texture_compression_free(&compressed_data);
+		return texture_id;
+	}
+
+	Image_Data* levels = graphics_image_load_with_mips(texture_path, usage);
+	if (!levels) return -1;
+	u32 texture_id = graphics_texture_create_from_mips(levels, usage);
+	mipmap_free(levels);
 
 	return texture_id;
 }
 
 void graphics_texture_delete(u32 texture_id)
 {
+	texture_stream_cancel(texture_id);
 	glDeleteTextures(1, &texture_id);
 }
 
@@ -527,24 +1443,12 @@ void graphics_light_create(Light* light, vec3 position, vec4 ambient_color, vec4
 // If memory is null, new memory will be allocated
 Float_Image_Data graphics_image_data_to_float_image_data(Image_Data* image_data, r32* memory)
 {
-	s32 image_channels = image_data->channels;
+	s32 value_count = image_data->height * image_data->width * image_data->channels;
 
 	if (!memory)
-		memory = (r32*)malloc(sizeof(r32) * image_data->height * image_data->width * image_channels);
+		memory = (r32*)malloc(sizeof(r32) * value_count);
 
-	for (s32 i = 0; i < image_data->height; ++i)
-	{
-		for (s32 j = 0; j < image_data->width; ++j)
-		{
-			memory[i * image_data->width * image_channels + j * image_channels] =
-				image_data->data[i * image_data->width * image_data->channels + j * image_data->channels] / 255.0f;
-			memory[i * image_data->width * image_channels + j * image_channels + 1] =
-				image_data->data[i * image_data->width * image_data->channels + j * image_data->channels + 1] / 255.0f;
-			memory[i * image_data->width * image_channels + j * image_channels + 2] =
-				image_data->data[i * image_data->width * image_data->channels + j * image_data->channels + 2] / 255.0f;
-			memory[i * image_data->width * image_channels + j * image_channels + 3] = 1.0f;
-		}
-	}
+	image_convert_u8_to_float(image_data->data, memory, image_data->width, image_data->height, image_data->channels);
 
 	Float_Image_Data fid;
 	fid.width = image_data->width;
@@ -557,21 +1461,13 @@ Float_Image_Data graphics_image_data_to_float_image_data(Image_Data* image_data,
 
 Image_Data graphics_float_image_data_to_image_data(const Float_Image_Data* float_image_data, u8* memory)
 {
-	s32 image_channels = float_image_data->channels;
+	s32 value_count = float_image_data->height * float_image_data->width * float_image_data->channels;
 
 	if (!memory)
-		memory = (u8*)malloc(sizeof(u8) * float_image_data->height * float_image_data->width * image_channels);
+		memory = (u8*)malloc(sizeof(u8) * value_count);
 
-	for (s32 i = 0; i < float_image_data->height; ++i)
-	{
-		for (s32 j = 0; j < float_image_data->width; ++j)
-		{
-			memory[i * float_image_data->width * image_channels + j * image_channels] = (u8)round(255.0f * float_image_data->data[i * float_image_data->width * image_channels + j * image_channels]);
-			memory[i * float_image_data->width * image_channels + j * image_channels + 1] = (u8)round(255.0f * float_image_data->data[i * float_image_data->width * image_channels + j * image_channels + 1]);
-			memory[i * float_image_data->width * image_channels + j * image_channels + 2] = (u8)round(255.0f * float_image_data->data[i * float_image_data->width * image_channels + j * image_channels + 2]);
-			if (float_image_data->channels > 3) memory[i * float_image_data->width * image_channels + j * image_channels + 3] = 255;
-		}
-	}
+	image_convert_float_to_u8(float_image_data->data, memory, float_image_data->width, float_image_data->height,
+		float_image_data->channels);
 
 	Image_Data id;
 	id.width = float_image_data->width;
@@ -582,12 +1478,229 @@ Image_Data graphics_float_image_data_to_image_data(const Float_Image_Data* float
 	return id;
 }
 
+// The cache is next to the obj file, with the extension replaced. Returns 0 if the obj file cannot be found.
+static u64 get_obj_cache_key(const s8* obj_path, const Obj_Options* options, bool streaming, s8* cache_path,
+	u32 cache_path_size)
+{
+	const s8* extension = strrchr(obj_path, '.');
+	if (!extension || strchr(extension, '/') || strchr(extension, '\\'))
+		extension = obj_path + strlen(obj_path);
+	snprintf(cache_path, cache_path_size, "%.*s%s", (s32)(extension - obj_path), obj_path,
+		streaming ? MESH_CACHE_STREAMED_FILE_EXTENSION : MESH_CACHE_FILE_EXTENSION);
+
+	// Same validity check as for cached mip chains, plus the import options.
+	struct stat file_info;
+	if (stat(obj_path, &file_info))
+		return 0;
+	u64 file_size = file_info.st_size, modification_time = file_info.st_mtime;
+	u64 key = util_hash(obj_path, strlen(obj_path) + 1, UTIL_HASH_SEED);
+	key = util_hash(&file_size, sizeof(file_size), key);
+	key = util_hash(&modification_time, sizeof(modification_time), key);
+	key = util_hash(&options->weld, sizeof(options->weld), key);
+	key = util_hash(&options->weld_epsilon, sizeof(options->weld_epsilon), key);
+	key = util_hash(&options->normals.weighting, sizeof(options->normals.weighting), key);
+	key = util_hash(&options->normals.crease_angle, sizeof(options->normals.crease_angle), key);
+	// Streamed imports produce different data (see obj_stream).
+	key = util_hash(&streaming, sizeof(streaming), key);
+	return key;
+}
+
 Mesh graphics_mesh_create_from_obj(const s8* obj_path, Normal_Mapping_Info* normal_info)
 {
+	s8 cache_path[256];
+	Obj_Options options = obj_get_default_options();
+	u64 key = get_obj_cache_key(obj_path, &options, false, cache_path, sizeof(cache_path));
+
+	Mesh_Cache_Data cache;
+	if (key && mesh_cache_load(cache_path, key, &cache))
+	{
+		Mesh m = create_mesh_buffers(cache.vertices, cache.vertex_count, cache.indices, cache.lods[0].index_count,
+			normal_info);
+		m.bounding_radius = cache.bounding_radius;
+		m.submeshes = create_submeshes(cache.submeshes, cache.submesh_count);
+		mesh_cache_unload(&cache);
+		return m;
+	}
+
 	Vertex* vertices;
 	u32* indexes;
-	obj_parse(obj_path, &vertices, &indexes);
+	Obj_Submesh* obj_submeshes;
+	Obj_Material_Library* material_libraries;
+	obj_parse_with_materials(obj_path, &options, &vertices, &indexes, &obj_submeshes, &material_libraries);
+
+	u32 submesh_count = array_length(obj_submeshes);
+	Mesh_Cache_Submesh* submeshes = (Mesh_Cache_Submesh*)calloc(submesh_count + 1, sizeof(Mesh_Cache_Submesh));
+	u32* submesh_index_counts = (u32*)malloc((submesh_count + 1) * sizeof(u32));
+	for (u32 i = 0; i < submesh_count; ++i)
+	{
+		submeshes[i].first_index = obj_submeshes[i].first_index;
+		submeshes[i].index_count = obj_submeshes[i].index_count;
+		submeshes[i].diffuse_color = obj_submeshes[i].diffuse_color;
+		strncpy(submeshes[i].diffuse_map_path, obj_submeshes[i].diffuse_map_path, MESH_CACHE_MAX_PATH_LENGTH - 1);
+		submesh_index_counts[i] = obj_submeshes[i].index_count;
+	}
+	array_free(obj_submeshes);
+
+	// Triangles are only reordered within their submesh.
+	Mesh_Optimize_Report report;
+	if (submesh_count > 0)
+		mesh_optimize_ranges(vertices, indexes, submesh_index_counts, submesh_count, &report);
+	else
+		mesh_optimize(vertices, indexes, &report);
+	free(submesh_index_counts);
+	printf("Optimized mesh %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u vertices, %u triangles)\n", obj_path,
+		report.before.acmr, report.after.acmr, report.before.atvr, report.after.atvr, (u32)array_length(vertices),
+		(u32)array_length(indexes) / 3);
+
+	// The materials are cached too, so the cache is also checked against the material libraries.
+	if (key)
+	{
+		u32 library_count = array_length(material_libraries);
+		const s8** library_paths = (const s8**)malloc((library_count + 1) * sizeof(const s8*));
+		for (u32 i = 0; i < library_count; ++i)
+			library_paths[i] = material_libraries[i].path;
+		mesh_cache_save(cache_path, key, vertices, array_length(vertices), indexes, array_length(indexes), 0, 0,
+			submeshes, submesh_count, library_paths, library_count);
+		free(library_paths);
+	}
+	array_free(material_libraries);
+
 	Mesh m = graphics_mesh_create(vertices, indexes, normal_info);
+	m.submeshes = create_submeshes(submeshes, submesh_count);
+	free(submeshes);
+	return m;
+}
+
+typedef struct
+{
+	GLuint VBO, EBO;
+	u32 vertex_count;
+	u32 vertex_capacity;
+	u32 index_count;
+	r32 bounding_radius;
+	Mesh_Cache_Writer writer;
+	bool writing;
+	const s8* cache_path;
+	u64 key;
+} Obj_Stream_Upload;
+
+// Moves the vertices to a buffer of the new capacity, without going through the CPU.
+static void resize_vertex_buffer(Obj_Stream_Upload* upload, u32 capacity)
+{
+	GLuint VBO;
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)capacity * sizeof(Vertex), 0, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, upload->VBO);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)upload->vertex_count * sizeof(Vertex));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &upload->VBO);
+	upload->VBO = VBO;
+	upload->vertex_capacity = capacity;
+}
+
+static bool obj_stream_upload_begin(u32 index_count, void* data)
+{
+	Obj_Stream_Upload* upload = (Obj_Stream_Upload*)data;
+	glGenBuffers(1, &upload->EBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, upload->EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)index_count * sizeof(u32), 0, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// Closed meshes have about one vertex for every two triangles. The buffer grows if that is not enough.
+	glGenBuffers(1, &upload->VBO);
+	resize_vertex_buffer(upload, index_count / 6 + 1);
+
+	if (upload->key)
+		upload->writing = mesh_cache_writer_open(&upload->writer, upload->cache_path, upload->key, index_count);
+	return true;
+}
+
+static bool obj_stream_upload_emit(const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count,
+	void* data)
+{
+	Obj_Stream_Upload* upload = (Obj_Stream_Upload*)data;
+	if (upload->vertex_count + vertex_count > upload->vertex_capacity)
+	{
+		u32 capacity = upload->vertex_capacity * 2;
+		resize_vertex_buffer(upload, capacity > upload->vertex_count + vertex_count ? capacity :
+			upload->vertex_count + vertex_count);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, upload->VBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)upload->vertex_count * sizeof(Vertex),
+		(GLsizeiptr)vertex_count * sizeof(Vertex), vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, upload->EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)upload->index_count * sizeof(u32),
+		(GLsizeiptr)index_count * sizeof(u32), indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	upload->vertex_count += vertex_count;
+	upload->index_count += index_count;
+
+	for (u32 i = 0; i < vertex_count; ++i)
+	{
+		r32 length = gm_vec3_length(vertices[i].position);
+		if (length > upload->bounding_radius)
+			upload->bounding_radius = length;
+	}
+
+	// A failed cache file only costs the next load its speed up.
+	if (upload->writing)
+		mesh_cache_writer_append(&upload->writer, vertices, vertex_count, indices, index_count);
+	return true;
+}
+
+Mesh graphics_mesh_create_from_obj_streaming(const s8* obj_path, Normal_Mapping_Info* normal_info, u64 memory_limit)
+{
+	s8 cache_path[256];
+	Obj_Options options = obj_get_default_options();
+	u64 key = get_obj_cache_key(obj_path, &options, true, cache_path, sizeof(cache_path));
+
+	Mesh_Cache_Data cache;
+	if (key && mesh_cache_load(cache_path, key, &cache))
+	{
+		Mesh m = create_mesh_buffers(cache.vertices, cache.vertex_count, cache.indices, cache.lods[0].index_count,
+			normal_info);
+		m.bounding_radius = cache.bounding_radius;
+		mesh_cache_unload(&cache);
+		return m;
+	}
+
+	Obj_Stream_Upload upload;
+	memset(&upload, 0, sizeof(upload));
+	upload.cache_path = cache_path;
+	upload.key = key;
+	Obj_Stream_Sink sink;
+	sink.begin = obj_stream_upload_begin;
+	sink.emit = obj_stream_upload_emit;
+	sink.data = &upload;
+
+	Obj_Stream_Report report;
+	if (!obj_stream(obj_path, &options, memory_limit, &sink, &report))
+	{
+		if (upload.writing)
+		{
+			upload.writer.failed = true;
+			mesh_cache_writer_close(&upload.writer, cache_path);
+		}
+		glDeleteBuffers(1, &upload.VBO);
+		glDeleteBuffers(1, &upload.EBO);
+		exit(1);
+	}
+
+	if (upload.writing)
+		mesh_cache_writer_close(&upload.writer, cache_path);
+	if (upload.vertex_capacity > upload.vertex_count)
+		resize_vertex_buffer(&upload, upload.vertex_count);
+
+	printf("Streamed mesh %s: %u windows of %u triangles (%u vertices, %u triangles), memory budget %.1f MB, "
+		"peak resident memory %.1f MB\n", obj_path, report.window_count, report.window_triangle_count,
+		report.vertex_count, report.triangle_count, report.memory_budget / (1024.0 * 1024.0),
+		report.peak_resident_memory / (1024.0 * 1024.0));
+
+	Mesh m = create_mesh_from_buffers(upload.VBO, upload.EBO, upload.index_count, normal_info);
+	m.bounding_radius = upload.bounding_radius;
 	return m;
 }
 
@@ -625,8 +1738,7 @@ void graphics_renderer_primitives_init()
 
 	int batch_size = 1024 * 1024;
 
-	primitives_ctx.shader = graphics_shader_create("shaders/debug.vs", "shaders/debug.fs");
-	glUseProgram(primitives_ctx.shader);
+	primitives_ctx.shader = graphics_shader_create_async("shaders/debug.vs", "shaders/debug.fs", 0);
 
 	glGenVertexArrays(1, &primitives_ctx.vector_vao);
 	glBindVertexArray(primitives_ctx.vector_vao);
@@ -649,14 +1761,21 @@ void graphics_renderer_primitives_init()
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Primitive_3D_Vertex), &((Primitive_3D_Vertex *) 0)->position);
 	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Primitive_3D_Vertex), &((Primitive_3D_Vertex *) 0)->color);
-
-	glUseProgram(0);
 }
 
 void graphics_renderer_primitives_flush(const Camera* camera)
 {
 	graphics_renderer_primitives_init();
-	glUseProgram(primitives_ctx.shader);
+
+	// While the debug shader is still being compiled, the primitives of this frame are simply dropped.
+	// The uniform is only looked up once the program is linked, asking earlier would block on the compilation.
+	bool shader_ready = graphics_shader_is_ready(primitives_ctx.shader);
+	GLint view_projection_matrix_location = -1;
+	if (shader_ready)
+	{
+		glUseProgram(primitives_ctx.shader);
+		view_projection_matrix_location = glGetUniformLocation(primitives_ctx.shader, "view_projection_matrix");
+	}
 
 	// Vector
 	glDisable(GL_DEPTH_TEST);
@@ -667,16 +1786,13 @@ void graphics_renderer_primitives_flush(const Camera* camera)
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
-	GLint view_matrix_location = glGetUniformLocation(primitives_ctx.shader, "view_matrix");
-	GLint projection_matrix_location = glGetUniformLocation(primitives_ctx.shader, "projection_matrix");
-
-	mat4 view_matrix = camera_get_view_matrix(camera);
-	mat4 projection_matrix = camera_get_projection_matrix(camera);
+	mat4 view_projection_matrix = get_view_projection_matrix(camera);
 
-	glUniformMatrix4fv(view_matrix_location, 1, GL_TRUE, (GLfloat *) view_matrix.data);
-	glUniformMatrix4fv(projection_matrix_location, 1, GL_TRUE, (GLfloat *) projection_matrix.data);
-
-	glDrawArrays(GL_LINES, 0, primitives_ctx.vertex_count);
+	if (shader_ready)
+	{
+		glUniformMatrix4fv(view_projection_matrix_location, 1, GL_TRUE, (GLfloat *) view_projection_matrix.data);
+		glDrawArrays(GL_LINES, 0, primitives_ctx.vertex_count);
+	}
 	primitives_ctx.vertex_count = 0;
 	primitives_ctx.data_ptr = 0;
 	glEnable(GL_DEPTH_TEST);
@@ -687,11 +1803,12 @@ void graphics_renderer_primitives_flush(const Camera* camera)
 	glBindBuffer(GL_ARRAY_BUFFER, primitives_ctx.point_vbo);
 	glUnmapBuffer(GL_ARRAY_BUFFER);
 
-	glUniformMatrix4fv(view_matrix_location, 1, GL_TRUE, (GLfloat *) view_matrix.data);
-	glUniformMatrix4fv(projection_matrix_location, 1, GL_TRUE, (GLfloat *) projection_matrix.data);
-
 	glPointSize(10.0f);
-	glDrawArrays(GL_POINTS, 0, primitives_ctx.point_count);
+	if (shader_ready)
+	{
+		glUniformMatrix4fv(view_projection_matrix_location, 1, GL_TRUE, (GLfloat *) view_projection_matrix.data);
+		glDrawArrays(GL_POINTS, 0, primitives_ctx.point_count);
+	}
 	primitives_ctx.point_count = 0;
 	primitives_ctx.point_data_ptr = 0;
 	glEnable(GL_DEPTH_TEST);
@@ -11,29 +11,68 @@ typedef struct
 	vec3 position;
 	vec3 normal;
 	vec2 texture_coordinates;
+	// Tangent frame packed in a quaternion, see mesh/tangents.h.
+	s16 tangent_frame[4];
 } Vertex;
 #pragma pack(pop)
 
 typedef struct
 {
 	bool use_normal_map;
-	bool tangent_space;		// @TODO: Not implemented yet.
+	// Normal map in tangent space (relative to the tangent frame of the vertices) instead of object space.
+	bool tangent_space;
 	u32 normal_map_texture;
+	// Set when the mesh is created: the normal map only stores x and y (BC5, see texture_compression.h), so the
+	// shader rebuilds z.
+	bool reconstruct_z;
 } Normal_Mapping_Info;
 
+// Part of a texture atlas layer holding one of the packed images (see texture_atlas.h).
+typedef struct
+{
+	vec2 uv_offset;
+	vec2 uv_scale;
+	s32 layer;
+} Texture_Atlas_Region;
+
 typedef struct
 {
 	bool use_diffuse_map;
 	u32 diffuse_map;
 	vec4 diffuse_color;
+	// If set, diffuse_map is a GL_TEXTURE_2D_ARRAY atlas shared with other entities, which is not owned by the entity.
+	bool use_atlas;
+	Texture_Atlas_Region atlas_region;
 } Diffuse_Info;
 
+// Triangles of a mesh drawn with one material. They are contiguous in the index data, so a multi-material mesh is
+// drawn with one VAO bind and one ranged draw per submesh.
+typedef struct
+{
+	u32 first_index;
+	u32 index_count;
+	// Owned by the mesh. Never uses an atlas.
+	Diffuse_Info diffuse_info;
+} Submesh;
+
 typedef struct
 {
 	u32 VAO, VBO, EBO;
 	Normal_Mapping_Info normal_info;
+	// 0 for meshes with a single material, which are drawn with the diffuse info of their entity. Otherwise a
+	// light_array covering every index, whose diffuse infos replace the entity's.
+	Submesh* submeshes;
+	// Both 0 for meshes loaded from a mesh cache, whose data is only in the GPU buffers (see mesh/cache.h).
 	Vertex* vertices;
 	u32* indices;
+	u32 index_count;
+	// GL_UNSIGNED_INT, except for meshes drawing from index data as stored in a file (see gltf.h), which may also use
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE.
+	u32 index_type;
+	// In bytes, where the indices start in the EBO.
+	u64 index_offset;
+	// Radius of the bounding sphere centered at the model space origin.
+	r32 bounding_radius;
 } Mesh;
 
 typedef struct
@@ -43,6 +82,11 @@ typedef struct
 	Quaternion world_rotation;
 	vec3 world_scale;
 	mat4 model_matrix;
+	// Inverse-transpose of the model matrix, recalculated together with it.
+	mat3 normal_matrix;
+	// projection * view * model. Only valid while mvp_camera_version matches the camera's matrices_version.
+	mat4 mvp_matrix;
+	u32 mvp_camera_version;
 	Diffuse_Info diffuse_info;
 } Entity;
 
@@ -66,7 +110,30 @@ typedef struct
 	s32 width, height, channels;
 } Float_Image_Data;
 
+// What a texture holds, which decides how it is stored on the GPU.
+typedef enum {
+	TEXTURE_USAGE_ALBEDO,	// Color. Gray (+alpha) images are stored with one (two) channels and expanded by the sampler.
+	TEXTURE_USAGE_NORMAL,	// Normal vectors. Only the first three channels are kept.
+	TEXTURE_USAGE_MASK		// Scalar data (roughness, occlusion, opacity, ...). Only the first channel is kept.
+} Texture_Usage;
+
+typedef struct
+{
+	u32 internal_format;
+	// Format and type of the client data, after graphics_texture_create_* drops the unused channels.
+	u32 format;
+	u32 type;
+	s32 channels;
+	s32 swizzle[4];
+} Texture_Format;
+
 Image_Data graphics_image_load(const s8* image_path);
+// Loads the image together with its mip chain (see mipmap.h), which is cached in MIPMAP_CACHE_DIRECTORY so later
+// loads skip decoding and filtering. Returns 0 on failure; release the levels with mipmap_free.
+Image_Data* graphics_image_load_with_mips(const s8* image_path, Texture_Usage usage);
+// A single level of the same chain, read on its own from the cache when it is there. The data is 0 on failure and is
+// otherwise released with free.
+Image_Data graphics_image_load_mip_level(const s8* image_path, Texture_Usage usage, s32 level);
 Float_Image_Data graphics_float_image_load(const s8* image_path);
 Float_Image_Data graphics_float_image_copy(const Float_Image_Data* image_data);
 void graphics_image_free(Image_Data* image_data);
@@ -74,9 +141,23 @@ void graphics_float_image_Free(Float_Image_Data* image_data);
 void graphics_image_save(const s8* image_path, const Image_Data* image_data);
 void graphics_float_image_save(const s8* image_path, const Float_Image_Data* image_data);
 Shader graphics_shader_create(const s8* vertex_shader_path, const s8* fragment_shader_path);
+// defines is injected right after the #version directive of both shaders, e.g. "#define USE_DIFFUSE_MAP\n".
+Shader graphics_shader_create_with_defines(const s8* vertex_shader_path, const s8* fragment_shader_path, const s8* defines);
+// Submits the compilation and returns immediately. The returned program must not be used before
+// graphics_shader_is_ready returns true; GL_ARB_parallel_shader_compile is used to poll without blocking when available.
+Shader graphics_shader_create_async(const s8* vertex_shader_path, const s8* fragment_shader_path, const s8* defines);
+// Always true for shaders created synchronously. Stays false forever if the shader failed to compile or link.
+bool graphics_shader_is_ready(Shader shader);
 Mesh graphics_quad_create();
 Mesh graphics_mesh_create(Vertex* vertices, u32* indices, Normal_Mapping_Info* normal_info);
+// Files with materials give a mesh with one submesh per material. The result is cached next to the obj file (see
+// mesh/cache.h) and imported again when the obj file or one of its material libraries changes.
 Mesh graphics_mesh_create_from_obj(const s8* obj_path, Normal_Mapping_Info* normal_info);
+// For obj files too big to import in memory: the file is imported in windows (see obj_stream) that are uploaded to
+// the GPU as they are ready, keeping the import under memory_limit bytes. The result is cached like with
+// graphics_mesh_create_from_obj, in a separate file. Generated normals ignore the crease angle (see obj_stream).
+Mesh graphics_mesh_create_from_obj_streaming(const s8* obj_path, Normal_Mapping_Info* normal_info, u64 memory_limit);
+// Binary glTF files hold whole scenes rather than one mesh, so they are loaded as entities by gltf_load_glb (see gltf.h).
 void graphics_mesh_render(Shader shader, Mesh mesh);
 void graphics_entity_create_with_color(Entity* entity, Mesh mesh, vec3 world_position, Quaternion world_rotation, vec3 world_scale, vec4 color);
 void graphics_entity_create_with_texture(Entity* entity, Mesh mesh, vec3 world_position, Quaternion world_rotation, vec3 world_scale, u32 texture);
@@ -84,6 +165,9 @@ void graphics_entity_destroy(Entity* entity);
 // If entity already has a diffuse map, the older diffuse map will be deleted if delete_diffuse_map is true.
 // If entity has a color instead of a diffuse map, the mesh will lose the color and be set to use the diffuse map.
 void graphics_entity_change_diffuse_map(Entity* entity, u32 diffuse_map, bool delete_diffuse_map);
+// The entity samples the given region of an atlas. The atlas is not deleted together with the entity.
+// If the entity already has its own diffuse map, it will be deleted if delete_diffuse_map is true.
+void graphics_entity_change_diffuse_atlas(Entity* entity, u32 atlas_texture, Texture_Atlas_Region region, bool delete_diffuse_map);
 // If the entity already has a color, the older color will be deleted.
 // If entity has a diffuse map instead of a color, the diffuse map will be deleted if delete_diffuse_map is true
 // The entity will be set to use the color.
@@ -92,13 +176,32 @@ void graphics_entity_mesh_replace(Entity* entity, Mesh mesh, bool delete_normal_
 void graphics_entity_set_position(Entity* entity, vec3 world_position);
 void graphics_entity_set_rotation(Entity* entity, Quaternion world_rotation);
 void graphics_entity_set_scale(Entity* entity, vec3 world_scale);
+// Recalculates the MVP matrix of every entity whose transform or camera changed since the last call.
+// Entities that were not updated before rendering still work, but pay for the multiplication at draw time.
+void graphics_entities_update_mvp(const Camera* camera, Entity* entities, s32 entity_count);
 void graphics_entity_render_basic_shader(const Camera* camera, const Entity* entity);
 void graphics_entity_render_phong_shader(const Camera* camera, const Entity* entity, const Light* lights);
+// Consecutive entities that share a mesh and a diffuse atlas are drawn with a single instanced draw call.
+// Entities that do not use an atlas are drawn one by one, as in graphics_entity_render_phong_shader.
+void graphics_entities_render_phong_shader_batched(const Camera* camera, const Entity* entities, s32 entity_count, const Light* lights);
 void graphics_light_create(Light* light, vec3 position, vec4 ambient_color, vec4 diffuse_color, vec4 specular_color);
+// Picks the smallest format that holds the data without visible loss: R8/RG8/RGB8/RGBA8 for 8-bit data, and
+// for float data R11F_G11F_B10F (positive HDR colors), 16-bit floats, or 32-bit floats only when the values
+// do not fit in a half float.
+Texture_Format graphics_texture_choose_format(s32 channels, Texture_Usage usage);
+Texture_Format graphics_texture_choose_float_format(const Float_Image_Data* image_data, Texture_Usage usage);
+// The variants without usage create albedo textures.
 u32 graphics_texture_create(const s8* texture_path);
+u32 graphics_texture_create_with_usage(const s8* texture_path, Texture_Usage usage);
 u32 graphics_texture_create_from_data(const Image_Data* image_data);
+u32 graphics_texture_create_from_data_with_usage(const Image_Data* image_data, Texture_Usage usage);
+// Uploads a precomputed mip chain (level 0 first) instead of generating one.
+u32 graphics_texture_create_from_mips(const Image_Data* levels, Texture_Usage usage);
 u32 graphics_texture_create_from_float_data(const Float_Image_Data* image_data);
+u32 graphics_texture_create_from_float_data_with_usage(const Float_Image_Data* image_data, Texture_Usage usage);
+u32 graphics_texture_create_from_compressed_data(const struct Compressed_Image_Data* image_data);
 void graphics_texture_delete(u32 texture_id);
+// Conversions run on the job workers (see image_convert.h). Float values are clamped to [0, 1].
 Float_Image_Data graphics_image_data_to_float_image_data(Image_Data* image_data, r32* memory);
 Image_Data graphics_float_image_data_to_image_data(const Float_Image_Data* float_image_Data, u8* memory);
 
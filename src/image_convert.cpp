@@ -0,0 +1,281 @@
+#include "image_convert.h"
+#include "jobs.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_CONVERT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define IMAGE_CONVERT_USE_AVX2
+#include <immintrin.h>
+#endif
+
+// Rows are grouped so every chunk converts at least this many values; smaller chunks cost more in scheduling
+// than they save.
+#define IMAGE_CONVERT_MIN_VALUES_PER_JOB (64 * 1024)
+
+typedef struct
+{
+	const void* in;
+	void* out;
+	s32 row_length;
+} Conversion_Job;
+
+typedef struct
+{
+	r32 values[256];
+} U8_To_Float_Table;
+
+static U8_To_Float_Table build_u8_to_float_table()
+{
+	U8_To_Float_Table table;
+	for (s32 i = 0; i < 256; ++i)
+		table.values[i] = i / 255.0f;
+	return table;
+}
+
+static const r32* get_u8_to_float_table()
+{
+	static const U8_To_Float_Table table = build_u8_to_float_table();
+	return table.values;
+}
+
+static u8 float_to_u8(r32 value)
+{
+	// Written so NaN ends up as 0, matching the max/min instructions used by the SIMD paths.
+	value = value > 0.0f ? value : 0.0f;
+	value = value < 1.0f ? value : 1.0f;
+	return (u8)(value * 255.0f + 0.5f);
+}
+
+void image_convert_u8_to_float_row(const u8* in, r32* out, s32 count)
+{
+	s32 i = 0;
+
+	// Division instead of multiplying by 1/255, so the results match the lookup table bit for bit.
+#if defined(IMAGE_CONVERT_USE_AVX2)
+	__m256 scale = _mm256_set1_ps(255.0f);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+		__m256i low = _mm256_cvtepu8_epi32(bytes);
+		__m256i high = _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8));
+		_mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_cvtepi32_ps(low), scale));
+		_mm256_storeu_ps(out + i + 8, _mm256_div_ps(_mm256_cvtepi32_ps(high), scale));
+	}
+#elif defined(IMAGE_CONVERT_USE_SSE2)
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i words_low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i words_high = _mm_unpackhi_epi8(bytes, zero);
+		__m128 v0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words_low, zero));
+		__m128 v1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words_low, zero));
+		__m128 v2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words_high, zero));
+		__m128 v3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words_high, zero));
+		_mm_storeu_ps(out + i + 0, _mm_div_ps(v0, scale));
+		_mm_storeu_ps(out + i + 4, _mm_div_ps(v1, scale));
+		_mm_storeu_ps(out + i + 8, _mm_div_ps(v2, scale));
+		_mm_storeu_ps(out + i + 12, _mm_div_ps(v3, scale));
+	}
+#endif
+
+	const r32* table = get_u8_to_float_table();
+	for (; i < count; ++i)
+		out[i] = table[in[i]];
+}
+
+void image_convert_float_to_u8_row(const r32* in, u8* out, s32 count)
+{
+	s32 i = 0;
+
+#if defined(IMAGE_CONVERT_USE_AVX2)
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 scale = _mm256_set1_ps(255.0f);
+	__m256 half = _mm256_set1_ps(0.5f);
+	for (; i + 16 <= count; i += 16)
+	{
+		// max/min return the second operand when the first one is NaN.
+		__m256 v0 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), zero), one);
+		__m256 v1 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), zero), one);
+		__m256i i0 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v0, scale), half));
+		__m256i i1 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v1, scale), half));
+		// Packing works per 128-bit lane, the permute puts the 64-bit groups back in order.
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(i0, i1), 0xD8);
+		__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+		_mm_storeu_si128((__m128i*)(out + i), bytes);
+	}
+#elif defined(IMAGE_CONVERT_USE_SSE2)
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	for (; i + 16 <= count; i += 16)
+	{
+		// max/min return the second operand when the first one is NaN.
+		__m128 v0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 0), zero), one);
+		__m128 v1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), zero), one);
+		__m128 v2 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 8), zero), one);
+		__m128 v3 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 12), zero), one);
+		__m128i i0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v0, scale), half));
+		__m128i i1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v1, scale), half));
+		__m128i i2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v2, scale), half));
+		__m128i i3 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v3, scale), half));
+		__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3));
+		_mm_storeu_si128((__m128i*)(out + i), bytes);
+	}
+#endif
+
+	for (; i < count; ++i)
+		out[i] = float_to_u8(in[i]);
+}
+
+static void convert_to_float(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Conversion_Job* job = (Conversion_Job*)data;
+	size_t offset = (size_t)begin * job->row_length;
+	image_convert_u8_to_float_row((const u8*)job->in + offset, (r32*)job->out + offset, (end - begin) * job->row_length);
+}
+
+static void convert_to_u8(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Conversion_Job* job = (Conversion_Job*)data;
+	size_t offset = (size_t)begin * job->row_length;
+	image_convert_float_to_u8_row((const r32*)job->in + offset, (u8*)job->out + offset, (end - begin) * job->row_length);
+}
+
+static s32 get_min_rows_per_job(s32 row_length)
+{
+	s32 rows = IMAGE_CONVERT_MIN_VALUES_PER_JOB / (row_length > 0 ? row_length : 1);
+	return rows > 0 ? rows : 1;
+}
+
+void image_convert_u8_to_float(const u8* in, r32* out, s32 width, s32 height, s32 channels)
+{
+	Conversion_Job job;
+	job.in = in;
+	job.out = out;
+	job.row_length = width * channels;
+	jobs_parallel_for(height, get_min_rows_per_job(job.row_length), convert_to_float, &job);
+}
+
+void image_convert_float_to_u8(const r32* in, u8* out, s32 width, s32 height, s32 channels)
+{
+	Conversion_Job job;
+	job.in = in;
+	job.out = out;
+	job.row_length = width * channels;
+	jobs_parallel_for(height, get_min_rows_per_job(job.row_length), convert_to_u8, &job);
+}
+
+// BT.601 limited range in 8-bit fixed point. Chroma uses the sum of 4 pixels, hence the 2 extra bits of shift.
+#define IMAGE_CONVERT_Y(r, g, b) ((((66 * (r) + 129 * (g) + 25 * (b) + 128) >> 8) + 16))
+#define IMAGE_CONVERT_U(r4, g4, b4) ((((-38 * (r4) - 74 * (g4) + 112 * (b4) + 512) >> 10) + 128))
+#define IMAGE_CONVERT_V(r4, g4, b4) ((((112 * (r4) - 94 * (g4) - 18 * (b4) + 512) >> 10) + 128))
+
+#ifdef IMAGE_CONVERT_USE_SSE2
+// Dot product of every RGBA pixel in lo (2 pixels) and hi (2 pixels, 16-bit channels) with the coefficients.
+static __m128i dot_rgba(__m128i lo, __m128i hi, __m128i coefficients)
+{
+	__m128 products_lo = _mm_castsi128_ps(_mm_madd_epi16(lo, coefficients));
+	__m128 products_hi = _mm_castsi128_ps(_mm_madd_epi16(hi, coefficients));
+	// madd leaves (r*cr + g*cg, b*cb + a*ca) per pixel, the two halves are added here.
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(products_lo, products_hi, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(products_lo, products_hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+// Luma of 8 pixels, packed in the low 8 bytes.
+static __m128i luma8(__m128i pixels0, __m128i pixels1)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i coefficients = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+	__m128i rounding = _mm_set1_epi32(128), offset = _mm_set1_epi32(16);
+
+	__m128i y0 = dot_rgba(_mm_unpacklo_epi8(pixels0, zero), _mm_unpackhi_epi8(pixels0, zero), coefficients);
+	__m128i y1 = dot_rgba(_mm_unpacklo_epi8(pixels1, zero), _mm_unpackhi_epi8(pixels1, zero), coefficients);
+	y0 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y0, rounding), 8), offset);
+	y1 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y1, rounding), 8), offset);
+	__m128i words = _mm_packs_epi32(y0, y1);
+	return _mm_packus_epi16(words, words);
+}
+
+// Sums each 2x2 block of 4 pixels from two rows. Returns the 2 blocks as 16-bit RGBA.
+static __m128i sum_blocks(__m128i top, __m128i bottom)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+// One chroma plane for 4 blocks, packed in the low 4 bytes.
+static u32 chroma4(__m128i blocks0, __m128i blocks1, __m128i coefficients)
+{
+	__m128i value = dot_rgba(blocks0, blocks1, coefficients);
+	value = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(value, _mm_set1_epi32(512)), 10), _mm_set1_epi32(128));
+	__m128i words = _mm_packs_epi32(value, value);
+	return (u32)_mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+}
+#endif
+
+void image_convert_rgba_to_yuv420(const u8* rgba, s32 stride, s32 width, s32 height, u8* y_plane, u8* u_plane,
+	u8* v_plane)
+{
+	s32 chroma_width = width / 2;
+
+	for (s32 y = 0; y + 1 < height; y += 2)
+	{
+		const u8* top = rgba + (s64)y * stride;
+		const u8* bottom = top + stride;
+		u8* y_top = y_plane + (size_t)y * width;
+		u8* y_bottom = y_top + width;
+		u8* u_row = u_plane + (size_t)(y / 2) * chroma_width;
+		u8* v_row = v_plane + (size_t)(y / 2) * chroma_width;
+		s32 x = 0;
+
+#ifdef IMAGE_CONVERT_USE_SSE2
+		__m128i u_coefficients = _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+		__m128i v_coefficients = _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i top0 = _mm_loadu_si128((const __m128i*)(top + x * 4));
+			__m128i top1 = _mm_loadu_si128((const __m128i*)(top + x * 4 + 16));
+			__m128i bottom0 = _mm_loadu_si128((const __m128i*)(bottom + x * 4));
+			__m128i bottom1 = _mm_loadu_si128((const __m128i*)(bottom + x * 4 + 16));
+
+			_mm_storel_epi64((__m128i*)(y_top + x), luma8(top0, top1));
+			_mm_storel_epi64((__m128i*)(y_bottom + x), luma8(bottom0, bottom1));
+
+			__m128i blocks0 = sum_blocks(top0, bottom0);
+			__m128i blocks1 = sum_blocks(top1, bottom1);
+			u32 u = chroma4(blocks0, blocks1, u_coefficients);
+			u32 v = chroma4(blocks0, blocks1, v_coefficients);
+			memcpy(u_row + x / 2, &u, 4);
+			memcpy(v_row + x / 2, &v, 4);
+		}
+#endif
+
+		for (; x + 1 < width; x += 2)
+		{
+			const u8* p[4] = { top + x * 4, top + x * 4 + 4, bottom + x * 4, bottom + x * 4 + 4 };
+			y_top[x] = (u8)IMAGE_CONVERT_Y(p[0][0], p[0][1], p[0][2]);
+			y_top[x + 1] = (u8)IMAGE_CONVERT_Y(p[1][0], p[1][1], p[1][2]);
+			y_bottom[x] = (u8)IMAGE_CONVERT_Y(p[2][0], p[2][1], p[2][2]);
+			y_bottom[x + 1] = (u8)IMAGE_CONVERT_Y(p[3][0], p[3][1], p[3][2]);
+
+			s32 r = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+			s32 g = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+			s32 b = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+			u_row[x / 2] = (u8)IMAGE_CONVERT_U(r, g, b);
+			v_row[x / 2] = (u8)IMAGE_CONVERT_V(r, g, b);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef BASIC_ENGINE_IMAGE_CONVERT_H
+#define BASIC_ENGINE_IMAGE_CONVERT_H
+#include "common.h"
+
+// Conversion kernels between 8-bit and float images. u8 values map to [0, 1] as value / 255; floats are clamped to
+// [0, 1] and rounded to the nearest u8. Channels are converted independently, so any channel count works.
+// The SIMD paths (SSE2, AVX2 when compiled with -mavx2) give exactly the same results as the scalar path.
+
+// Converts a single run of values on the calling thread. Meant for callers that already split work across the jobs.
+void image_convert_u8_to_float_row(const u8* in, r32* out, s32 count);
+void image_convert_float_to_u8_row(const r32* in, u8* out, s32 count);
+// Converts width * height * channels values, splitting rows across the job workers.
+void image_convert_u8_to_float(const u8* in, r32* out, s32 width, s32 height, s32 channels);
+void image_convert_float_to_u8(const r32* in, u8* out, s32 width, s32 height, s32 channels);
+// Converts RGBA pixels to planar YUV 4:2:0 (I420) with BT.601 limited range coefficients, the usual input of video
+// encoders. Chroma is computed from the average of each 2x2 block. width and height must be even.
+// stride is the distance in bytes between two rows and can be negative to flip the image (e.g. for frames read back
+// from OpenGL, pass a pointer to the last row). Runs on the calling thread.
+void image_convert_rgba_to_yuv420(const u8* rgba, s32 stride, s32 width, s32 height, u8* y_plane, u8* u_plane,
+	u8* v_plane);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "image_loader.h"
+#include "util.h"
+#include "jobs.h"
+#include <stb_image.h>
+#include <light_array.h>
+#include <stdio.h>
+#include <mutex>
+#include <condition_variable>
+
+typedef struct
+{
+	Image_Data image;
+	s32 index;
+	bool ready;
+} Image_Loader_Slot;
+
+// Shared between the caller and its helper jobs. Helpers may only start after the caller returned (the queue can be
+// busy with long jobs), so the last one to let go frees it.
+typedef struct
+{
+	const s8* const* image_paths;
+	s32 count;
+	s32 max_in_flight;
+	// Image i goes to slot i % max_in_flight. Only images in [delivered, delivered + max_in_flight) are claimed,
+	// so slots are never shared.
+	Image_Loader_Slot* slots;
+	s32 next_claim;
+	s32 delivered;
+	s32 active_helpers;
+	s32 references;
+	std::mutex mutex;
+	std::condition_variable ready_condition;
+} Image_Loader;
+
+static Image_Data decode_image(const s8* image_path)
+{
+	Image_Data image_data;
+	image_data.data = 0;
+	image_data.width = image_data.height = image_data.channels = 0;
+
+	u64 file_size;
+	const u8* file = util_map_file(image_path, &file_size);
+	if (file)
+	{
+		image_data.data = stbi_load_from_memory(file, (s32)file_size, &image_data.width, &image_data.height,
+			&image_data.channels, 0);
+		util_unmap_file(file, file_size);
+	}
+
+	// stbi_failure_reason is shared by all threads, so it is not worth reporting here.
+	if (!image_data.data)
+		printf("Error loading image %s\n", image_path);
+
+	return image_data;
+}
+
+// Must be called with the mutex locked.
+static bool can_claim(const Image_Loader* loader)
+{
+	return loader->next_claim < loader->count && loader->next_claim < loader->delivered + loader->max_in_flight;
+}
+
+// Must be called with the mutex locked. Unlocks it while decoding.
+static void decode_claimed(Image_Loader* loader, std::unique_lock<std::mutex>& lock)
+{
+	s32 index = loader->next_claim++;
+	lock.unlock();
+	Image_Data image_data = decode_image(loader->image_paths[index]);
+	lock.lock();
+
+	Image_Loader_Slot* slot = &loader->slots[index % loader->max_in_flight];
+	slot->image = image_data;
+	slot->index = index;
+	slot->ready = true;
+	loader->ready_condition.notify_all();
+}
+
+static void release(Image_Loader* loader, std::unique_lock<std::mutex>& lock)
+{
+	bool last = --loader->references == 0;
+	lock.unlock();
+	if (last)
+	{
+		delete[] loader->slots;
+		delete loader;
+	}
+}
+
+static void helper_job(void* data)
+{
+	Image_Loader* loader = (Image_Loader*)data;
+	std::unique_lock<std::mutex> lock(loader->mutex);
+
+	while (can_claim(loader))
+		decode_claimed(loader, lock);
+
+	// Stops when the window is full; the caller submits new helpers as it delivers images.
+	--loader->active_helpers;
+	release(loader, lock);
+}
+
+// Must be called with the mutex locked.
+static void submit_helpers(Image_Loader* loader)
+{
+	s32 helper_count = jobs_get_worker_count();
+	s32 claimable = loader->delivered + loader->max_in_flight;
+	if (claimable > loader->count)
+		claimable = loader->count;
+	claimable -= loader->next_claim;
+
+	while (loader->active_helpers < helper_count && loader->active_helpers < claimable)
+	{
+		++loader->active_helpers;
+		++loader->references;
+		jobs_submit(helper_job, loader);
+	}
+}
+
+void image_loader_load(const s8* const* image_paths, s32 count, s32 max_in_flight, Image_Loader_Callback callback,
+	void* data)
+{
+	if (count <= 0)
+		return;
+	if (max_in_flight < 1)
+		max_in_flight = 1;
+
+	// stb_image keeps this setting in a global, so it is set once here instead of from the workers.
+	stbi_set_flip_vertically_on_load(1);
+
+	Image_Loader* loader = new Image_Loader;
+	loader->image_paths = image_paths;
+	loader->count = count;
+	loader->max_in_flight = max_in_flight;
+	loader->slots = new Image_Loader_Slot[max_in_flight];
+	for (s32 i = 0; i < max_in_flight; ++i)
+		loader->slots[i].ready = false;
+	loader->next_claim = 0;
+	loader->delivered = 0;
+	loader->active_helpers = 0;
+	loader->references = 1;
+
+	std::unique_lock<std::mutex> lock(loader->mutex);
+	for (s32 i = 0; i < count; ++i)
+	{
+		submit_helpers(loader);
+
+		Image_Loader_Slot* slot = &loader->slots[i % max_in_flight];
+		while (!slot->ready)
+		{
+			// The caller decodes too instead of only waiting, so progress does not depend on the workers being free.
+			if (can_claim(loader))
+				decode_claimed(loader, lock);
+			else
+				loader->ready_condition.wait(lock);
+		}
+
+		Image_Data image_data = slot->image;
+		slot->ready = false;
+		lock.unlock();
+		callback(i, &image_data, data);
+		lock.lock();
+		++loader->delivered;
+	}
+
+	release(loader, lock);
+}
+
+static void store_image(s32 index, Image_Data* image_data, void* data)
+{
+	Image_Data* images = (Image_Data*)data;
+	images[index] = *image_data;
+}
+
+Image_Data* image_loader_load_all(const s8* const* image_paths, s32 count)
+{
+	Image_Data* images = array_new(Image_Data);
+	Image_Data empty = {0};
+	for (s32 i = 0; i < count; ++i)
+		array_push(images, empty);
+
+	// Every image is kept anyway, so the window only needs to keep all workers busy.
+	image_loader_load(image_paths, count, count, store_image, images);
+	return images;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef BASIC_ENGINE_IMAGE_LOADER_H
+#define BASIC_ENGINE_IMAGE_LOADER_H
+#include "graphics.h"
+
+// Decodes many images in parallel. Files are memory mapped and decoded with stb_image on the job workers and on the
+// calling thread. Images are flipped vertically, like graphics_image_load.
+
+#define IMAGE_LOADER_DEFAULT_MAX_IN_FLIGHT 8
+
+// Receives image index (in request order) and takes ownership of image_data (release with graphics_image_free).
+// image_data->data is null if the image could not be loaded.
+typedef void (*Image_Loader_Callback)(s32 index, Image_Data* image_data, void* data);
+
+// Calls callback on the calling thread once per path, in order, and returns after the last one.
+// At most max_in_flight images are being decoded or waiting for the callback at any time, which bounds peak memory
+// to about max_in_flight decoded images plus their mapped files.
+void image_loader_load(const s8* const* image_paths, s32 count, s32 max_in_flight, Image_Loader_Callback callback,
+	void* data);
+// Loads every image at once. Returns an array (light_array) of count images in request order. Peak memory is not
+// bounded, use image_loader_load to process images as they arrive.
+Image_Data* image_loader_load_all(const s8* const* image_paths, s32 count);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,511 @@
+#include "image_process.h"
+#include "jobs.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+#define IMAGE_PROCESS_LANCZOS_RADIUS 3.0f
+
+typedef struct
+{
+	s32 x0, y0, x1, y1;
+} Tile;
+
+typedef struct
+{
+	const Float_Image_Data* source;
+	Float_Image_Data* destination;
+	const r32* kernel;
+	s32 radius;
+} Convolve_Job;
+
+typedef struct
+{
+	const Float_Image_Data* source;
+	Float_Image_Data* destination;
+	Image_Process_Filter filter;
+} Resize_Job;
+
+typedef struct
+{
+	const Float_Image_Data* source;
+	Float_Image_Data* destination;
+	Image_Process_Map_Function function;
+	void* data;
+} Map_Job;
+
+typedef struct
+{
+	const Float_Image_Data* image;
+	const void* identity;
+	s32 accumulator_size;
+	Image_Process_Reduce_Function reduce;
+	Image_Process_Merge_Function merge;
+	void* result;
+	void* data;
+	std::mutex mutex;
+} Reduce_Job;
+
+// Sample weights of one output sample of a resize.
+typedef struct
+{
+	s32 first;
+	s32 tap_count;
+	r32 weights[IMAGE_PROCESS_MAX_RESIZE_TAPS];
+} Resize_Contribution;
+
+static s32 clamp_index(s32 index, s32 size)
+{
+	return index < 0 ? 0 : (index >= size ? size - 1 : index);
+}
+
+static s32 get_tile_count(s32 width, s32 height)
+{
+	s32 tiles_x = (width + IMAGE_PROCESS_TILE_SIZE - 1) / IMAGE_PROCESS_TILE_SIZE;
+	s32 tiles_y = (height + IMAGE_PROCESS_TILE_SIZE - 1) / IMAGE_PROCESS_TILE_SIZE;
+	return tiles_x * tiles_y;
+}
+
+static Tile get_tile(s32 width, s32 height, s32 index)
+{
+	s32 tiles_x = (width + IMAGE_PROCESS_TILE_SIZE - 1) / IMAGE_PROCESS_TILE_SIZE;
+	Tile tile;
+	tile.x0 = (index % tiles_x) * IMAGE_PROCESS_TILE_SIZE;
+	tile.y0 = (index / tiles_x) * IMAGE_PROCESS_TILE_SIZE;
+	tile.x1 = tile.x0 + IMAGE_PROCESS_TILE_SIZE < width ? tile.x0 + IMAGE_PROCESS_TILE_SIZE : width;
+	tile.y1 = tile.y0 + IMAGE_PROCESS_TILE_SIZE < height ? tile.y0 + IMAGE_PROCESS_TILE_SIZE : height;
+	return tile;
+}
+
+static void run_tiles(s32 width, s32 height, Job_Range_Function function, void* data)
+{
+	jobs_parallel_for(get_tile_count(width, height), 1, function, data);
+}
+
+static void prepare_destination(Float_Image_Data* destination)
+{
+	if (!destination->data)
+		destination->data = (r32*)malloc(sizeof(r32) * destination->width * destination->height * destination->channels);
+}
+
+// Convolution
+
+static void convolve_horizontal(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Convolve_Job* job = (Convolve_Job*)data;
+	const Float_Image_Data* source = job->source;
+	s32 channels = source->channels;
+	s32 radius = job->radius;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(source->width, source->height, t);
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			const r32* in = source->data + (size_t)y * source->width * channels;
+			r32* out = job->destination->data + (size_t)y * source->width * channels;
+			for (s32 x = tile.x0; x < tile.x1; ++x)
+			{
+				r32 sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+				bool interior = x - radius >= 0 && x + radius < source->width;
+				for (s32 c = 0; c < channels; c += 4)
+				{
+					s32 group = channels - c < 4 ? channels - c : 4;
+					for (s32 k = -radius; k <= radius; ++k)
+					{
+						s32 sx = interior ? x + k : clamp_index(x + k, source->width);
+						const r32* sample = in + (size_t)sx * channels + c;
+						r32 weight = job->kernel[k + radius];
+						for (s32 i = 0; i < group; ++i)
+							sum[i] += weight * sample[i];
+					}
+					for (s32 i = 0; i < group; ++i)
+					{
+						out[(size_t)x * channels + c + i] = sum[i];
+						sum[i] = 0.0f;
+					}
+				}
+			}
+		}
+	}
+}
+
+static void convolve_vertical(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Convolve_Job* job = (Convolve_Job*)data;
+	const Float_Image_Data* source = job->source;
+	s32 channels = source->channels;
+	s32 row_length = source->width * channels;
+	s32 radius = job->radius;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(source->width, source->height, t);
+		s32 span_begin = tile.x0 * channels;
+		s32 span_end = tile.x1 * channels;
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			r32* out = job->destination->data + (size_t)y * row_length;
+			for (s32 i = span_begin; i < span_end; ++i)
+				out[i] = 0.0f;
+			// Whole row spans at a time, so the inner loop runs over contiguous memory.
+			for (s32 k = -radius; k <= radius; ++k)
+			{
+				const r32* in = source->data + (size_t)clamp_index(y + k, source->height) * row_length;
+				r32 weight = job->kernel[k + radius];
+				for (s32 i = span_begin; i < span_end; ++i)
+					out[i] += weight * in[i];
+			}
+		}
+	}
+}
+
+s32 image_process_get_convolve_scratch_size(const Float_Image_Data* source)
+{
+	return source->width * source->height * source->channels;
+}
+
+void image_process_convolve_separable(const Float_Image_Data* source, Float_Image_Data* destination,
+	const r32* kernel, s32 radius, r32* scratch)
+{
+	Float_Image_Data temporary = *source;
+	temporary.data = scratch ? scratch : (r32*)malloc(sizeof(r32) * image_process_get_convolve_scratch_size(source));
+	prepare_destination(destination);
+
+	// The horizontal pass only reads the source and the vertical pass only reads the scratch image,
+	// so source and destination can be the same image.
+	Convolve_Job job;
+	job.kernel = kernel;
+	job.radius = radius;
+	job.source = source;
+	job.destination = &temporary;
+	run_tiles(source->width, source->height, convolve_horizontal, &job);
+
+	job.source = &temporary;
+	job.destination = destination;
+	run_tiles(source->width, source->height, convolve_vertical, &job);
+
+	if (!scratch)
+		free(temporary.data);
+}
+
+void image_process_blur(const Float_Image_Data* source, Float_Image_Data* destination, r32 sigma, r32* scratch)
+{
+	s32 radius = (s32)ceilf(3.0f * sigma);
+	if (radius > IMAGE_PROCESS_MAX_BLUR_RADIUS)
+		radius = IMAGE_PROCESS_MAX_BLUR_RADIUS;
+	if (radius < 0)
+		radius = 0;
+
+	r32 kernel[2 * IMAGE_PROCESS_MAX_BLUR_RADIUS + 1];
+	r32 sum = 0.0f;
+	for (s32 i = -radius; i <= radius; ++i)
+	{
+		kernel[i + radius] = sigma > 0.0f ? expf(-(i * i) / (2.0f * sigma * sigma)) : 1.0f;
+		sum += kernel[i + radius];
+	}
+	for (s32 i = 0; i < 2 * radius + 1; ++i)
+		kernel[i] /= sum;
+
+	image_process_convolve_separable(source, destination, kernel, radius, scratch);
+}
+
+// Resize
+
+static r32 evaluate_filter(Image_Process_Filter filter, r32 x)
+{
+	x = fabsf(x);
+	switch (filter)
+	{
+		case IMAGE_PROCESS_FILTER_BILINEAR: {
+			return x < 1.0f ? 1.0f - x : 0.0f;
+		} break;
+		case IMAGE_PROCESS_FILTER_LANCZOS3: {
+			if (x < 1e-5f)
+				return 1.0f;
+			if (x >= IMAGE_PROCESS_LANCZOS_RADIUS)
+				return 0.0f;
+			r32 px = PI_F * x;
+			return IMAGE_PROCESS_LANCZOS_RADIUS * sinf(px) * sinf(px / IMAGE_PROCESS_LANCZOS_RADIUS) / (px * px);
+		} break;
+	}
+	return 0.0f;
+}
+
+static Resize_Contribution get_resize_contribution(Image_Process_Filter filter, s32 source_size, s32 destination_size,
+	s32 index)
+{
+	r32 scale = (r32)source_size / destination_size;
+	r32 radius = filter == IMAGE_PROCESS_FILTER_LANCZOS3 ? IMAGE_PROCESS_LANCZOS_RADIUS : 1.0f;
+	// When downscaling the filter is stretched over the source, so it also removes the frequencies the smaller
+	// image cannot hold.
+	r32 filter_scale = scale > 1.0f ? scale : 1.0f;
+	r32 max_filter_scale = (IMAGE_PROCESS_MAX_RESIZE_TAPS - 1) / (2.0f * radius);
+	if (filter_scale > max_filter_scale)
+		filter_scale = max_filter_scale;
+
+	r32 center = (index + 0.5f) * scale - 0.5f;
+	r32 support = radius * filter_scale;
+	s32 first = (s32)floorf(center - support) + 1;
+	s32 last = (s32)floorf(center + support);
+	if (last - first + 1 > IMAGE_PROCESS_MAX_RESIZE_TAPS)
+		last = first + IMAGE_PROCESS_MAX_RESIZE_TAPS - 1;
+
+	Resize_Contribution contribution;
+	contribution.first = first;
+	contribution.tap_count = last - first + 1;
+	r32 sum = 0.0f;
+	for (s32 i = 0; i < contribution.tap_count; ++i)
+	{
+		contribution.weights[i] = evaluate_filter(filter, (first + i - center) / filter_scale);
+		sum += contribution.weights[i];
+	}
+	for (s32 i = 0; i < contribution.tap_count; ++i)
+		contribution.weights[i] /= sum;
+
+	return contribution;
+}
+
+static void resize_horizontal(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Resize_Job* job = (Resize_Job*)data;
+	const Float_Image_Data* source = job->source;
+	Float_Image_Data* destination = job->destination;
+	s32 channels = source->channels;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(destination->width, destination->height, t);
+		// Weights only depend on the column, so they are computed once per tile and reused for all of its rows.
+		Resize_Contribution contributions[IMAGE_PROCESS_TILE_SIZE];
+		for (s32 x = tile.x0; x < tile.x1; ++x)
+			contributions[x - tile.x0] = get_resize_contribution(job->filter, source->width, destination->width, x);
+
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			const r32* in = source->data + (size_t)y * source->width * channels;
+			r32* out = destination->data + (size_t)y * destination->width * channels;
+			for (s32 x = tile.x0; x < tile.x1; ++x)
+			{
+				const Resize_Contribution* contribution = &contributions[x - tile.x0];
+				for (s32 c = 0; c < channels; ++c)
+				{
+					r32 sum = 0.0f;
+					for (s32 i = 0; i < contribution->tap_count; ++i)
+					{
+						s32 sx = clamp_index(contribution->first + i, source->width);
+						sum += contribution->weights[i] * in[(size_t)sx * channels + c];
+					}
+					out[(size_t)x * channels + c] = sum;
+				}
+			}
+		}
+	}
+}
+
+static void resize_vertical(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Resize_Job* job = (Resize_Job*)data;
+	const Float_Image_Data* source = job->source;
+	Float_Image_Data* destination = job->destination;
+	s32 row_length = source->width * source->channels;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(destination->width, destination->height, t);
+		s32 span_begin = tile.x0 * source->channels;
+		s32 span_end = tile.x1 * source->channels;
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			Resize_Contribution contribution = get_resize_contribution(job->filter, source->height,
+				destination->height, y);
+			r32* out = destination->data + (size_t)y * row_length;
+			for (s32 i = span_begin; i < span_end; ++i)
+				out[i] = 0.0f;
+			for (s32 k = 0; k < contribution.tap_count; ++k)
+			{
+				const r32* in = source->data + (size_t)clamp_index(contribution.first + k, source->height) * row_length;
+				r32 weight = contribution.weights[k];
+				for (s32 i = span_begin; i < span_end; ++i)
+					out[i] += weight * in[i];
+			}
+		}
+	}
+}
+
+s32 image_process_get_resize_scratch_size(const Float_Image_Data* source, s32 width, s32 height)
+{
+	return width * source->height * source->channels;
+}
+
+void image_process_resize(const Float_Image_Data* source, Float_Image_Data* destination, Image_Process_Filter filter,
+	r32* scratch)
+{
+	destination->channels = source->channels;
+	prepare_destination(destination);
+
+	// Columns first: the intermediate image has the destination width and the source height.
+	Float_Image_Data temporary;
+	temporary.width = destination->width;
+	temporary.height = source->height;
+	temporary.channels = source->channels;
+	temporary.data = scratch ? scratch :
+		(r32*)malloc(sizeof(r32) * image_process_get_resize_scratch_size(source, destination->width, destination->height));
+
+	Resize_Job job;
+	job.filter = filter;
+	job.source = source;
+	job.destination = &temporary;
+	run_tiles(temporary.width, temporary.height, resize_horizontal, &job);
+
+	job.source = &temporary;
+	job.destination = destination;
+	run_tiles(destination->width, destination->height, resize_vertical, &job);
+
+	if (!scratch)
+		free(temporary.data);
+}
+
+// Map and reduce
+
+static void map_tiles(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Map_Job* job = (Map_Job*)data;
+	const Float_Image_Data* source = job->source;
+	s32 channels = source->channels;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(source->width, source->height, t);
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			size_t offset = ((size_t)y * source->width + tile.x0) * channels;
+			job->function(source->data + offset, job->destination->data + offset, tile.x1 - tile.x0, channels, job->data);
+		}
+	}
+}
+
+void image_process_map(const Float_Image_Data* source, Float_Image_Data* destination,
+	Image_Process_Map_Function function, void* data)
+{
+	prepare_destination(destination);
+
+	Map_Job job;
+	job.source = source;
+	job.destination = destination;
+	job.function = function;
+	job.data = data;
+	run_tiles(source->width, source->height, map_tiles, &job);
+}
+
+static void reduce_tiles(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Reduce_Job* job = (Reduce_Job*)data;
+	const Float_Image_Data* image = job->image;
+
+	// r64 keeps the accumulator aligned for any type the caller stores in it.
+	r64 partial[IMAGE_PROCESS_MAX_ACCUMULATOR_SIZE / sizeof(r64)];
+	memcpy(partial, job->identity, job->accumulator_size);
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Tile tile = get_tile(image->width, image->height, t);
+		for (s32 y = tile.y0; y < tile.y1; ++y)
+		{
+			size_t offset = ((size_t)y * image->width + tile.x0) * image->channels;
+			job->reduce(partial, image->data + offset, tile.x1 - tile.x0, image->channels, job->data);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(job->mutex);
+	job->merge(job->result, partial, job->data);
+}
+
+void image_process_reduce(const Float_Image_Data* image, const void* identity, s32 accumulator_size,
+	Image_Process_Reduce_Function reduce, Image_Process_Merge_Function merge, void* result, void* data)
+{
+	if (accumulator_size > IMAGE_PROCESS_MAX_ACCUMULATOR_SIZE)
+	{
+		printf("Error: image_process_reduce accumulator is larger than %d bytes\n", IMAGE_PROCESS_MAX_ACCUMULATOR_SIZE);
+		return;
+	}
+
+	memcpy(result, identity, accumulator_size);
+
+	Reduce_Job job;
+	job.image = image;
+	job.identity = identity;
+	job.accumulator_size = accumulator_size;
+	job.reduce = reduce;
+	job.merge = merge;
+	job.result = result;
+	job.data = data;
+	run_tiles(image->width, image->height, reduce_tiles, &job);
+}
+
+typedef struct
+{
+	r32 min[4];
+	r32 max[4];
+	r64 sum[4];
+} Statistics_Accumulator;
+
+static void reduce_statistics(void* accumulator, const r32* pixels, s32 pixel_count, s32 channels, void* data)
+{
+	Statistics_Accumulator* statistics = (Statistics_Accumulator*)accumulator;
+	s32 reported_channels = channels < 4 ? channels : 4;
+	for (s32 c = 0; c < reported_channels; ++c)
+	{
+		// The row sum is accumulated in r32 and folded into the r64 total, which keeps the inner loop cheap.
+		r32 min = statistics->min[c], max = statistics->max[c], sum = 0.0f;
+		for (s32 i = 0; i < pixel_count; ++i)
+		{
+			r32 value = pixels[(size_t)i * channels + c];
+			min = value < min ? value : min;
+			max = value > max ? value : max;
+			sum += value;
+		}
+		statistics->min[c] = min;
+		statistics->max[c] = max;
+		statistics->sum[c] += sum;
+	}
+}
+
+static void merge_statistics(void* result, const void* partial, void* data)
+{
+	Statistics_Accumulator* statistics = (Statistics_Accumulator*)result;
+	const Statistics_Accumulator* other = (const Statistics_Accumulator*)partial;
+	for (s32 c = 0; c < 4; ++c)
+	{
+		statistics->min[c] = other->min[c] < statistics->min[c] ? other->min[c] : statistics->min[c];
+		statistics->max[c] = other->max[c] > statistics->max[c] ? other->max[c] : statistics->max[c];
+		statistics->sum[c] += other->sum[c];
+	}
+}
+
+Image_Process_Statistics image_process_get_statistics(const Float_Image_Data* image)
+{
+	Statistics_Accumulator identity, accumulator;
+	for (s32 c = 0; c < 4; ++c)
+	{
+		identity.min[c] = INFINITY;
+		identity.max[c] = -INFINITY;
+		identity.sum[c] = 0.0;
+	}
+
+	image_process_reduce(image, &identity, sizeof(Statistics_Accumulator), reduce_statistics, merge_statistics,
+		&accumulator, 0);
+
+	Image_Process_Statistics statistics;
+	r64 pixel_count = (r64)image->width * image->height;
+	for (s32 c = 0; c < 4; ++c)
+	{
+		bool reported = c < image->channels;
+		statistics.min[c] = reported ? accumulator.min[c] : 0.0f;
+		statistics.max[c] = reported ? accumulator.max[c] : 0.0f;
+		statistics.mean[c] = reported && pixel_count > 0.0 ? (r32)(accumulator.sum[c] / pixel_count) : 0.0f;
+	}
+	return statistics;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef BASIC_ENGINE_IMAGE_PROCESS_H
+#define BASIC_ENGINE_IMAGE_PROCESS_H
+#include "graphics.h"
+
+// Batch processing of float images. Every operation splits the image in tiles of IMAGE_PROCESS_TILE_SIZE^2 pixels,
+// small enough to stay in cache, and runs them on the job workers. Operations can be called from inside jobs.
+//
+// Destination images must have width, height and channels set. If their data is null, new memory is allocated
+// (to be released with free). Operations that need scratch memory take it as a parameter;
+// if it is null, it is allocated and released by the operation itself. Passing both avoids any allocation.
+//
+// Samples outside the image are clamped to the closest edge pixel.
+
+#define IMAGE_PROCESS_TILE_SIZE 64
+#define IMAGE_PROCESS_MAX_BLUR_RADIUS 32
+// Maximum number of source samples per output sample when resizing. Very large downscales are filtered with a
+// narrower kernel than ideal, so they may alias slightly.
+#define IMAGE_PROCESS_MAX_RESIZE_TAPS 64
+// Maximum size of the accumulator of image_process_reduce.
+#define IMAGE_PROCESS_MAX_ACCUMULATOR_SIZE 256
+
+typedef enum {
+	IMAGE_PROCESS_FILTER_BILINEAR,	// Tent filter, 2 taps when upscaling.
+	IMAGE_PROCESS_FILTER_LANCZOS3	// Windowed sinc, 6 taps when upscaling. Sharper, may ring a little.
+} Image_Process_Filter;
+
+// Transforms pixel_count pixels. in and out are the same pointer when the operation runs in place.
+typedef void (*Image_Process_Map_Function)(const r32* in, r32* out, s32 pixel_count, s32 channels, void* data);
+// Folds pixel_count pixels into the accumulator. Runs concurrently, each call on its own accumulator.
+typedef void (*Image_Process_Reduce_Function)(void* accumulator, const r32* pixels, s32 pixel_count, s32 channels,
+	void* data);
+// Folds a partial accumulator into the result. Calls are serialized, in no particular order.
+typedef void (*Image_Process_Merge_Function)(void* result, const void* partial, void* data);
+
+typedef struct
+{
+	r32 min[4];
+	r32 max[4];
+	r32 mean[4];
+} Image_Process_Statistics;
+
+// Number of r32 values the scratch memory of each operation must hold.
+s32 image_process_get_convolve_scratch_size(const Float_Image_Data* source);
+s32 image_process_get_resize_scratch_size(const Float_Image_Data* source, s32 width, s32 height);
+
+// Convolves with kernel (2 * radius + 1 weights) along x and then along y.
+// destination can be source, in which case the image is filtered in place.
+void image_process_convolve_separable(const Float_Image_Data* source, Float_Image_Data* destination,
+	const r32* kernel, s32 radius, r32* scratch);
+// Gaussian blur. The radius is 3 sigma, clamped to IMAGE_PROCESS_MAX_BLUR_RADIUS. Can run in place.
+void image_process_blur(const Float_Image_Data* source, Float_Image_Data* destination, r32 sigma, r32* scratch);
+// Resamples source to the size of destination. Cannot run in place.
+void image_process_resize(const Float_Image_Data* source, Float_Image_Data* destination, Image_Process_Filter filter,
+	r32* scratch);
+// Calls function over every row of every tile. destination can be source.
+void image_process_map(const Float_Image_Data* source, Float_Image_Data* destination,
+	Image_Process_Map_Function function, void* data);
+// result is reset to identity and receives the reduction of the whole image. Every job starts its own partial
+// accumulator from identity as well, so identity must be neutral for merge.
+void image_process_reduce(const Float_Image_Data* image, const void* identity, s32 accumulator_size,
+	Image_Process_Reduce_Function reduce, Image_Process_Merge_Function merge, void* result, void* data);
+// Per channel minimum, maximum and mean. Only the first 4 channels are reported.
+Image_Process_Statistics image_process_get_statistics(const Float_Image_Data* image);
+
+#endif
\ No newline at end of file
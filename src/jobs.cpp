@@ -0,0 +1,227 @@
+#include "jobs.h"
+#include <light_array.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+typedef struct {
+	Job_Function function;
+	void* data;
+} Job;
+
+typedef struct {
+	std::thread* workers;
+	s32 worker_count;
+	Job* queue;
+	s32 queue_head;
+	std::mutex mutex;
+	std::condition_variable queue_condition;
+	bool shutting_down;
+	bool initialized;
+} Jobs_Ctx;
+
+static Jobs_Ctx jobs_ctx;
+static std::mutex jobs_init_mutex;
+
+static void worker_loop()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(jobs_ctx.mutex);
+			while (jobs_ctx.queue_head == (s32)array_length(jobs_ctx.queue) && !jobs_ctx.shutting_down)
+				jobs_ctx.queue_condition.wait(lock);
+
+			if (jobs_ctx.queue_head == (s32)array_length(jobs_ctx.queue))
+				return;
+
+			job = jobs_ctx.queue[jobs_ctx.queue_head++];
+
+			// Reclaim the consumed part of the queue once it is empty.
+			if (jobs_ctx.queue_head == (s32)array_length(jobs_ctx.queue))
+			{
+				array_clear(jobs_ctx.queue);
+				jobs_ctx.queue_head = 0;
+			}
+		}
+
+		job.function(job.data);
+	}
+}
+
+void jobs_init(s32 worker_count)
+{
+	std::lock_guard<std::mutex> lock(jobs_init_mutex);
+	if (jobs_ctx.initialized)
+		return;
+
+	if (worker_count <= 0)
+	{
+		worker_count = (s32)std::thread::hardware_concurrency() - 1;
+		if (worker_count < 1)
+			worker_count = 1;
+	}
+
+	jobs_ctx.queue = array_new(Job);
+	jobs_ctx.queue_head = 0;
+	jobs_ctx.shutting_down = false;
+	jobs_ctx.worker_count = worker_count;
+	jobs_ctx.workers = new std::thread[worker_count];
+	for (s32 i = 0; i < worker_count; ++i)
+		jobs_ctx.workers[i] = std::thread(worker_loop);
+
+	jobs_ctx.initialized = true;
+}
+
+void jobs_destroy()
+{
+	std::lock_guard<std::mutex> lock(jobs_init_mutex);
+	if (!jobs_ctx.initialized)
+		return;
+
+	{
+		std::lock_guard<std::mutex> queue_lock(jobs_ctx.mutex);
+		jobs_ctx.shutting_down = true;
+	}
+	jobs_ctx.queue_condition.notify_all();
+
+	for (s32 i = 0; i < jobs_ctx.worker_count; ++i)
+		jobs_ctx.workers[i].join();
+
+	delete[] jobs_ctx.workers;
+	array_free(jobs_ctx.queue);
+	jobs_ctx.initialized = false;
+}
+
+s32 jobs_get_worker_count()
+{
+	jobs_init(0);
+	return jobs_ctx.worker_count;
+}
+
+void jobs_submit(Job_Function function, void* data)
+{
+	jobs_init(0);
+
+	Job job;
+	job.function = function;
+	job.data = data;
+	{
+		std::lock_guard<std::mutex> lock(jobs_ctx.mutex);
+		array_push(jobs_ctx.queue, job);
+	}
+	jobs_ctx.queue_condition.notify_one();
+}
+
+// Shared between the caller of jobs_parallel_for and its helper jobs. Helpers may only start running after the caller
+// already returned (the queue can be busy with long jobs), so the last one to let go frees it.
+typedef struct {
+	Job_Range_Function function;
+	void* data;
+	s32 count;
+	s32 chunk_size;
+	s32 chunk_count;
+	std::atomic<s32> next_chunk;
+	std::atomic<s32> pending_chunks;
+	std::atomic<s32> references;
+	std::mutex mutex;
+	std::condition_variable done_condition;
+} Parallel_For;
+
+static void parallel_for_release(Parallel_For* parallel_for)
+{
+	if (parallel_for->references.fetch_sub(1) == 1)
+		delete parallel_for;
+}
+
+static void parallel_for_run_chunks(Parallel_For* parallel_for)
+{
+	for (;;)
+	{
+		s32 chunk = parallel_for->next_chunk.fetch_add(1);
+		if (chunk >= parallel_for->chunk_count)
+			break;
+
+		s32 begin = chunk * parallel_for->chunk_size;
+		s32 end = begin + parallel_for->chunk_size;
+		if (end > parallel_for->count)
+			end = parallel_for->count;
+		parallel_for->function(parallel_for->data, begin, end, chunk);
+
+		if (parallel_for->pending_chunks.fetch_sub(1) == 1)
+		{
+			std::lock_guard<std::mutex> lock(parallel_for->mutex);
+			parallel_for->done_condition.notify_all();
+		}
+	}
+}
+
+static void parallel_for_helper(void* data)
+{
+	Parallel_For* parallel_for = (Parallel_For*)data;
+	parallel_for_run_chunks(parallel_for);
+	parallel_for_release(parallel_for);
+}
+
+static s32 get_chunk_size(s32 count, s32 min_chunk_size)
+{
+	if (min_chunk_size < 1)
+		min_chunk_size = 1;
+
+	// A few chunks per thread help balancing when chunks take different amounts of time.
+	s32 thread_count = jobs_get_worker_count() + 1;
+	s32 chunk_size = (count + thread_count * 4 - 1) / (thread_count * 4);
+	return chunk_size < min_chunk_size ? min_chunk_size : chunk_size;
+}
+
+s32 jobs_get_chunk_count(s32 count, s32 min_chunk_size)
+{
+	if (count <= 0)
+		return 0;
+
+	s32 chunk_size = get_chunk_size(count, min_chunk_size);
+	return (count + chunk_size - 1) / chunk_size;
+}
+
+void jobs_parallel_for(s32 count, s32 min_chunk_size, Job_Range_Function function, void* data)
+{
+	s32 chunk_count = jobs_get_chunk_count(count, min_chunk_size);
+	if (chunk_count == 0)
+		return;
+
+	if (chunk_count == 1)
+	{
+		function(data, 0, count, 0);
+		return;
+	}
+
+	Parallel_For* parallel_for = new Parallel_For;
+	parallel_for->function = function;
+	parallel_for->data = data;
+	parallel_for->count = count;
+	parallel_for->chunk_count = chunk_count;
+	parallel_for->chunk_size = get_chunk_size(count, min_chunk_size);
+	parallel_for->next_chunk = 0;
+	parallel_for->pending_chunks = chunk_count;
+
+	s32 helper_count = jobs_get_worker_count();
+	if (helper_count > chunk_count - 1)
+		helper_count = chunk_count - 1;
+	parallel_for->references = helper_count + 1;
+
+	for (s32 i = 0; i < helper_count; ++i)
+		jobs_submit(parallel_for_helper, parallel_for);
+
+	// The calling thread works as well, which also guarantees progress when called from inside a job.
+	parallel_for_run_chunks(parallel_for);
+
+	{
+		std::unique_lock<std::mutex> lock(parallel_for->mutex);
+		while (parallel_for->pending_chunks.load() != 0)
+			parallel_for->done_condition.wait(lock);
+	}
+
+	parallel_for_release(parallel_for);
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef BASIC_ENGINE_JOBS_H
+#define BASIC_ENGINE_JOBS_H
+#include "common.h"
+
+// Worker thread pool used for background work (image decoding, mesh processing, ...).
+// The pool is created lazily with one worker less than the number of hardware threads, unless jobs_init is called first.
+
+typedef void (*Job_Function)(void* data);
+// Processes the range [begin, end). chunk_index is in [0, jobs_get_chunk_count(...)) and can be used to index
+// per-chunk scratch memory, since no two running calls share the same chunk_index.
+typedef void (*Job_Range_Function)(void* data, s32 begin, s32 end, s32 chunk_index);
+
+void jobs_init(s32 worker_count);
+// Waits for all queued jobs to finish and joins the workers.
+void jobs_destroy();
+s32 jobs_get_worker_count();
+// Runs the function on a worker thread. Returns immediately.
+void jobs_submit(Job_Function function, void* data);
+// Number of chunks jobs_parallel_for will split count items in.
+s32 jobs_get_chunk_count(s32 count, s32 min_chunk_size);
+// Splits [0, count) in chunks of at least min_chunk_size items and runs them on the workers and on the calling thread.
+// Returns when all chunks are done. Can be called from inside a job.
+void jobs_parallel_for(s32 count, s32 min_chunk_size, Job_Range_Function function, void* data);
+
+#endif
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <GLFW/glfw3.h>
 #include <stdio.h>
 #include "core.h"
+#include "jobs.h"
 #include "vendor/imgui.h"
 #include "vendor/imgui_impl_glfw.h"
 #include "vendor/imgui_impl_opengl3.h"
@@ -177,6 +178,7 @@ s32 main(s32 argc, s8** argv)
 	}
 
 	core_destroy(&core_ctx);
+	jobs_destroy();
 	imgui_destroy(imgui_ctx);
 	glfwTerminate();
 }
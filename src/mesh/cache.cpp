@@ -0,0 +1,317 @@
+#include "cache.h"
+#include "../util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MESH_CACHE_FILE_MAGIC 0x48534D42	// "BMSH"
+#define MESH_CACHE_FILE_VERSION 3
+// Vertex and index data start at multiples of this, so they can be used in place.
+#define MESH_CACHE_ALIGNMENT 16
+
+#pragma pack(push, 1)
+typedef struct
+{
+	u32 magic;
+	u32 version;
+	u64 key;
+	// Checked against sizeof(Vertex), so files written before a vertex format change are rejected.
+	u32 vertex_size;
+	u32 vertex_count;
+	u32 index_count;
+	u32 lod_count;
+	u32 submesh_count;
+	u32 dependency_count;
+	vec3 bounds_min;
+	vec3 bounds_max;
+	r32 bounding_radius;
+	u64 lods_offset;
+	u64 submeshes_offset;
+	u64 dependencies_offset;
+	u64 vertices_offset;
+	u64 indices_offset;
+} Mesh_Cache_File_Header;
+#pragma pack(pop)
+
+static u64 align_offset(u64 offset)
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(u64)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static void update_bounds(vec3* bounds_min, vec3* bounds_max, r32* bounding_radius, const Vertex* vertices,
+	u32 vertex_count, bool first)
+{
+	for (u32 i = 0; i < vertex_count; ++i)
+	{
+		vec3 p = vertices[i].position;
+		if (first && i == 0)
+			*bounds_min = *bounds_max = p;
+		bounds_min->x = p.x < bounds_min->x ? p.x : bounds_min->x;
+		bounds_min->y = p.y < bounds_min->y ? p.y : bounds_min->y;
+		bounds_min->z = p.z < bounds_min->z ? p.z : bounds_min->z;
+		bounds_max->x = p.x > bounds_max->x ? p.x : bounds_max->x;
+		bounds_max->y = p.y > bounds_max->y ? p.y : bounds_max->y;
+		bounds_max->z = p.z > bounds_max->z ? p.z : bounds_max->z;
+		r32 length = gm_vec3_length(p);
+		if (length > *bounding_radius)
+			*bounding_radius = length;
+	}
+}
+
+static void get_dependency(const s8* path, Mesh_Cache_Dependency* dependency)
+{
+	memset(dependency, 0, sizeof(Mesh_Cache_Dependency));
+	strncpy(dependency->path, path, MESH_CACHE_MAX_PATH_LENGTH - 1);
+	struct stat file_info;
+	if (!stat(path, &file_info))
+	{
+		dependency->size = file_info.st_size;
+		dependency->modification_time = file_info.st_mtime;
+	}
+}
+
+static bool seek(FILE* file, u64 offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, (s64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool write_padded(FILE* file, const void* data, u64 size, u64* offset)
+{
+	static const u8 padding[MESH_CACHE_ALIGNMENT] = { 0 };
+	u64 aligned = align_offset(*offset);
+	if (aligned != *offset && fwrite(padding, aligned - *offset, 1, file) != 1)
+		return false;
+	*offset = aligned + size;
+	return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+bool mesh_cache_save(const s8* path, u64 key, const Vertex* vertices, u32 vertex_count, const u32* indices,
+	u32 index_count, const Mesh_Cache_Lod* lods, u32 lod_count, const Mesh_Cache_Submesh* submeshes,
+	u32 submesh_count, const s8* const* dependency_paths, u32 dependency_count)
+{
+	Mesh_Cache_Lod full_lod = { 0, index_count };
+	if (!lods || lod_count == 0)
+	{
+		lods = &full_lod;
+		lod_count = 1;
+	}
+
+	Mesh_Cache_File_Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_CACHE_FILE_MAGIC;
+	header.version = MESH_CACHE_FILE_VERSION;
+	header.key = key;
+	header.vertex_size = sizeof(Vertex);
+	header.vertex_count = vertex_count;
+	header.index_count = index_count;
+	header.lod_count = lod_count;
+	header.submesh_count = submesh_count;
+	header.dependency_count = dependency_count;
+
+	update_bounds(&header.bounds_min, &header.bounds_max, &header.bounding_radius, vertices, vertex_count, true);
+
+	header.lods_offset = align_offset(sizeof(Mesh_Cache_File_Header));
+	header.submeshes_offset = align_offset(header.lods_offset + (u64)lod_count * sizeof(Mesh_Cache_Lod));
+	header.dependencies_offset = align_offset(header.submeshes_offset +
+		(u64)submesh_count * sizeof(Mesh_Cache_Submesh));
+	header.vertices_offset = align_offset(header.dependencies_offset +
+		(u64)dependency_count * sizeof(Mesh_Cache_Dependency));
+	header.indices_offset = align_offset(header.vertices_offset + (u64)vertex_count * sizeof(Vertex));
+
+	Mesh_Cache_Dependency* dependencies =
+		(Mesh_Cache_Dependency*)malloc((dependency_count + 1) * sizeof(Mesh_Cache_Dependency));
+	for (u32 i = 0; i < dependency_count; ++i)
+		get_dependency(dependency_paths[i], &dependencies[i]);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Error writing mesh cache %s\n", path);
+		free(dependencies);
+		return false;
+	}
+
+	u64 offset = 0;
+	bool success = write_padded(file, &header, sizeof(header), &offset) &&
+		write_padded(file, lods, (u64)lod_count * sizeof(Mesh_Cache_Lod), &offset) &&
+		write_padded(file, submeshes, (u64)submesh_count * sizeof(Mesh_Cache_Submesh), &offset) &&
+		write_padded(file, dependencies, (u64)dependency_count * sizeof(Mesh_Cache_Dependency), &offset) &&
+		write_padded(file, vertices, (u64)vertex_count * sizeof(Vertex), &offset) &&
+		write_padded(file, indices, (u64)index_count * sizeof(u32), &offset);
+	success = fclose(file) == 0 && success;
+	free(dependencies);
+
+	if (!success)
+	{
+		printf("Error writing mesh cache %s\n", path);
+		remove(path);
+	}
+
+	return success;
+}
+
+bool mesh_cache_load(const s8* path, u64 key, Mesh_Cache_Data* data)
+{
+	u64 file_size;
+	const u8* file = util_map_file(path, &file_size);
+	if (!file)
+		return false;
+
+	Mesh_Cache_File_Header header;
+	bool valid = file_size >= sizeof(header);
+	if (valid)
+	{
+		memcpy(&header, file, sizeof(header));
+		valid = header.magic == MESH_CACHE_FILE_MAGIC &&
+			header.version == MESH_CACHE_FILE_VERSION &&
+			header.key == key &&
+			header.vertex_size == sizeof(Vertex) &&
+			header.lod_count > 0 &&
+			header.lods_offset % MESH_CACHE_ALIGNMENT == 0 &&
+			header.submeshes_offset % MESH_CACHE_ALIGNMENT == 0 &&
+			header.dependencies_offset % MESH_CACHE_ALIGNMENT == 0 &&
+			header.vertices_offset % MESH_CACHE_ALIGNMENT == 0 &&
+			header.indices_offset % MESH_CACHE_ALIGNMENT == 0 &&
+			header.lods_offset + (u64)header.lod_count * sizeof(Mesh_Cache_Lod) <= file_size &&
+			header.submeshes_offset + (u64)header.submesh_count * sizeof(Mesh_Cache_Submesh) <= file_size &&
+			header.dependencies_offset + (u64)header.dependency_count * sizeof(Mesh_Cache_Dependency) <= file_size &&
+			header.vertices_offset + (u64)header.vertex_count * sizeof(Vertex) <= file_size &&
+			header.indices_offset + (u64)header.index_count * sizeof(u32) <= file_size;
+	}
+
+	if (valid)
+	{
+		const Mesh_Cache_Lod* lods = (const Mesh_Cache_Lod*)(file + header.lods_offset);
+		valid = lods[0].first_index == 0 && lods[0].index_count == header.index_count;
+		for (u32 i = 1; valid && i < header.lod_count; ++i)
+			valid = (u64)lods[i].first_index + lods[i].index_count <= header.index_count;
+
+		const Mesh_Cache_Submesh* submeshes = (const Mesh_Cache_Submesh*)(file + header.submeshes_offset);
+		for (u32 i = 0; valid && i < header.submesh_count; ++i)
+			valid = (u64)submeshes[i].first_index + submeshes[i].index_count <= header.index_count &&
+				memchr(submeshes[i].diffuse_map_path, 0, MESH_CACHE_MAX_PATH_LENGTH);
+
+		const Mesh_Cache_Dependency* dependencies = (const Mesh_Cache_Dependency*)(file + header.dependencies_offset);
+		for (u32 i = 0; valid && i < header.dependency_count; ++i)
+		{
+			Mesh_Cache_Dependency current;
+			valid = memchr(dependencies[i].path, 0, MESH_CACHE_MAX_PATH_LENGTH) != 0;
+			if (valid)
+				get_dependency(dependencies[i].path, &current);
+			valid = valid && current.size == dependencies[i].size &&
+				current.modification_time == dependencies[i].modification_time;
+		}
+	}
+
+	if (!valid)
+	{
+		printf("Discarding stale mesh cache %s\n", path);
+		util_unmap_file(file, file_size);
+		remove(path);
+		return false;
+	}
+
+	data->file = file;
+	data->file_size = file_size;
+	data->vertices = (const Vertex*)(file + header.vertices_offset);
+	data->vertex_count = header.vertex_count;
+	data->indices = (const u32*)(file + header.indices_offset);
+	data->index_count = header.index_count;
+	data->lods = (const Mesh_Cache_Lod*)(file + header.lods_offset);
+	data->lod_count = header.lod_count;
+	data->submeshes = (const Mesh_Cache_Submesh*)(file + header.submeshes_offset);
+	data->submesh_count = header.submesh_count;
+	data->bounds_min = header.bounds_min;
+	data->bounds_max = header.bounds_max;
+	data->bounding_radius = header.bounding_radius;
+	return true;
+}
+
+void mesh_cache_unload(Mesh_Cache_Data* data)
+{
+	util_unmap_file(data->file, data->file_size);
+	data->file = 0;
+}
+
+// The writer puts the indices before the vertices, since only the index count is known when the file is opened.
+
+bool mesh_cache_writer_open(Mesh_Cache_Writer* writer, const s8* path, u64 key, u32 index_count)
+{
+	memset(writer, 0, sizeof(Mesh_Cache_Writer));
+	writer->file = fopen(path, "wb");
+	if (!writer->file)
+	{
+		printf("Error writing mesh cache %s\n", path);
+		return false;
+	}
+
+	writer->key = key;
+	writer->index_count = index_count;
+	u64 lods_offset = align_offset(sizeof(Mesh_Cache_File_Header));
+	writer->indices_offset = align_offset(lods_offset + sizeof(Mesh_Cache_Lod));
+	writer->vertices_offset = align_offset(writer->indices_offset + (u64)index_count * sizeof(u32));
+	return true;
+}
+
+bool mesh_cache_writer_append(Mesh_Cache_Writer* writer, const Vertex* vertices, u32 vertex_count, const u32* indices,
+	u32 index_count)
+{
+	if (writer->failed || writer->written_index_count + (u64)index_count > writer->index_count)
+	{
+		writer->failed = true;
+		return false;
+	}
+
+	update_bounds(&writer->bounds_min, &writer->bounds_max, &writer->bounding_radius, vertices, vertex_count,
+		writer->written_vertex_count == 0);
+
+	writer->failed = !seek(writer->file, writer->indices_offset + (u64)writer->written_index_count * sizeof(u32)) ||
+		(index_count > 0 && fwrite(indices, index_count * sizeof(u32), 1, writer->file) != 1) ||
+		!seek(writer->file, writer->vertices_offset + (u64)writer->written_vertex_count * sizeof(Vertex)) ||
+		(vertex_count > 0 && fwrite(vertices, (u64)vertex_count * sizeof(Vertex), 1, writer->file) != 1);
+
+	writer->written_index_count += index_count;
+	writer->written_vertex_count += vertex_count;
+	return !writer->failed;
+}
+
+bool mesh_cache_writer_close(Mesh_Cache_Writer* writer, const s8* path)
+{
+	Mesh_Cache_File_Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_CACHE_FILE_MAGIC;
+	header.version = MESH_CACHE_FILE_VERSION;
+	header.key = writer->key;
+	header.vertex_size = sizeof(Vertex);
+	header.vertex_count = writer->written_vertex_count;
+	header.index_count = writer->index_count;
+	header.lod_count = 1;
+	header.bounds_min = writer->bounds_min;
+	header.bounds_max = writer->bounds_max;
+	header.bounding_radius = writer->bounding_radius;
+	header.lods_offset = align_offset(sizeof(Mesh_Cache_File_Header));
+	header.vertices_offset = writer->vertices_offset;
+	header.indices_offset = writer->indices_offset;
+	Mesh_Cache_Lod lod = { 0, writer->index_count };
+
+	bool success = !writer->failed && writer->written_index_count == writer->index_count &&
+		seek(writer->file, 0) &&
+		fwrite(&header, sizeof(header), 1, writer->file) == 1 &&
+		seek(writer->file, header.lods_offset) &&
+		fwrite(&lod, sizeof(lod), 1, writer->file) == 1;
+	success = fclose(writer->file) == 0 && success;
+	writer->file = 0;
+
+	if (!success)
+	{
+		printf("Error writing mesh cache %s\n", path);
+		remove(path);
+	}
+
+	return success;
+}
\ No newline at end of file
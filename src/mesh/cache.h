@@ -0,0 +1,96 @@
+#ifndef BASIC_ENGINE_MESH_CACHE_H
+#define BASIC_ENGINE_MESH_CACHE_H
+
+#include "../graphics.h"
+#include <stdio.h>
+
+// Imported meshes are stored in .bmesh files, next to their source, so later loads skip parsing and processing.
+// The vertex and index data are stored exactly as uploaded to the GPU, so a loaded file is used in place.
+#define MESH_CACHE_FILE_EXTENSION ".bmesh"
+// Streamed imports give different data (see obj_stream), so they have their own file and do not evict the other.
+#define MESH_CACHE_STREAMED_FILE_EXTENSION ".stream.bmesh"
+
+// Range of the index data drawing one level of detail. All levels share the vertex data; level 0 is the full mesh,
+// covering every index.
+typedef struct
+{
+	u32 first_index;
+	u32 index_count;
+} Mesh_Cache_Lod;
+
+#define MESH_CACHE_MAX_PATH_LENGTH 256
+
+// Range of the index data drawn with one material (see Submesh in graphics.h). Submeshes partition the level 0 range.
+typedef struct
+{
+	u32 first_index;
+	u32 index_count;
+	vec4 diffuse_color;
+	// Empty if the material has no diffuse map.
+	s8 diffuse_map_path[MESH_CACHE_MAX_PATH_LENGTH];
+} Mesh_Cache_Submesh;
+
+// Other files the data was imported from, such as material libraries, are checked on load: their size and
+// modification time are stored in the file, which is rejected if any of them changed, appeared or disappeared.
+typedef struct
+{
+	s8 path[MESH_CACHE_MAX_PATH_LENGTH];
+	// Both 0 if the file did not exist.
+	u64 size;
+	u64 modification_time;
+} Mesh_Cache_Dependency;
+
+typedef struct
+{
+	// Everything points into the mapped file, which stays mapped until mesh_cache_unload.
+	const u8* file;
+	u64 file_size;
+	const Vertex* vertices;
+	u32 vertex_count;
+	const u32* indices;
+	u32 index_count;
+	const Mesh_Cache_Lod* lods;
+	u32 lod_count;
+	// None for meshes with a single material.
+	const Mesh_Cache_Submesh* submeshes;
+	u32 submesh_count;
+	vec3 bounds_min;
+	vec3 bounds_max;
+	// Radius of the bounding sphere centered at the model space origin.
+	r32 bounding_radius;
+} Mesh_Cache_Data;
+
+// The key is stored in the file and checked on load; files with a different key or version are rejected.
+// lods may be 0, in which case a single level covering all indices is written.
+bool mesh_cache_save(const s8* path, u64 key, const Vertex* vertices, u32 vertex_count, const u32* indices,
+	u32 index_count, const Mesh_Cache_Lod* lods, u32 lod_count, const Mesh_Cache_Submesh* submeshes,
+	u32 submesh_count, const s8* const* dependency_paths, u32 dependency_count);
+
+// Writes a single level, single material cache file incrementally, for meshes that do not fit in memory at once.
+// The index count must be known up front; vertices are appended in blocks together with their indices.
+typedef struct
+{
+	FILE* file;
+	u64 key;
+	u32 index_count;
+	u32 written_vertex_count;
+	u32 written_index_count;
+	u64 vertices_offset;
+	u64 indices_offset;
+	vec3 bounds_min;
+	vec3 bounds_max;
+	r32 bounding_radius;
+	bool failed;
+} Mesh_Cache_Writer;
+
+bool mesh_cache_writer_open(Mesh_Cache_Writer* writer, const s8* path, u64 key, u32 index_count);
+// Indices refer to all vertices appended so far, including the ones in this call.
+bool mesh_cache_writer_append(Mesh_Cache_Writer* writer, const Vertex* vertices, u32 vertex_count, const u32* indices,
+	u32 index_count);
+// Writes the header. On failure, or if fewer indices than announced were appended, the file is removed.
+bool mesh_cache_writer_close(Mesh_Cache_Writer* writer, const s8* path);
+// Maps the file. Returns false if it does not exist, is not valid for this key or a dependency changed.
+bool mesh_cache_load(const s8* path, u64 key, Mesh_Cache_Data* data);
+void mesh_cache_unload(Mesh_Cache_Data* data);
+
+#endif
\ No newline at end of file
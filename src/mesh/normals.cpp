@@ -0,0 +1,237 @@
+#include "normals.h"
+#include "weld.h"
+#include "../jobs.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Triangles are split in one slice per thread, since every slice needs a buffer as big as the position count.
+#define NORMALS_MIN_SLICE_TRIANGLES 4096
+#define NORMALS_MIN_CHUNK_SIZE 4096
+
+typedef struct
+{
+	Vertex* corners;
+	u32 triangle_count;
+	const u32* position_ids;
+	u32 position_count;
+	u32 slice_count;
+	bool smooth_all;
+	r32 crease_cosine;
+	Mesh_Normals_Weighting weighting;
+
+	// Unit normal of every triangle and weight of every corner.
+	vec3* face_normals;
+	r32* weights;
+
+	// Without creases: weighted normal sums per slice and position. The reduction leaves the result in slice 0.
+	vec3* sums;
+
+	// With creases: corners grouped by position. position_corners[offsets[p] .. offsets[p + 1]) are the corners of
+	// position p. Each slice counts its own corners first and then writes to a range reserved for it.
+	u32* slice_counts;
+	u32* offsets;
+	u32* position_corners;
+} Normals_Context;
+
+Mesh_Normals_Options mesh_normals_get_default_options()
+{
+	Mesh_Normals_Options options;
+	options.weighting = MESH_NORMALS_WEIGHT_ANGLE;
+	options.crease_angle = 60.0f;
+	return options;
+}
+
+static void get_slice_range(const Normals_Context* ctx, u32 slice, u32* begin, u32* end)
+{
+	*begin = (u32)((u64)ctx->triangle_count * slice / ctx->slice_count);
+	*end = (u32)((u64)ctx->triangle_count * (slice + 1) / ctx->slice_count);
+}
+
+static r32 get_corner_angle(vec3 corner, vec3 a, vec3 b)
+{
+	vec3 first_edge = gm_vec3_subtract(a, corner);
+	vec3 second_edge = gm_vec3_subtract(b, corner);
+	r32 lengths = gm_vec3_length(first_edge) * gm_vec3_length(second_edge);
+	if (lengths == 0.0f)
+		return 0.0f;
+
+	r32 cosine = gm_vec3_dot(first_edge, second_edge) / lengths;
+	cosine = cosine < -1.0f ? -1.0f : (cosine > 1.0f ? 1.0f : cosine);
+	return acosf(cosine);
+}
+
+static void face_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Normals_Context* ctx = (Normals_Context*)data;
+
+	for (u32 slice = (u32)begin; slice < (u32)end; ++slice)
+	{
+		u32 first_triangle, last_triangle;
+		get_slice_range(ctx, slice, &first_triangle, &last_triangle);
+		vec3* sums = ctx->smooth_all ? ctx->sums + (u64)slice * ctx->position_count : 0;
+		u32* counts = ctx->smooth_all ? 0 : ctx->slice_counts + (u64)slice * ctx->position_count;
+
+		for (u32 t = first_triangle; t < last_triangle; ++t)
+		{
+			const Vertex* v = ctx->corners + t * 3;
+			vec3 normal = gm_vec3_cross(gm_vec3_subtract(v[1].position, v[0].position),
+				gm_vec3_subtract(v[2].position, v[0].position));
+			r32 length = gm_vec3_length(normal);
+			if (length > 0.0f)
+				normal = gm_vec3_scalar_product(1.0f / length, normal);
+			ctx->face_normals[t] = normal;
+
+			for (u32 i = 0; i < 3; ++i)
+			{
+				u32 corner = t * 3 + i;
+				r32 weight = length;
+				if (ctx->weighting == MESH_NORMALS_WEIGHT_ANGLE)
+					weight = get_corner_angle(v[i].position, v[(i + 1) % 3].position, v[(i + 2) % 3].position);
+				ctx->weights[corner] = weight;
+
+				u32 position = ctx->position_ids[corner];
+				if (sums)
+					sums[position] = gm_vec3_add(sums[position], gm_vec3_scalar_product(weight, normal));
+				else
+					++counts[position];
+			}
+		}
+	}
+}
+
+static void reduce_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Normals_Context* ctx = (Normals_Context*)data;
+
+	for (u32 p = (u32)begin; p < (u32)end; ++p)
+	{
+		vec3 sum = ctx->sums[p];
+		for (u32 slice = 1; slice < ctx->slice_count; ++slice)
+			sum = gm_vec3_add(sum, ctx->sums[(u64)slice * ctx->position_count + p]);
+
+		r32 length = gm_vec3_length(sum);
+		ctx->sums[p] = length > 0.0f ? gm_vec3_scalar_product(1.0f / length, sum) : sum;
+	}
+}
+
+static void apply_smooth_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Normals_Context* ctx = (Normals_Context*)data;
+
+	for (u32 corner = (u32)begin; corner < (u32)end; ++corner)
+	{
+		vec3 normal = ctx->sums[ctx->position_ids[corner]];
+		// Faces cancelling each other out (or degenerate ones) fall back to the face normal.
+		ctx->corners[corner].normal = gm_vec3_length(normal) > 0.0f ? normal : ctx->face_normals[corner / 3];
+	}
+}
+
+static void scatter_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Normals_Context* ctx = (Normals_Context*)data;
+
+	for (u32 slice = (u32)begin; slice < (u32)end; ++slice)
+	{
+		u32 first_triangle, last_triangle;
+		get_slice_range(ctx, slice, &first_triangle, &last_triangle);
+		// After the prefix sum, these are the next free positions of this slice's ranges.
+		u32* next = ctx->slice_counts + (u64)slice * ctx->position_count;
+
+		for (u32 corner = first_triangle * 3; corner < last_triangle * 3; ++corner)
+			ctx->position_corners[next[ctx->position_ids[corner]]++] = corner;
+	}
+}
+
+static void apply_crease_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Normals_Context* ctx = (Normals_Context*)data;
+
+	for (u32 corner = (u32)begin; corner < (u32)end; ++corner)
+	{
+		vec3 face_normal = ctx->face_normals[corner / 3];
+		u32 position = ctx->position_ids[corner];
+		vec3 sum = (vec3){0.0f, 0.0f, 0.0f};
+
+		for (u32 i = ctx->offsets[position]; i < ctx->offsets[position + 1]; ++i)
+		{
+			u32 other = ctx->position_corners[i];
+			vec3 other_normal = ctx->face_normals[other / 3];
+			if (gm_vec3_dot(face_normal, other_normal) >= ctx->crease_cosine)
+				sum = gm_vec3_add(sum, gm_vec3_scalar_product(ctx->weights[other], other_normal));
+		}
+
+		r32 length = gm_vec3_length(sum);
+		ctx->corners[corner].normal = length > 0.0f ? gm_vec3_scalar_product(1.0f / length, sum) : face_normal;
+	}
+}
+
+void mesh_generate_normals(Vertex* corners, u32 corner_count, const Mesh_Normals_Options* options)
+{
+	Normals_Context ctx;
+	ctx.corners = corners;
+	ctx.triangle_count = corner_count / 3;
+	if (ctx.triangle_count == 0)
+		return;
+
+	u32* position_ids = (u32*)malloc(corner_count * sizeof(u32));
+	ctx.position_ids = position_ids;
+	ctx.position_count = mesh_weld_positions(corners, corner_count, position_ids);
+	ctx.smooth_all = options->crease_angle >= 180.0f;
+	ctx.crease_cosine = cosf(gm_radians(options->crease_angle));
+	ctx.weighting = options->weighting;
+	ctx.face_normals = (vec3*)malloc(ctx.triangle_count * sizeof(vec3));
+	ctx.weights = (r32*)malloc(corner_count * sizeof(r32));
+
+	ctx.slice_count = jobs_get_worker_count() + 1;
+	u32 max_slice_count = (ctx.triangle_count + NORMALS_MIN_SLICE_TRIANGLES - 1) / NORMALS_MIN_SLICE_TRIANGLES;
+	if (ctx.slice_count > max_slice_count)
+		ctx.slice_count = max_slice_count;
+
+	u64 slice_buffer_count = (u64)ctx.slice_count * ctx.position_count;
+	ctx.sums = 0;
+	ctx.slice_counts = 0;
+	ctx.offsets = 0;
+	ctx.position_corners = 0;
+
+	if (ctx.smooth_all)
+	{
+		ctx.sums = (vec3*)calloc(slice_buffer_count, sizeof(vec3));
+		jobs_parallel_for(ctx.slice_count, 1, face_job, &ctx);
+		jobs_parallel_for(ctx.position_count, NORMALS_MIN_CHUNK_SIZE, reduce_job, &ctx);
+		jobs_parallel_for(corner_count, NORMALS_MIN_CHUNK_SIZE, apply_smooth_job, &ctx);
+	}
+	else
+	{
+		ctx.slice_counts = (u32*)calloc(slice_buffer_count, sizeof(u32));
+		jobs_parallel_for(ctx.slice_count, 1, face_job, &ctx);
+
+		// Prefix sum over (position, slice), so the corners of a position keep their original order.
+		ctx.offsets = (u32*)malloc((ctx.position_count + 1) * sizeof(u32));
+		u32 offset = 0;
+		for (u32 p = 0; p < ctx.position_count; ++p)
+		{
+			ctx.offsets[p] = offset;
+			for (u32 slice = 0; slice < ctx.slice_count; ++slice)
+			{
+				u32* count = &ctx.slice_counts[(u64)slice * ctx.position_count + p];
+				u32 slice_count = *count;
+				*count = offset;
+				offset += slice_count;
+			}
+		}
+		ctx.offsets[ctx.position_count] = offset;
+
+		ctx.position_corners = (u32*)malloc(corner_count * sizeof(u32));
+		jobs_parallel_for(ctx.slice_count, 1, scatter_job, &ctx);
+		jobs_parallel_for(corner_count, NORMALS_MIN_CHUNK_SIZE, apply_crease_job, &ctx);
+	}
+
+	free(position_ids);
+	free(ctx.face_normals);
+	free(ctx.weights);
+	free(ctx.sums);
+	free(ctx.slice_counts);
+	free(ctx.offsets);
+	free(ctx.position_corners);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef BASIC_ENGINE_MESH_NORMALS_H
+#define BASIC_ENGINE_MESH_NORMALS_H
+
+#include "../graphics.h"
+
+typedef enum {
+	MESH_NORMALS_WEIGHT_AREA,	// Big faces count more. Cheap, but skews normals towards long thin triangles.
+	MESH_NORMALS_WEIGHT_ANGLE	// Each face counts by its angle at the vertex, so the result does not depend on tessellation.
+} Mesh_Normals_Weighting;
+
+typedef struct
+{
+	Mesh_Normals_Weighting weighting;
+	// In degrees. Faces meeting at a sharper angle than this keep separate normals. 180 smooths everything.
+	r32 crease_angle;
+} Mesh_Normals_Options;
+
+Mesh_Normals_Options mesh_normals_get_default_options();
+// Generates smooth normals for triangle corners (3 per triangle, before welding, see mesh/weld.h). Corners are
+// matched by position, so faces that share a position but not a vertex in the source file are still smoothed.
+// Triangles are processed on the job workers; each thread accumulates into memory of its own, which is then reduced.
+void mesh_generate_normals(Vertex* corners, u32 corner_count, const Mesh_Normals_Options* options);
+
+#endif
\ No newline at end of file
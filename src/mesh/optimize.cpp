@@ -0,0 +1,366 @@
+#include "optimize.h"
+#include <light_array.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define OPTIMIZE_INVALID 0xFFFFFFFF
+
+typedef struct
+{
+	// Triangles using each vertex: triangles[offsets[v]] to triangles[offsets[v] + counts[v]].
+	u32* offsets;
+	u32* counts;
+	u32* triangles;
+} Vertex_Adjacency;
+
+typedef struct
+{
+	u32 first_triangle;
+	u32 triangle_count;
+	r32 sort_key;
+} Overdraw_Cluster;
+
+static Vertex_Adjacency build_adjacency(const u32* indices, u32 index_count, u32 vertex_count)
+{
+	Vertex_Adjacency adjacency;
+	adjacency.offsets = (u32*)malloc(vertex_count * sizeof(u32));
+	adjacency.counts = (u32*)calloc(vertex_count, sizeof(u32));
+	adjacency.triangles = (u32*)malloc(index_count * sizeof(u32));
+
+	for (u32 i = 0; i < index_count; ++i)
+		++adjacency.counts[indices[i]];
+
+	u32 offset = 0;
+	for (u32 v = 0; v < vertex_count; ++v)
+	{
+		adjacency.offsets[v] = offset;
+		offset += adjacency.counts[v];
+		adjacency.counts[v] = 0;
+	}
+
+	for (u32 i = 0; i < index_count; ++i)
+	{
+		u32 v = indices[i];
+		adjacency.triangles[adjacency.offsets[v] + adjacency.counts[v]++] = i / 3;
+	}
+
+	return adjacency;
+}
+
+static void free_adjacency(Vertex_Adjacency* adjacency)
+{
+	free(adjacency->offsets);
+	free(adjacency->counts);
+	free(adjacency->triangles);
+}
+
+// FIFO cache simulation. A vertex is in the cache if it entered less than cache_size misses ago.
+static u32 count_cache_misses(const u32* indices, u32 index_count, u32* timestamps, u32* time, u32 cache_size)
+{
+	u32 misses = 0;
+	for (u32 i = 0; i < index_count; ++i)
+	{
+		u32 v = indices[i];
+		if (*time - timestamps[v] > cache_size)
+		{
+			timestamps[v] = (*time)++;
+			++misses;
+		}
+	}
+	return misses;
+}
+
+Mesh_Cache_Statistics mesh_optimize_analyze_vertex_cache(const u32* indices, u32 index_count, u32 vertex_count,
+	u32 cache_size)
+{
+	Mesh_Cache_Statistics statistics = { 0.0f, 0.0f };
+	if (index_count == 0)
+		return statistics;
+
+	u32* timestamps = (u32*)calloc(vertex_count, sizeof(u32));
+	bool* used = (bool*)calloc(vertex_count, sizeof(bool));
+	u32 time = cache_size + 1;
+	u32 misses = count_cache_misses(indices, index_count, timestamps, &time, cache_size);
+
+	u32 used_count = 0;
+	for (u32 i = 0; i < index_count; ++i)
+	{
+		used_count += used[indices[i]] ? 0 : 1;
+		used[indices[i]] = true;
+	}
+
+	statistics.acmr = (r32)misses / (index_count / 3);
+	statistics.atvr = (r32)misses / used_count;
+
+	free(timestamps);
+	free(used);
+	return statistics;
+}
+
+// Vertex cache
+
+static u32 skip_dead_end(u32** dead_end_stack, const u32* live_triangles, u32* cursor, u32 vertex_count)
+{
+	// Recently used vertices first, they are likely still in the cache.
+	while (array_length(*dead_end_stack) > 0)
+	{
+		u32 v = (*dead_end_stack)[--array_length(*dead_end_stack)];
+		if (live_triangles[v] > 0)
+			return v;
+	}
+
+	// Otherwise the next vertex in input order that still has triangles.
+	for (; *cursor < vertex_count; ++*cursor)
+		if (live_triangles[*cursor] > 0)
+			return *cursor;
+
+	return OPTIMIZE_INVALID;
+}
+
+static u32 get_next_vertex(const u32* candidates, const u32* live_triangles, const u32* timestamps, u32 time,
+	u32 cache_size, u32** dead_end_stack, u32* cursor, u32 vertex_count)
+{
+	u32 best = OPTIMIZE_INVALID;
+	s32 best_priority = -1;
+
+	for (u32 i = 0; i < array_length(candidates); ++i)
+	{
+		u32 v = candidates[i];
+		if (live_triangles[v] == 0)
+			continue;
+
+		// Prefer the oldest vertex that will still be in the cache after fanning around it.
+		s32 priority = 0;
+		if (time - timestamps[v] + 2 * live_triangles[v] <= cache_size)
+			priority = time - timestamps[v];
+		if (priority > best_priority)
+		{
+			best_priority = priority;
+			best = v;
+		}
+	}
+
+	if (best == OPTIMIZE_INVALID)
+		best = skip_dead_end(dead_end_stack, live_triangles, cursor, vertex_count);
+	return best;
+}
+
+void mesh_optimize_vertex_cache(u32* indices, u32 index_count, u32 vertex_count, u32 cache_size)
+{
+	u32 triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	Vertex_Adjacency adjacency = build_adjacency(indices, index_count, vertex_count);
+	u32* live_triangles = (u32*)malloc(vertex_count * sizeof(u32));
+	memcpy(live_triangles, adjacency.counts, vertex_count * sizeof(u32));
+	u32* timestamps = (u32*)calloc(vertex_count, sizeof(u32));
+	bool* emitted = (bool*)calloc(triangle_count, sizeof(bool));
+	u32* output = (u32*)malloc(index_count * sizeof(u32));
+	u32* dead_end_stack = array_new(u32);
+	u32* candidates = array_new(u32);
+
+	u32 time = cache_size + 1;
+	u32 cursor = 0;
+	u32 output_count = 0;
+	u32 fanning_vertex = skip_dead_end(&dead_end_stack, live_triangles, &cursor, vertex_count);
+
+	while (fanning_vertex != OPTIMIZE_INVALID)
+	{
+		array_clear(candidates);
+
+		const u32* triangles = adjacency.triangles + adjacency.offsets[fanning_vertex];
+		for (u32 i = 0; i < adjacency.counts[fanning_vertex]; ++i)
+		{
+			u32 t = triangles[i];
+			if (emitted[t])
+				continue;
+
+			for (u32 c = 0; c < 3; ++c)
+			{
+				u32 v = indices[t * 3 + c];
+				output[output_count++] = v;
+				array_push(dead_end_stack, v);
+				array_push(candidates, v);
+				--live_triangles[v];
+				if (time - timestamps[v] > cache_size)
+					timestamps[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		fanning_vertex = get_next_vertex(candidates, live_triangles, timestamps, time, cache_size, &dead_end_stack,
+			&cursor, vertex_count);
+	}
+
+	memcpy(indices, output, index_count * sizeof(u32));
+
+	free_adjacency(&adjacency);
+	free(live_triangles);
+	free(timestamps);
+	free(emitted);
+	free(output);
+	array_free(dead_end_stack);
+	array_free(candidates);
+}
+
+// Overdraw
+
+static bool compare_clusters(const Overdraw_Cluster& a, const Overdraw_Cluster& b)
+{
+	return a.sort_key > b.sort_key;
+}
+
+void mesh_optimize_overdraw(u32* indices, u32 index_count, const Vertex* vertices, u32 vertex_count, u32 cache_size,
+	r32 threshold)
+{
+	u32 triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	u32* timestamps = (u32*)calloc(vertex_count, sizeof(u32));
+	u32 time = cache_size + 1;
+
+	// Hard boundaries: triangles where all three vertices miss the cache, i.e. where the vertex cache order restarted.
+	u32* hard_boundaries = array_new(u32);
+	for (u32 t = 0; t < triangle_count; ++t)
+		if (count_cache_misses(indices + t * 3, 3, timestamps, &time, cache_size) == 3 || t == 0)
+			array_push(hard_boundaries, t);
+	array_push(hard_boundaries, triangle_count);
+
+	// Soft boundaries: hard clusters are split wherever the cache efficiency so far is close enough to the whole
+	// cluster's. Every split flushes the cache, so it costs a few extra misses.
+	Overdraw_Cluster* clusters = array_new(Overdraw_Cluster);
+	for (u32 h = 0; h + 1 < array_length(hard_boundaries); ++h)
+	{
+		u32 begin = hard_boundaries[h], end = hard_boundaries[h + 1];
+
+		time += cache_size + 1;
+		r32 cluster_acmr = (r32)count_cache_misses(indices + begin * 3, (end - begin) * 3, timestamps, &time, cache_size) /
+			(end - begin);
+
+		time += cache_size + 1;
+		u32 cluster_begin = begin, misses = 0;
+		for (u32 t = begin; t < end; ++t)
+		{
+			misses += count_cache_misses(indices + t * 3, 3, timestamps, &time, cache_size);
+			if (t + 1 == end || (r32)misses / (t + 1 - cluster_begin) <= cluster_acmr * threshold)
+			{
+				Overdraw_Cluster cluster = { cluster_begin, t + 1 - cluster_begin, 0.0f };
+				array_push(clusters, cluster);
+				cluster_begin = t + 1;
+				misses = 0;
+				time += cache_size + 1;
+			}
+		}
+	}
+
+	// Clusters facing away from the mesh center are drawn first: they are more likely to occlude the others.
+	vec3 mesh_centroid = (vec3){0.0f, 0.0f, 0.0f};
+	for (u32 i = 0; i < index_count; ++i)
+		mesh_centroid = gm_vec3_add(mesh_centroid, vertices[indices[i]].position);
+	mesh_centroid = gm_vec3_scalar_product(1.0f / index_count, mesh_centroid);
+
+	for (u32 c = 0; c < array_length(clusters); ++c)
+	{
+		Overdraw_Cluster* cluster = &clusters[c];
+		vec3 centroid = (vec3){0.0f, 0.0f, 0.0f}, normal = (vec3){0.0f, 0.0f, 0.0f};
+		r32 area_sum = 0.0f;
+		for (u32 t = cluster->first_triangle; t < cluster->first_triangle + cluster->triangle_count; ++t)
+		{
+			vec3 a = vertices[indices[t * 3 + 0]].position;
+			vec3 b = vertices[indices[t * 3 + 1]].position;
+			vec3 c = vertices[indices[t * 3 + 2]].position;
+			// Length is twice the area, so both sums below are area weighted.
+			vec3 triangle_normal = gm_vec3_cross(gm_vec3_subtract(b, a), gm_vec3_subtract(c, a));
+			r32 area = gm_vec3_length(triangle_normal);
+			vec3 triangle_centroid = gm_vec3_scalar_product(1.0f / 3.0f, gm_vec3_add(gm_vec3_add(a, b), c));
+			centroid = gm_vec3_add(centroid, gm_vec3_scalar_product(area, triangle_centroid));
+			normal = gm_vec3_add(normal, triangle_normal);
+			area_sum += area;
+		}
+
+		r32 normal_length = gm_vec3_length(normal);
+		if (area_sum > 0.0f && normal_length > 0.0f)
+		{
+			centroid = gm_vec3_scalar_product(1.0f / area_sum, centroid);
+			normal = gm_vec3_scalar_product(1.0f / normal_length, normal);
+			cluster->sort_key = gm_vec3_dot(gm_vec3_subtract(centroid, mesh_centroid), normal);
+		}
+	}
+
+	std::stable_sort(clusters, clusters + array_length(clusters), compare_clusters);
+
+	u32* output = (u32*)malloc(index_count * sizeof(u32));
+	u32 output_count = 0;
+	for (u32 c = 0; c < array_length(clusters); ++c)
+	{
+		u32 count = clusters[c].triangle_count * 3;
+		memcpy(output + output_count, indices + clusters[c].first_triangle * 3, count * sizeof(u32));
+		output_count += count;
+	}
+	memcpy(indices, output, output_count * sizeof(u32));
+
+	free(output);
+	free(timestamps);
+	array_free(hard_boundaries);
+	array_free(clusters);
+}
+
+// Vertex fetch
+
+u32 mesh_optimize_vertex_fetch(Vertex* vertices, u32 vertex_count, u32* indices, u32 index_count)
+{
+	u32* remap = (u32*)malloc(vertex_count * sizeof(u32));
+	memset(remap, 0xFF, vertex_count * sizeof(u32));
+	Vertex* reordered = (Vertex*)malloc(vertex_count * sizeof(Vertex));
+
+	u32 next_vertex = 0;
+	for (u32 i = 0; i < index_count; ++i)
+	{
+		u32 v = indices[i];
+		if (remap[v] == OPTIMIZE_INVALID)
+		{
+			remap[v] = next_vertex;
+			reordered[next_vertex++] = vertices[v];
+		}
+		indices[i] = remap[v];
+	}
+
+	memcpy(vertices, reordered, next_vertex * sizeof(Vertex));
+
+	free(remap);
+	free(reordered);
+	return next_vertex;
+}
+
+void mesh_optimize(Vertex* vertices, u32* indices, Mesh_Optimize_Report* report)
+{
+	u32 index_count = array_length(indices);
+	mesh_optimize_ranges(vertices, indices, &index_count, 1, report);
+}
+
+void mesh_optimize_ranges(Vertex* vertices, u32* indices, const u32* range_index_counts, u32 range_count,
+	Mesh_Optimize_Report* report)
+{
+	u32 vertex_count = array_length(vertices);
+	u32 index_count = array_length(indices);
+
+	if (report)
+		report->before = mesh_optimize_analyze_vertex_cache(indices, index_count, vertex_count, MESH_OPTIMIZE_CACHE_SIZE);
+
+	u32* range_indices = indices;
+	for (u32 i = 0; i < range_count; ++i)
+	{
+		mesh_optimize_vertex_cache(range_indices, range_index_counts[i], vertex_count, MESH_OPTIMIZE_CACHE_SIZE);
+		mesh_optimize_overdraw(range_indices, range_index_counts[i], vertices, vertex_count, MESH_OPTIMIZE_CACHE_SIZE,
+			MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+		range_indices += range_index_counts[i];
+	}
+	array_length(vertices) = mesh_optimize_vertex_fetch(vertices, vertex_count, indices, index_count);
+
+	if (report)
+		report->after = mesh_optimize_analyze_vertex_cache(indices, index_count, array_length(vertices),
+			MESH_OPTIMIZE_CACHE_SIZE);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef BASIC_ENGINE_MESH_OPTIMIZE_H
+#define BASIC_ENGINE_MESH_OPTIMIZE_H
+
+#include "../graphics.h"
+
+// Import-time triangle and vertex reordering, meant to run once on indexed meshes (see mesh/weld.h).
+// The rendered result is the same, only the order of triangles and vertices changes.
+
+// Size of the simulated FIFO post-transform cache. Real hardware varies, 16 is a reasonable middle ground.
+#define MESH_OPTIMIZE_CACHE_SIZE 16
+// Clusters are split further for overdraw ordering as long as their ACMR stays within this factor of the original.
+#define MESH_OPTIMIZE_OVERDRAW_THRESHOLD 1.05f
+
+typedef struct
+{
+	// Average cache miss ratio: transformed vertices per triangle. 0.5 is the ideal for large regular meshes, 3 the worst.
+	r32 acmr;
+	// Average transform to vertex ratio: transformed vertices per vertex. 1 is the ideal.
+	r32 atvr;
+} Mesh_Cache_Statistics;
+
+typedef struct
+{
+	Mesh_Cache_Statistics before;
+	Mesh_Cache_Statistics after;
+} Mesh_Optimize_Report;
+
+Mesh_Cache_Statistics mesh_optimize_analyze_vertex_cache(const u32* indices, u32 index_count, u32 vertex_count,
+	u32 cache_size);
+// Reorders triangles for the post-transform cache with Tipsify (Sander et al. 2007).
+void mesh_optimize_vertex_cache(u32* indices, u32 index_count, u32 vertex_count, u32 cache_size);
+// Splits the triangle order in clusters that barely affect the cache efficiency and draws the clusters facing
+// outwards first, so hidden triangles are more likely to fail the depth test (Sander et al. 2007).
+void mesh_optimize_overdraw(u32* indices, u32 index_count, const Vertex* vertices, u32 vertex_count, u32 cache_size,
+	r32 threshold);
+// Sorts vertices in the order the indices first use them, so vertex fetch walks memory linearly.
+// Vertices not used by any triangle are removed. Returns the new vertex count.
+u32 mesh_optimize_vertex_fetch(Vertex* vertices, u32 vertex_count, u32* indices, u32 index_count);
+// Runs the three steps above in order. vertices is a light_array, its length is updated.
+void mesh_optimize(Vertex* vertices, u32* indices, Mesh_Optimize_Report* report);
+// Same, but triangles only move within ranges of range_index_counts[i] indices, which follow each other from the
+// first index. Ranges drawn on their own, like the submeshes of a multi-material mesh, stay contiguous.
+void mesh_optimize_ranges(Vertex* vertices, u32* indices, const u32* range_index_counts, u32 range_count,
+	Mesh_Optimize_Report* report);
+
+#endif
\ No newline at end of file
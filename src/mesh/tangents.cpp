@@ -0,0 +1,206 @@
+#include "tangents.h"
+#include "../jobs.h"
+#include "../quaternion.h"
+#include <light_array.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TANGENTS_MIN_CHUNK_SIZE 1024
+// A w of exactly 0 would lose its sign, and with it the handedness, once quantized.
+#define TANGENTS_W_BIAS (1.0f / 32767.0f)
+
+typedef struct
+{
+	const Vertex* vertices;
+	const u32* indices;
+	// Angle weighted tangent of every corner, projected to the plane of the vertex normal.
+	vec3* corner_tangents;
+	// Per triangle: whether texture space keeps its orientation (positive signed uv area).
+	bool* orientations;
+	Vertex* output;
+	vec3* tangent_sums;
+	bool* vertex_orientations;
+} Tangents_Context;
+
+static vec3 project_to_plane(vec3 v, vec3 normal)
+{
+	return gm_vec3_subtract(v, gm_vec3_scalar_product(gm_vec3_dot(normal, v), normal));
+}
+
+static vec3 normalize_or_zero(vec3 v)
+{
+	r32 length = gm_vec3_length(v);
+	return length > 0.0f ? gm_vec3_scalar_product(1.0f / length, v) : v;
+}
+
+static vec3 get_any_perpendicular(vec3 normal)
+{
+	vec3 axis = fabsf(normal.x) < 0.9f ? (vec3){1.0f, 0.0f, 0.0f} : (vec3){0.0f, 1.0f, 0.0f};
+	return normalize_or_zero(project_to_plane(axis, normal));
+}
+
+void mesh_pack_tangent_frame(vec3 tangent, vec3 normal, r32 handedness, s16 tangent_frame[4])
+{
+	normal = normalize_or_zero(normal);
+	if (gm_vec3_length(normal) == 0.0f)
+		normal = (vec3){0.0f, 0.0f, 1.0f};
+	tangent = normalize_or_zero(project_to_plane(tangent, normal));
+	if (gm_vec3_length(tangent) == 0.0f)
+		tangent = get_any_perpendicular(normal);
+	vec3 bitangent = gm_vec3_cross(normal, tangent);
+
+	// Rotation matrix with tangent, bitangent and normal as columns.
+	mat4 m = { 0 };
+	m.data[0][0] = tangent.x; m.data[0][1] = bitangent.x; m.data[0][2] = normal.x;
+	m.data[1][0] = tangent.y; m.data[1][1] = bitangent.y; m.data[1][2] = normal.y;
+	m.data[2][0] = tangent.z; m.data[2][1] = bitangent.z; m.data[2][2] = normal.z;
+	m.data[3][3] = 1.0f;
+	Quaternion q = quaternion_from_matrix(&m);
+	q = quaternion_normalize(&q);
+
+	// q and -q are the same rotation, so the sign of w is free to store the handedness.
+	if (q.w < 0.0f)
+	{
+		q.x = -q.x; q.y = -q.y; q.z = -q.z; q.w = -q.w;
+	}
+	if (q.w < TANGENTS_W_BIAS)
+	{
+		r32 scale = sqrtf(1.0f - TANGENTS_W_BIAS * TANGENTS_W_BIAS) / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z);
+		q.x *= scale; q.y *= scale; q.z *= scale;
+		q.w = TANGENTS_W_BIAS;
+	}
+	if (handedness < 0.0f)
+	{
+		q.x = -q.x; q.y = -q.y; q.z = -q.z; q.w = -q.w;
+	}
+
+	r32 components[4] = { q.x, q.y, q.z, q.w };
+	for (u32 i = 0; i < 4; ++i)
+	{
+		r32 c = components[i] < -1.0f ? -1.0f : (components[i] > 1.0f ? 1.0f : components[i]);
+		tangent_frame[i] = (s16)roundf(c * 32767.0f);
+	}
+}
+
+void mesh_unpack_tangent_frame(const s16 tangent_frame[4], vec3* tangent, vec3* bitangent, vec3* normal)
+{
+	// Same as the decoding in phong_shader.vs.
+	r32 x = tangent_frame[0] / 32767.0f, y = tangent_frame[1] / 32767.0f;
+	r32 z = tangent_frame[2] / 32767.0f, w = tangent_frame[3] / 32767.0f;
+	*tangent = (vec3){1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y)};
+	*normal = (vec3){2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y)};
+	*bitangent = gm_vec3_scalar_product(w < 0.0f ? -1.0f : 1.0f, gm_vec3_cross(*normal, *tangent));
+}
+
+static void triangle_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Tangents_Context* ctx = (Tangents_Context*)data;
+
+	for (u32 t = (u32)begin; t < (u32)end; ++t)
+	{
+		const Vertex* v[3];
+		for (u32 i = 0; i < 3; ++i)
+			v[i] = &ctx->vertices[ctx->indices[t * 3 + i]];
+
+		vec3 first_edge = gm_vec3_subtract(v[1]->position, v[0]->position);
+		vec3 second_edge = gm_vec3_subtract(v[2]->position, v[0]->position);
+		r32 s1 = v[1]->texture_coordinates.x - v[0]->texture_coordinates.x;
+		r32 t1 = v[1]->texture_coordinates.y - v[0]->texture_coordinates.y;
+		r32 s2 = v[2]->texture_coordinates.x - v[0]->texture_coordinates.x;
+		r32 t2 = v[2]->texture_coordinates.y - v[0]->texture_coordinates.y;
+		r32 signed_area = s1 * t2 - s2 * t1;
+
+		// Direction of increasing u on the triangle, flipped where texture space is mirrored so that every corner of
+		// a vertex agrees on it. Triangles without texture space area do not contribute (like in MikkTSpace).
+		vec3 face_tangent = gm_vec3_subtract(gm_vec3_scalar_product(t2, first_edge),
+			gm_vec3_scalar_product(t1, second_edge));
+		if (signed_area < 0.0f)
+			face_tangent = gm_vec3_scalar_product(-1.0f, face_tangent);
+		if (fabsf(signed_area) <= 1e-20f)
+			face_tangent = (vec3){0.0f, 0.0f, 0.0f};
+		ctx->orientations[t] = signed_area >= 0.0f;
+
+		for (u32 i = 0; i < 3; ++i)
+		{
+			vec3 normal = normalize_or_zero(v[i]->normal);
+			vec3 tangent = normalize_or_zero(project_to_plane(face_tangent, normal));
+
+			// Weighted by the angle of the triangle at the corner, measured on the plane of the normal.
+			vec3 a = normalize_or_zero(project_to_plane(gm_vec3_subtract(v[(i + 1) % 3]->position, v[i]->position), normal));
+			vec3 b = normalize_or_zero(project_to_plane(gm_vec3_subtract(v[(i + 2) % 3]->position, v[i]->position), normal));
+			r32 cosine = gm_vec3_dot(a, b);
+			cosine = cosine < -1.0f ? -1.0f : (cosine > 1.0f ? 1.0f : cosine);
+
+			ctx->corner_tangents[t * 3 + i] = gm_vec3_scalar_product(acosf(cosine), tangent);
+		}
+	}
+}
+
+static void pack_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Tangents_Context* ctx = (Tangents_Context*)data;
+
+	for (u32 i = (u32)begin; i < (u32)end; ++i)
+	{
+		Vertex* vertex = &ctx->output[i];
+		mesh_pack_tangent_frame(ctx->tangent_sums[i], vertex->normal, ctx->vertex_orientations[i] ? 1.0f : -1.0f,
+			vertex->tangent_frame);
+	}
+}
+
+void mesh_generate_tangents(Vertex** vertices, u32* indices)
+{
+	u32 vertex_count = array_length(*vertices);
+	u32 index_count = array_length(indices);
+	u32 triangle_count = index_count / 3;
+
+	Tangents_Context ctx;
+	ctx.vertices = *vertices;
+	ctx.indices = indices;
+	ctx.corner_tangents = (vec3*)malloc(index_count * sizeof(vec3));
+	ctx.orientations = (bool*)malloc(triangle_count * sizeof(bool));
+	jobs_parallel_for(triangle_count, TANGENTS_MIN_CHUNK_SIZE, triangle_job, &ctx);
+
+	// Vertices used with both orientations get a copy for the mirrored triangles. Flags: 1 kept, 2 mirrored.
+	u8* used_orientations = (u8*)calloc(vertex_count, sizeof(u8));
+	for (u32 i = 0; i < index_count; ++i)
+		used_orientations[indices[i]] |= ctx.orientations[i / 3] ? 1 : 2;
+
+	u32* mirrored_copies = (u32*)malloc(vertex_count * sizeof(u32));
+	for (u32 v = 0; v < vertex_count; ++v)
+	{
+		mirrored_copies[v] = v;
+		if (used_orientations[v] == 3)
+		{
+			mirrored_copies[v] = array_length(*vertices);
+			array_push(*vertices, (*vertices)[v]);
+		}
+	}
+
+	u32 output_count = array_length(*vertices);
+	ctx.output = *vertices;
+	ctx.tangent_sums = (vec3*)calloc(output_count, sizeof(vec3));
+	ctx.vertex_orientations = (bool*)malloc(output_count * sizeof(bool));
+	memset(ctx.vertex_orientations, 1, output_count * sizeof(bool));
+
+	// A single add per corner, cheap next to the per triangle work above.
+	for (u32 i = 0; i < index_count; ++i)
+	{
+		if (!ctx.orientations[i / 3])
+		{
+			indices[i] = mirrored_copies[indices[i]];
+			ctx.vertex_orientations[indices[i]] = false;
+		}
+		ctx.tangent_sums[indices[i]] = gm_vec3_add(ctx.tangent_sums[indices[i]], ctx.corner_tangents[i]);
+	}
+
+	jobs_parallel_for(output_count, TANGENTS_MIN_CHUNK_SIZE * 4, pack_job, &ctx);
+
+	free(ctx.corner_tangents);
+	free(ctx.orientations);
+	free(used_orientations);
+	free(mirrored_copies);
+	free(ctx.tangent_sums);
+	free(ctx.vertex_orientations);
+}
\ No newline at end of file
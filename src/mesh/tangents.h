@@ -0,0 +1,16 @@
+#ifndef BASIC_ENGINE_MESH_TANGENTS_H
+#define BASIC_ENGINE_MESH_TANGENTS_H
+
+#include "../graphics.h"
+
+// Tangent frames are stored in the vertex as a quaternion (QTangent): 8 bytes instead of 36 for tangent, bitangent
+// and normal. The sign of w is the handedness of the frame, i.e. bitangent = handedness * cross(normal, tangent).
+void mesh_pack_tangent_frame(vec3 tangent, vec3 normal, r32 handedness, s16 tangent_frame[4]);
+void mesh_unpack_tangent_frame(const s16 tangent_frame[4], vec3* tangent, vec3* bitangent, vec3* normal);
+// Generates MikkTSpace-compatible tangents for an indexed mesh with normals and texture coordinates, so normal maps
+// baked by the usual tools decode correctly. Vertices shared by triangles with mirrored texture coordinates are
+// split, since they need two frames of different handedness. vertices is a light_array and may grow.
+// Triangles are processed on the job workers.
+void mesh_generate_tangents(Vertex** vertices, u32* indices);
+
+#endif
\ No newline at end of file
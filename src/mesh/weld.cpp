@@ -0,0 +1,222 @@
+#include "weld.h"
+#include <light_array.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WELD_EMPTY 0xFFFFFFFF
+// Position, normal and texture coordinates. The tangent frame is compared bitwise.
+#define WELD_FLOAT_COUNT (offsetof(Vertex, tangent_frame) / sizeof(r32))
+
+static u32 hash_u32(u32 hash, u32 value)
+{
+	// murmur3 mixing, cheap and good enough for table lookups.
+	value *= 0xcc9e2d51;
+	value = (value << 15) | (value >> 17);
+	value *= 0x1b873593;
+	hash ^= value;
+	hash = (hash << 13) | (hash >> 19);
+	return hash * 5 + 0xe6546b64;
+}
+
+static u32 finish_hash(u32 hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	return hash ^ (hash >> 16);
+}
+
+static const r32* get_floats(const Vertex* vertex)
+{
+	return (const r32*)vertex;
+}
+
+static u32 get_table_size(u32 count)
+{
+	// At most half full, so probe sequences stay short.
+	u32 size = 16;
+	while (size < count * 2)
+		size *= 2;
+	return size;
+}
+
+static u32 hash_floats(const r32* floats, u32 count)
+{
+	u32 hash = 0;
+	for (u32 i = 0; i < count; ++i)
+	{
+		// +0 and -0 compare equal, so they must hash the same.
+		r32 value = floats[i] == 0.0f ? 0.0f : floats[i];
+		u32 bits;
+		memcpy(&bits, &value, sizeof(u32));
+		hash = hash_u32(hash, bits);
+	}
+	return hash;
+}
+
+static u32 hash_vertex(const Vertex* vertex)
+{
+	u32 tangent_frame[2];
+	memcpy(tangent_frame, vertex->tangent_frame, sizeof(tangent_frame));
+	u32 hash = hash_floats(get_floats(vertex), WELD_FLOAT_COUNT);
+	hash = hash_u32(hash_u32(hash, tangent_frame[0]), tangent_frame[1]);
+	return finish_hash(hash);
+}
+
+static bool vertices_equal(const Vertex* a, const Vertex* b)
+{
+	const r32* fa = get_floats(a);
+	const r32* fb = get_floats(b);
+	for (u32 i = 0; i < WELD_FLOAT_COUNT; ++i)
+		if (fa[i] != fb[i])
+			return false;
+	return memcmp(a->tangent_frame, b->tangent_frame, sizeof(a->tangent_frame)) == 0;
+}
+
+static bool vertices_close(const Vertex* a, const Vertex* b, r32 epsilon)
+{
+	const r32* fa = get_floats(a);
+	const r32* fb = get_floats(b);
+	for (u32 i = 0; i < WELD_FLOAT_COUNT; ++i)
+		if (fabsf(fa[i] - fb[i]) > epsilon)
+			return false;
+	return memcmp(a->tangent_frame, b->tangent_frame, sizeof(a->tangent_frame)) == 0;
+}
+
+static void weld_exact(const Vertex* corners, u32 corner_count, Vertex** vertices, u32** indices)
+{
+	u32 table_size = get_table_size(corner_count);
+	u32* table = (u32*)malloc(table_size * sizeof(u32));
+	memset(table, 0xFF, table_size * sizeof(u32));
+
+	for (u32 i = 0; i < corner_count; ++i)
+	{
+		const Vertex* corner = &corners[i];
+		u32 slot = hash_vertex(corner) & (table_size - 1);
+		while (table[slot] != WELD_EMPTY && !vertices_equal(&(*vertices)[table[slot]], corner))
+			slot = (slot + 1) & (table_size - 1);
+
+		if (table[slot] == WELD_EMPTY)
+		{
+			table[slot] = array_length(*vertices);
+			array_push(*vertices, *corner);
+		}
+		array_push(*indices, table[slot]);
+	}
+
+	free(table);
+}
+
+// Positions are bucketed in a grid of cells of size epsilon. Two vertices within epsilon of each other are at most
+// one cell apart along every axis, so only the 27 neighboring cells have to be searched.
+typedef struct
+{
+	s32 x, y, z;
+} Weld_Cell;
+
+static Weld_Cell get_cell(vec3 position, r32 epsilon)
+{
+	Weld_Cell cell;
+	cell.x = (s32)floorf(position.x / epsilon);
+	cell.y = (s32)floorf(position.y / epsilon);
+	cell.z = (s32)floorf(position.z / epsilon);
+	return cell;
+}
+
+static u32 hash_cell(Weld_Cell cell)
+{
+	return finish_hash(hash_u32(hash_u32(hash_u32(0, (u32)cell.x), (u32)cell.y), (u32)cell.z));
+}
+
+static void weld_epsilon(const Vertex* corners, u32 corner_count, r32 epsilon, Vertex** vertices, u32** indices)
+{
+	// Every cell in use has a table entry pointing to the first vertex of a list; next links the vertices of a cell.
+	u32 table_size = get_table_size(corner_count);
+	Weld_Cell* cells = (Weld_Cell*)malloc(table_size * sizeof(Weld_Cell));
+	u32* heads = (u32*)malloc(table_size * sizeof(u32));
+	u32* next = (u32*)malloc(corner_count * sizeof(u32));
+	memset(heads, 0xFF, table_size * sizeof(u32));
+
+	for (u32 i = 0; i < corner_count; ++i)
+	{
+		const Vertex* corner = &corners[i];
+		Weld_Cell center = get_cell(corner->position, epsilon);
+		u32 match = WELD_EMPTY;
+
+		for (s32 dz = -1; dz <= 1 && match == WELD_EMPTY; ++dz)
+		for (s32 dy = -1; dy <= 1 && match == WELD_EMPTY; ++dy)
+		for (s32 dx = -1; dx <= 1 && match == WELD_EMPTY; ++dx)
+		{
+			Weld_Cell cell = { center.x + dx, center.y + dy, center.z + dz };
+			u32 slot = hash_cell(cell) & (table_size - 1);
+			while (heads[slot] != WELD_EMPTY &&
+				(cells[slot].x != cell.x || cells[slot].y != cell.y || cells[slot].z != cell.z))
+				slot = (slot + 1) & (table_size - 1);
+
+			for (u32 v = heads[slot]; v != WELD_EMPTY && match == WELD_EMPTY; v = next[v])
+				if (vertices_close(&(*vertices)[v], corner, epsilon))
+					match = v;
+		}
+
+		if (match == WELD_EMPTY)
+		{
+			match = array_length(*vertices);
+			array_push(*vertices, *corner);
+
+			u32 slot = hash_cell(center) & (table_size - 1);
+			while (heads[slot] != WELD_EMPTY &&
+				(cells[slot].x != center.x || cells[slot].y != center.y || cells[slot].z != center.z))
+				slot = (slot + 1) & (table_size - 1);
+			cells[slot] = center;
+			next[match] = heads[slot];
+			heads[slot] = match;
+		}
+		array_push(*indices, match);
+	}
+
+	free(cells);
+	free(heads);
+	free(next);
+}
+
+u32 mesh_weld_positions(const Vertex* corners, u32 corner_count, u32* position_ids)
+{
+	// Table entries are corner indices; the id of a position is assigned when its first corner is inserted.
+	u32 table_size = get_table_size(corner_count);
+	u32* table = (u32*)malloc(table_size * sizeof(u32));
+	memset(table, 0xFF, table_size * sizeof(u32));
+	u32 position_count = 0;
+
+	for (u32 i = 0; i < corner_count; ++i)
+	{
+		vec3 position = corners[i].position;
+		u32 slot = finish_hash(hash_floats((const r32*)&position, 3)) & (table_size - 1);
+		while (table[slot] != WELD_EMPTY && !gm_vec3_equal(corners[table[slot]].position, position))
+			slot = (slot + 1) & (table_size - 1);
+
+		if (table[slot] == WELD_EMPTY)
+		{
+			table[slot] = i;
+			position_ids[i] = position_count++;
+		}
+		else
+			position_ids[i] = position_ids[table[slot]];
+	}
+
+	free(table);
+	return position_count;
+}
+
+void mesh_weld_vertices(const Vertex* corners, u32 corner_count, r32 epsilon, Vertex** vertices, u32** indices)
+{
+	*vertices = array_new(Vertex);
+	*indices = array_new(u32);
+
+	if (epsilon > 0.0f)
+		weld_epsilon(corners, corner_count, epsilon, vertices, indices);
+	else
+		weld_exact(corners, corner_count, vertices, indices);
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef BASIC_ENGINE_MESH_WELD_H
+#define BASIC_ENGINE_MESH_WELD_H
+
+#include "../graphics.h"
+
+// Builds an indexed mesh out of triangle corners (3 per triangle), merging corners with the same position, normal,
+// texture coordinates and tangent frame into a single vertex.
+// With epsilon 0, only bit-identical attributes are merged (+0 and -0 are considered equal). Otherwise, corners whose
+// attributes all differ by at most epsilon (tangent frames must still be identical) are merged into the first of them.
+// vertices and indices are new arrays (light_array); indices has one entry per corner.
+void mesh_weld_vertices(const Vertex* corners, u32 corner_count, r32 epsilon, Vertex** vertices, u32** indices);
+// Same as above, but only positions are compared (exactly) and only ids are produced: position_ids[i] is the index of
+// the first distinct position equal to corners[i].position. Returns the number of distinct positions.
+u32 mesh_weld_positions(const Vertex* corners, u32 corner_count, u32* position_ids);
+
+#endif
\ No newline at end of file
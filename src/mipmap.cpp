@@ -0,0 +1,531 @@
+#include "mipmap.h"
+#include "jobs.h"
+#include "image_convert.h"
+#include "util.h"
+#include <light_array.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MIPMAP_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#define MIPMAP_FILE_MAGIC 0x50494D42	// "BMIP"
+#define MIPMAP_FILE_VERSION 1
+#define MIPMAP_KAISER_WIDTH 3.0f
+#define MIPMAP_KAISER_ALPHA 4.0f
+#define MIPMAP_MAX_TAPS 12
+#define MIPMAP_SRGB_TABLE_SIZE 4096
+#define MIPMAP_MIN_ROWS_PER_JOB 16
+
+#pragma pack(push, 1)
+typedef struct
+{
+	u32 magic;
+	u32 version;
+	u64 key;
+	s32 width;
+	s32 height;
+	s32 channels;
+	s32 level_count;
+} Mipmap_File_Header;
+#pragma pack(pop)
+
+// Output texel x of a level is computed from the source texels [2x + first_offset, 2x + first_offset + tap_count).
+typedef struct
+{
+	s32 tap_count;
+	s32 first_offset;
+	r32 weights[MIPMAP_MAX_TAPS];
+} Mipmap_Kernel;
+
+typedef struct
+{
+	r32 to_linear[256];
+	u8 from_linear[MIPMAP_SRGB_TABLE_SIZE];
+} Srgb_Tables;
+
+typedef struct
+{
+	const Float_Image_Data* source;
+	Float_Image_Data* temporary;
+	Float_Image_Data* destination;
+	const Mipmap_Kernel* kernel;
+} Downsample_Job;
+
+typedef struct
+{
+	Image_Data* image;
+	Float_Image_Data* float_image;
+	bool gamma_correct;
+} Conversion_Job;
+
+static Srgb_Tables build_srgb_tables()
+{
+	Srgb_Tables tables;
+	for (s32 i = 0; i < 256; ++i)
+	{
+		r32 value = i / 255.0f;
+		tables.to_linear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+	}
+	for (s32 i = 0; i < MIPMAP_SRGB_TABLE_SIZE; ++i)
+	{
+		r32 value = i / (r32)(MIPMAP_SRGB_TABLE_SIZE - 1);
+		r32 srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+		tables.from_linear[i] = (u8)(srgb * 255.0f + 0.5f);
+	}
+	return tables;
+}
+
+static const Srgb_Tables* get_srgb_tables()
+{
+	// Function-local statics are initialized once, even with several threads generating mips at the same time.
+	static const Srgb_Tables tables = build_srgb_tables();
+	return &tables;
+}
+
+static r32 bessel_i0(r32 x)
+{
+	r32 sum = 1.0f, term = 1.0f;
+	for (s32 k = 1; k < 32; ++k)
+	{
+		term *= (x / (2.0f * k)) * (x / (2.0f * k));
+		sum += term;
+		if (term < sum * 1e-8f)
+			break;
+	}
+	return sum;
+}
+
+static Mipmap_Kernel build_kernel(Mipmap_Filter filter)
+{
+	Mipmap_Kernel kernel;
+	if (filter == MIPMAP_FILTER_BOX)
+	{
+		kernel.tap_count = 2;
+		kernel.first_offset = 0;
+		kernel.weights[0] = kernel.weights[1] = 0.5f;
+		return kernel;
+	}
+
+	// The filter spans MIPMAP_KAISER_WIDTH texels of the output level on each side, i.e. twice that in the source.
+	s32 radius = (s32)(2.0f * MIPMAP_KAISER_WIDTH);
+	kernel.tap_count = 2 * radius;
+	kernel.first_offset = 1 - radius;
+	r32 sum = 0.0f;
+	for (s32 j = 0; j < kernel.tap_count; ++j)
+	{
+		// Distance between the source texel center and the output texel center, in output texels.
+		r32 t = (j - radius + 0.5f) / 2.0f;
+		r32 sinc = sinf(PI_F * t) / (PI_F * t);
+		r32 window_position = t / MIPMAP_KAISER_WIDTH;
+		r32 window = bessel_i0(MIPMAP_KAISER_ALPHA * sqrtf(1.0f - window_position * window_position)) /
+			bessel_i0(MIPMAP_KAISER_ALPHA);
+		kernel.weights[j] = sinc * window;
+		sum += kernel.weights[j];
+	}
+	for (s32 j = 0; j < kernel.tap_count; ++j)
+		kernel.weights[j] /= sum;
+
+	return kernel;
+}
+
+static s32 clamp_index(s32 index, s32 size)
+{
+	return index < 0 ? 0 : (index >= size ? size - 1 : index);
+}
+
+static void filter_horizontally(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Downsample_Job* job = (Downsample_Job*)data;
+	const Float_Image_Data* source = job->source;
+	Float_Image_Data* destination = job->temporary;
+	const Mipmap_Kernel* kernel = job->kernel;
+	s32 channels = source->channels;
+
+	for (s32 y = begin; y < end; ++y)
+	{
+		const r32* in = source->data + (size_t)y * source->width * channels;
+		r32* out = destination->data + (size_t)y * destination->width * channels;
+
+		if (source->width == 1)
+		{
+			memcpy(out, in, channels * sizeof(r32));
+			continue;
+		}
+
+		for (s32 x = 0; x < destination->width; ++x, out += channels)
+		{
+			s32 first = 2 * x + kernel->first_offset;
+#ifdef MIPMAP_USE_SSE
+			if (channels == 4)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (s32 j = 0; j < kernel->tap_count; ++j)
+				{
+					__m128 texel = _mm_loadu_ps(in + clamp_index(first + j, source->width) * 4);
+					sum = _mm_add_ps(sum, _mm_mul_ps(texel, _mm_set1_ps(kernel->weights[j])));
+				}
+				_mm_storeu_ps(out, sum);
+				continue;
+			}
+#endif
+			for (s32 c = 0; c < channels; ++c)
+			{
+				r32 sum = 0.0f;
+				for (s32 j = 0; j < kernel->tap_count; ++j)
+					sum += kernel->weights[j] * in[clamp_index(first + j, source->width) * channels + c];
+				out[c] = sum;
+			}
+		}
+	}
+}
+
+static void filter_vertically(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Downsample_Job* job = (Downsample_Job*)data;
+	const Float_Image_Data* source = job->temporary;
+	Float_Image_Data* destination = job->destination;
+	const Mipmap_Kernel* kernel = job->kernel;
+	s32 row_length = destination->width * destination->channels;
+
+	for (s32 y = begin; y < end; ++y)
+	{
+		r32* out = destination->data + (size_t)y * row_length;
+
+		if (source->height == 1)
+		{
+			memcpy(out, source->data, row_length * sizeof(r32));
+			continue;
+		}
+
+		const r32* rows[MIPMAP_MAX_TAPS];
+		s32 first = 2 * y + kernel->first_offset;
+		for (s32 j = 0; j < kernel->tap_count; ++j)
+			rows[j] = source->data + (size_t)clamp_index(first + j, source->height) * row_length;
+
+		s32 i = 0;
+#ifdef MIPMAP_USE_SSE
+		// The rows are contiguous, so four values are filtered at a time regardless of the channel count.
+		for (; i + 4 <= row_length; i += 4)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (s32 j = 0; j < kernel->tap_count; ++j)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[j] + i), _mm_set1_ps(kernel->weights[j])));
+			_mm_storeu_ps(out + i, sum);
+		}
+#endif
+		for (; i < row_length; ++i)
+		{
+			r32 sum = 0.0f;
+			for (s32 j = 0; j < kernel->tap_count; ++j)
+				sum += kernel->weights[j] * rows[j][i];
+			out[i] = sum;
+		}
+	}
+}
+
+// Separable: first every source row is filtered horizontally, then the result is filtered vertically.
+static Float_Image_Data downsample(const Float_Image_Data* source, const Mipmap_Kernel* kernel)
+{
+	Float_Image_Data destination, temporary;
+	destination.width = source->width > 1 ? source->width / 2 : 1;
+	destination.height = source->height > 1 ? source->height / 2 : 1;
+	destination.channels = source->channels;
+	destination.data = (r32*)malloc((size_t)destination.width * destination.height * destination.channels * sizeof(r32));
+	temporary.width = destination.width;
+	temporary.height = source->height;
+	temporary.channels = source->channels;
+	temporary.data = (r32*)malloc((size_t)temporary.width * temporary.height * temporary.channels * sizeof(r32));
+
+	Downsample_Job job;
+	job.source = source;
+	job.temporary = &temporary;
+	job.destination = &destination;
+	job.kernel = kernel;
+	jobs_parallel_for(source->height, MIPMAP_MIN_ROWS_PER_JOB, filter_horizontally, &job);
+	jobs_parallel_for(destination.height, MIPMAP_MIN_ROWS_PER_JOB, filter_vertically, &job);
+
+	free(temporary.data);
+	return destination;
+}
+
+static bool is_alpha_channel(s32 channel, s32 channels)
+{
+	return (channels == 2 || channels == 4) && channel == channels - 1;
+}
+
+static void convert_to_float(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Conversion_Job* job = (Conversion_Job*)data;
+	const Srgb_Tables* tables = get_srgb_tables();
+	s32 channels = job->image->channels;
+	s32 row_length = job->image->width * channels;
+
+	for (s32 y = begin; y < end; ++y)
+	{
+		const u8* in = job->image->data + (size_t)y * row_length;
+		r32* out = job->float_image->data + (size_t)y * row_length;
+		image_convert_u8_to_float_row(in, out, row_length);
+		if (!job->gamma_correct)
+			continue;
+		for (s32 i = 0; i < row_length; ++i)
+			if (!is_alpha_channel(i % channels, channels))
+				out[i] = tables->to_linear[in[i]];
+	}
+}
+
+static void convert_from_float(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Conversion_Job* job = (Conversion_Job*)data;
+	const Srgb_Tables* tables = get_srgb_tables();
+	s32 channels = job->image->channels;
+	s32 row_length = job->image->width * channels;
+
+	for (s32 y = begin; y < end; ++y)
+	{
+		const r32* in = job->float_image->data + (size_t)y * row_length;
+		u8* out = job->image->data + (size_t)y * row_length;
+		// Clamps too, the Kaiser filter can overshoot.
+		image_convert_float_to_u8_row(in, out, row_length);
+		if (!job->gamma_correct)
+			continue;
+		for (s32 i = 0; i < row_length; ++i)
+		{
+			if (is_alpha_channel(i % channels, channels))
+				continue;
+			r32 value = in[i] < 0.0f ? 0.0f : (in[i] > 1.0f ? 1.0f : in[i]);
+			out[i] = tables->from_linear[(s32)(value * (MIPMAP_SRGB_TABLE_SIZE - 1) + 0.5f)];
+		}
+	}
+}
+
+Mipmap_Options mipmap_get_default_options(Texture_Usage usage)
+{
+	Mipmap_Options options;
+	if (usage == TEXTURE_USAGE_ALBEDO)
+	{
+		options.filter = MIPMAP_FILTER_KAISER;
+		options.gamma_correct = true;
+	}
+	else
+	{
+		// Data textures: ringing would show up as artifacts in lighting, so they stay with the box filter.
+		options.filter = MIPMAP_FILTER_BOX;
+		options.gamma_correct = false;
+	}
+	return options;
+}
+
+Image_Data* mipmap_generate(const Image_Data* image_data, const Mipmap_Options* options)
+{
+	Image_Data* levels = array_new(Image_Data);
+	Mipmap_Kernel kernel = build_kernel(options->filter);
+
+	Image_Data level = *image_data;
+	size_t size = (size_t)level.width * level.height * level.channels;
+	level.data = (u8*)malloc(size);
+	memcpy(level.data, image_data->data, size);
+	array_push(levels, level);
+
+	if (level.width == 1 && level.height == 1)
+		return levels;
+
+	// Levels are filtered from the previous float level, so rounding errors do not accumulate along the chain.
+	Float_Image_Data current;
+	current.width = level.width;
+	current.height = level.height;
+	current.channels = level.channels;
+	current.data = (r32*)malloc(size * sizeof(r32));
+
+	Conversion_Job job;
+	job.image = &level;
+	job.float_image = &current;
+	job.gamma_correct = options->gamma_correct;
+	jobs_parallel_for(current.height, MIPMAP_MIN_ROWS_PER_JOB, convert_to_float, &job);
+
+	while (current.width > 1 || current.height > 1)
+	{
+		Float_Image_Data next = downsample(&current, &kernel);
+		free(current.data);
+		current = next;
+
+		level.width = current.width;
+		level.height = current.height;
+		level.data = (u8*)malloc((size_t)level.width * level.height * level.channels);
+		jobs_parallel_for(current.height, MIPMAP_MIN_ROWS_PER_JOB, convert_from_float, &job);
+		array_push(levels, level);
+	}
+
+	free(current.data);
+	return levels;
+}
+
+Float_Image_Data* mipmap_generate_float(const Float_Image_Data* image_data, const Mipmap_Options* options)
+{
+	Float_Image_Data* levels = array_new(Float_Image_Data);
+	Mipmap_Kernel kernel = build_kernel(options->filter);
+
+	Float_Image_Data level = *image_data;
+	size_t size = (size_t)level.width * level.height * level.channels * sizeof(r32);
+	level.data = (r32*)malloc(size);
+	memcpy(level.data, image_data->data, size);
+	array_push(levels, level);
+
+	while (level.width > 1 || level.height > 1)
+	{
+		level = downsample(&level, &kernel);
+		array_push(levels, level);
+	}
+
+	return levels;
+}
+
+void mipmap_free(Image_Data* levels)
+{
+	for (u32 i = 0; i < array_length(levels); ++i)
+		free(levels[i].data);
+	array_free(levels);
+}
+
+void mipmap_free_float(Float_Image_Data* levels)
+{
+	for (u32 i = 0; i < array_length(levels); ++i)
+		free(levels[i].data);
+	array_free(levels);
+}
+
+bool mipmap_save(const s8* path, u64 key, const Image_Data* levels)
+{
+	// Loads of the same image may run on other threads, they must only ever see a complete file.
+	s8 temporary_path[256];
+	FILE* file = util_open_temporary_file(path, temporary_path, sizeof(temporary_path));
+	if (!file)
+	{
+		printf("Error writing mip chain %s\n", path);
+		return false;
+	}
+
+	Mipmap_File_Header header;
+	header.magic = MIPMAP_FILE_MAGIC;
+	header.version = MIPMAP_FILE_VERSION;
+	header.key = key;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.channels = levels[0].channels;
+	header.level_count = array_length(levels);
+
+	bool success = fwrite(&header, sizeof(Mipmap_File_Header), 1, file) == 1;
+	for (s32 i = 0; success && i < header.level_count; ++i)
+		success = fwrite(levels[i].data, (size_t)levels[i].width * levels[i].height * levels[i].channels, 1, file) == 1;
+	success = fclose(file) == 0 && success;
+
+	if (success)
+		success = util_replace_file(temporary_path, path);
+	else
+		remove(temporary_path);
+
+	if (!success)
+		printf("Error writing mip chain %s\n", path);
+
+	return success;
+}
+
+Image_Data* mipmap_load(const s8* path, u64 key)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	Mipmap_File_Header header;
+	bool valid = fread(&header, sizeof(Mipmap_File_Header), 1, file) == 1 &&
+		header.magic == MIPMAP_FILE_MAGIC &&
+		header.version == MIPMAP_FILE_VERSION &&
+		header.key == key &&
+		header.width > 0 && header.height > 0 &&
+		header.channels >= 1 && header.channels <= 4 &&
+		header.level_count > 0;
+
+	Image_Data* levels = array_new(Image_Data);
+	Image_Data level;
+	level.width = header.width;
+	level.height = header.height;
+	level.channels = header.channels;
+	for (s32 i = 0; valid && i < header.level_count; ++i)
+	{
+		size_t size = (size_t)level.width * level.height * level.channels;
+		level.data = (u8*)malloc(size);
+		array_push(levels, level);
+		valid = fread(level.data, size, 1, file) == 1;
+
+		level.width = level.width > 1 ? level.width / 2 : 1;
+		level.height = level.height > 1 ? level.height / 2 : 1;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		printf("Discarding stale mip chain %s\n", path);
+		remove(path);
+		mipmap_free(levels);
+		return 0;
+	}
+
+	return levels;
+}
+
+bool mipmap_load_level(const s8* path, u64 key, s32 level, Image_Data* level_data)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	Mipmap_File_Header header;
+	bool valid = fread(&header, sizeof(Mipmap_File_Header), 1, file) == 1 &&
+		header.magic == MIPMAP_FILE_MAGIC &&
+		header.version == MIPMAP_FILE_VERSION &&
+		header.key == key &&
+		header.width > 0 && header.height > 0 &&
+		header.channels >= 1 && header.channels <= 4 &&
+		level >= 0 && level < header.level_count;
+
+	// Levels are stored one after the other, level 0 first.
+	s64 offset = sizeof(Mipmap_File_Header);
+	s32 width = header.width, height = header.height;
+	for (s32 i = 0; valid && i < level; ++i)
+	{
+		offset += (s64)width * height * header.channels;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	level_data->data = 0;
+	if (valid)
+	{
+		size_t size = (size_t)width * height * header.channels;
+		level_data->width = width;
+		level_data->height = height;
+		level_data->channels = header.channels;
+		level_data->data = (u8*)malloc(size);
+#ifdef _WIN32
+		valid = _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+		valid = fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+		valid = valid && fread(level_data->data, size, 1, file) == 1;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		free(level_data->data);
+		level_data->data = 0;
+	}
+
+	return valid;
+}
\ No newline at end of file
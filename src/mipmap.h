@@ -0,0 +1,36 @@
+#ifndef BASIC_ENGINE_MIPMAP_H
+#define BASIC_ENGINE_MIPMAP_H
+#include "graphics.h"
+
+#define MIPMAP_CACHE_DIRECTORY "./cache/mips"
+
+typedef enum {
+	MIPMAP_FILTER_BOX,		// 2x2 average. Cheap, slightly blurry.
+	MIPMAP_FILTER_KAISER	// Kaiser-windowed sinc, 12 taps per direction. Keeps more detail, may ring a little.
+} Mipmap_Filter;
+
+typedef struct
+{
+	Mipmap_Filter filter;
+	// Filter in linear space: color channels are decoded from sRGB before filtering and encoded back afterwards.
+	// Alpha (the last channel of 2 and 4 channel images) is always filtered as is. Ignored for float images.
+	bool gamma_correct;
+} Mipmap_Options;
+
+Mipmap_Options mipmap_get_default_options(Texture_Usage usage);
+// Builds the whole mip chain down to 1x1. Level 0 (a copy of the image) comes first; every level is owned by the
+// returned array and must be released with mipmap_free. Rows are filtered on the job workers.
+Image_Data* mipmap_generate(const Image_Data* image_data, const Mipmap_Options* options);
+Float_Image_Data* mipmap_generate_float(const Float_Image_Data* image_data, const Mipmap_Options* options);
+void mipmap_free(Image_Data* levels);
+void mipmap_free_float(Float_Image_Data* levels);
+// Mip chains can be stored to disk so later loads skip both decoding and filtering.
+// The key is stored in the file and checked on load; files with a different key or version are rejected.
+bool mipmap_save(const s8* path, u64 key, const Image_Data* levels);
+// Returns 0 if the file does not exist or is not valid for this key.
+Image_Data* mipmap_load(const s8* path, u64 key);
+// Reads only the given level of a stored chain. Returns false if the file does not exist, is not valid for this key
+// or has no such level. The data is released with free.
+bool mipmap_load_level(const s8* path, u64 key, s32 level, Image_Data* level_data);
+
+#endif
\ No newline at end of file
@@ -1,148 +1,1146 @@
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-#include <iostream>
 #include "graphics.h"
+#include "obj.h"
+#include "jobs.h"
+#include "util.h"
+#include "mesh/optimize.h"
+#include "mesh/weld.h"
+#include "mesh/tangents.h"
 #include <light_array.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files are parsed in chunks of whole lines, at most a few per thread.
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+#define OBJ_MIN_TRIANGLES_PER_JOB 4096
+#define OBJ_MISSING_INDEX -1
+// Longest number handed to strtod when the fast path cannot parse it exactly.
+#define OBJ_MAX_NUMBER_LENGTH 64
+// Streamed files are read through a buffer of this size.
+#define OBJ_STREAM_READ_BUFFER_SIZE (4 << 20)
+// Rough upper bound of the memory a window needs per triangle: its corners, the vertices and indices made from them,
+// and the temporary memory of welding, tangent generation and optimization.
+#define OBJ_STREAM_BYTES_PER_TRIANGLE 640
+#define OBJ_STREAM_MIN_WINDOW_TRIANGLES 4096
+
+// A material name, pointing into the file.
+typedef struct
+{
+	const s8* name;
+	u32 length;
+} Obj_Name;
+
+// usemtl statement: triangles from first_triangle on (counted in the chunk) use the material.
+typedef struct
+{
+	u32 first_triangle;
+	Obj_Name name;
+	// Index in the material table, set once every chunk is parsed.
+	u32 material;
+} Obj_Material_Use;
+
+// Indices of the attributes of a triangle corner, 0-based. Relative (negative) indices in the file are resolved
+// against the chunk counts while parsing, so they only need the counts of the previous chunks added once these are
+// known; relative_mask tells which ones (bit 0 position, 1 texture coordinates, 2 normal).
+typedef struct
+{
+	s32 position;
+	s32 texture_coordinates;
+	s32 normal;
+	u32 relative_mask;
+} Obj_Corner;
+
+typedef struct
+{
+	const s8* begin;
+	const s8* end;
+	vec3* positions;
+	vec2* texture_coordinates;
+	vec3* normals;
+	// 3 per triangle; polygons are triangulated as fans.
+	Obj_Corner* corners;
+	Obj_Material_Use* material_uses;
+	// mtllib statements, each of which may name several files.
+	Obj_Name* material_libraries;
+	// Material of the triangles before the first usemtl of the chunk.
+	u32 initial_material;
+	// Number of items in the previous chunks.
+	u32 position_offset;
+	u32 texture_coordinates_offset;
+	u32 normal_offset;
+	u32 corner_offset;
+	u32 invalid_lines;
+	u32 invalid_indices;
+} Obj_Chunk;
+
+typedef struct
+{
+	Obj_Chunk* chunks;
+	vec3* positions;
+	u32 position_count;
+	vec2* texture_coordinates;
+	u32 texture_coordinates_count;
+	vec3* normals;
+	u32 normal_count;
+	Obj_Corner* corners;
+	// Material of every triangle, 0 if the file has no usemtl statements.
+	u32* triangle_materials;
+	Vertex* output;
+} Obj_Context;
+
+Obj_Options obj_get_default_options()
+{
+	Obj_Options options;
+	options.weld = true;
+	options.weld_epsilon = 0.0f;
+	options.normals = mesh_normals_get_default_options();
+	return options;
+}
 
 int obj_parse(const char* obj_path, Vertex** vertices, u32** indexes)
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::string warn;
-	std::string err;
+	Obj_Options options = obj_get_default_options();
+	return obj_parse_with_options(obj_path, &options, vertices, indexes);
+}
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, 0, &warn, &err, obj_path, 0, true);
+static vec3 get_face_normal(const Vertex* v)
+{
+	vec3 first_edge = gm_vec3_subtract(v[1].position, v[0].position);
+	vec3 second_edge = gm_vec3_subtract(v[2].position, v[0].position);
+	vec3 normal = gm_vec3_cross(first_edge, second_edge);
+	r32 length = gm_vec3_length(normal);
+	return length > 0.0f ? gm_vec3_scalar_product(1.0f / length, normal) : normal;
+}
 
-	if (!warn.empty()) {
-		std::cout << warn << std::endl;
+// Number parsing
+
+static bool is_digit(s8 c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool is_space(s8 c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Checks 8 ASCII digits at once (SWAR): every byte must be in 0x30..0x39.
+static bool are_eight_digits(u64 value)
+{
+	return ((value & 0xF0F0F0F0F0F0F0F0ULL) |
+		(((value + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// Converts 8 ASCII digits (first digit in the lowest byte) with three multiplications instead of eight.
+static u32 parse_eight_digits(u64 value)
+{
+	const u64 mask = 0x000000FF000000FFULL;
+	value -= 0x3030303030303030ULL;
+	value = (value * 10) + (value >> 8);
+	value = (((value & mask) * (100 + (1000000ULL << 32))) + (((value >> 16) & mask) * (1 + (10000ULL << 32)))) >> 32;
+	return (u32)value;
+}
+
+static const s8* parse_digits(const s8* p, const s8* end, u64* mantissa, s32* digit_count)
+{
+	// Only little endian targets are supported, like everywhere else in the engine.
+	while (end - p >= 8)
+	{
+		u64 value;
+		memcpy(&value, p, sizeof(value));
+		if (!are_eight_digits(value))
+			break;
+		*mantissa = *mantissa * 100000000 + parse_eight_digits(value);
+		*digit_count += 8;
+		p += 8;
 	}
 
-	if (!err.empty()) {
-		std::cerr << err << std::endl;
+	while (p < end && is_digit(*p))
+	{
+		*mantissa = *mantissa * 10 + (*p - '0');
+		++*digit_count;
+		++p;
 	}
 
-	if (!ret) {
-		exit(1);
+	return p;
+}
+
+// Returns the end of the number, or 0 if there is no valid number at p.
+static const s8* parse_float(const s8* p, const s8* end, r32* value)
+{
+	static const r64 powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const s8* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
 	}
 
-	*vertices = array_new(Vertex);
-	*indexes = array_new(u32);
+	u64 mantissa = 0;
+	s32 digit_count = 0;
+	p = parse_digits(p, end, &mantissa, &digit_count);
+	s32 exponent = 0;
+	if (p < end && *p == '.')
+	{
+		s32 integer_digit_count = digit_count;
+		p = parse_digits(p + 1, end, &mantissa, &digit_count);
+		exponent = integer_digit_count - digit_count;
+	}
+	if (digit_count == 0)
+		return 0;
 
-	bool generate_normals = attrib.normals.size() == 0;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const s8* q = p + 1;
+		bool negative_exponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negative_exponent = *q == '-';
+			++q;
+		}
+		if (q < end && is_digit(*q))
+		{
+			s32 explicit_exponent = 0;
+			for (; q < end && is_digit(*q); ++q)
+				if (explicit_exponent < 10000)
+					explicit_exponent = explicit_exponent * 10 + (*q - '0');
+			exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+			p = q;
+		}
+	}
 
-	if (generate_normals)
-		printf("normals not found in model.. will be generated\n");
-	else
-		printf("normals are present in model\n");
+	// Both the mantissa and the power of ten are exact doubles here, so a single operation rounds correctly
+	// (Clinger's fast path). Anything else, which is rare in practice, goes through strtod.
+	if (digit_count <= 15 && exponent >= -22 && exponent <= 22)
+	{
+		r64 result = (r64)mantissa;
+		result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+		*value = (r32)(negative ? -result : result);
+		return p;
+	}
+
+	s8 buffer[OBJ_MAX_NUMBER_LENGTH];
+	if (p - start >= OBJ_MAX_NUMBER_LENGTH)
+		return 0;
+	memcpy(buffer, start, p - start);
+	buffer[p - start] = 0;
+	*value = (r32)strtod(buffer, 0);
+	return p;
+}
+
+static const s8* parse_int(const s8* p, const s8* end, s32* value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
+	}
+	if (p == end || !is_digit(*p))
+		return 0;
+
+	s64 result = 0;
+	for (; p < end && is_digit(*p); ++p)
+		if (result <= 0x7FFFFFFF)
+			result = result * 10 + (*p - '0');
+	*value = (s32)(negative ? -result : result);
+	return p;
+}
+
+static const s8* skip_spaces(const s8* p, const s8* end)
+{
+	while (p < end && is_space(*p))
+		++p;
+	return p;
+}
+
+static bool parse_floats(const s8* p, const s8* end, r32* values, s32 count)
+{
+	for (s32 i = 0; i < count; ++i)
+	{
+		p = skip_spaces(p, end);
+		p = parse_float(p, end, &values[i]);
+		if (!p)
+			return false;
+	}
+	return true;
+}
+
+// Chunk parsing
+
+// 1-based indices count from the start of the file, negative ones backwards from the current item.
+static s32 resolve_index(s32 index, u32 chunk_count, u32 relative_bit, u32* relative_mask)
+{
+	if (index > 0)
+		return index - 1;
+	*relative_mask |= relative_bit;
+	return (s32)chunk_count + index;
+}
+
+// Fills the polygon; relative indices are resolved against the given counts of items read so far.
+static bool parse_face(const s8* p, const s8* end, u32 position_count, u32 texture_coordinates_count,
+	u32 normal_count, Obj_Corner** polygon)
+{
+	array_clear(*polygon);
+
+	for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end))
+	{
+		Obj_Corner corner = { OBJ_MISSING_INDEX, OBJ_MISSING_INDEX, OBJ_MISSING_INDEX, 0 };
+		s32 index;
+
+		// v, v/vt, v//vn or v/vt/vn
+		p = parse_int(p, end, &index);
+		if (!p || index == 0)
+			return false;
+		corner.position = resolve_index(index, position_count, 1, &corner.relative_mask);
+
+		if (p < end && *p == '/')
+		{
+			++p;
+			if (p < end && *p != '/')
+			{
+				p = parse_int(p, end, &index);
+				if (!p || index == 0)
+					return false;
+				corner.texture_coordinates = resolve_index(index, texture_coordinates_count, 2, &corner.relative_mask);
+			}
+			if (p < end && *p == '/')
+			{
+				p = parse_int(p + 1, end, &index);
+				if (!p || index == 0)
+					return false;
+				corner.normal = resolve_index(index, normal_count, 4, &corner.relative_mask);
+			}
+		}
+
+		if (p < end && !is_space(*p))
+			return false;
+		array_push(*polygon, corner);
+	}
+
+	return array_length(*polygon) >= 3;
+}
+
+typedef enum {
+	OBJ_LINE_OTHER,
+	OBJ_LINE_INVALID,
+	OBJ_LINE_POSITION,
+	OBJ_LINE_TEXTURE_COORDINATES,
+	OBJ_LINE_NORMAL,
+	OBJ_LINE_FACE,
+	OBJ_LINE_MATERIAL,
+	OBJ_LINE_MATERIAL_LIBRARY
+} Obj_Line_Type;
+
+static bool is_statement(const s8* p, const s8* end, const s8* keyword)
+{
+	u32 length = (u32)strlen(keyword);
+	return (u32)(end - p) > length && !memcmp(p, keyword, length) && is_space(p[length]);
+}
 
-	// For now, we are not re-using vertices, i.e., our indices are 0 1 2 3 4 5 6 7...
-	// This is because tinyobj loads the object in such a way that the position, tex coords and normals are completely independent
-	// vectors (just like in the obj file)
-	// for this reason, if we wanna re-use vertices, we need to be sure that all three pos,tex_coords,normals are the same...
-	// for example, we may have two indices poiting to the same vertex position, but using different uv_coords... so we would not
-	// be able to re-use this specific vertex in this case
-	// we can make such algorithm if needed, but for now, we are just duplicating everything
-	s32 index_counter = 0;
-	for (size_t s = 0; s < shapes.size(); s++) {
-		for (size_t f = 0; f < shapes[s].mesh.indices.size() / 3; f++) {
-			array_push(*indexes, index_counter);
-			++index_counter;
-			array_push(*indexes, index_counter);
-			++index_counter;
-			array_push(*indexes, index_counter);
-			++index_counter;
-
-			tinyobj::index_t idx0 = shapes[s].mesh.indices[3 * f + 0];
-			tinyobj::index_t idx1 = shapes[s].mesh.indices[3 * f + 1];
-			tinyobj::index_t idx2 = shapes[s].mesh.indices[3 * f + 2];
-			Vertex v[3];
-
-			if (attrib.texcoords.size() > 0) {
-				v[0].texture_coordinates.x = attrib.texcoords[2 * idx0.texcoord_index];
-				v[0].texture_coordinates.y = attrib.texcoords[2 * idx0.texcoord_index + 1];
-				v[1].texture_coordinates.x = attrib.texcoords[2 * idx1.texcoord_index];
-				v[1].texture_coordinates.y = attrib.texcoords[2 * idx1.texcoord_index + 1];
-				v[2].texture_coordinates.x = attrib.texcoords[2 * idx2.texcoord_index];
-				v[2].texture_coordinates.y = attrib.texcoords[2 * idx2.texcoord_index + 1];
+// Argument of a statement taking a name (usemtl, mtllib, newmtl, map_Kd...), without surrounding spaces.
+static Obj_Name get_statement_name(const s8* line, const s8* line_end)
+{
+	const s8* p = skip_spaces(line, line_end);
+	while (p < line_end && !is_space(*p))
+		++p;
+	p = skip_spaces(p, line_end);
+	while (line_end > p && is_space(line_end[-1]))
+		--line_end;
+	Obj_Name name = { p, (u32)(line_end - p) };
+	return name;
+}
+
+// Attributes are returned in values, faces in polygon. The counts are the numbers of items read so far.
+static Obj_Line_Type parse_line(const s8* line, const s8* line_end, u32 position_count, u32 texture_coordinates_count,
+	u32 normal_count, r32 values[3], Obj_Corner** polygon)
+{
+	const s8* p = skip_spaces(line, line_end);
+	Obj_Line_Type type = OBJ_LINE_OTHER;
+	bool valid = true;
+	// Only geometry and materials are read. Comments, groups and smoothing groups are skipped.
+	if (line_end - p >= 2 && p[0] == 'v' && is_space(p[1]))
+	{
+		type = OBJ_LINE_POSITION;
+		valid = parse_floats(p + 2, line_end, values, 3);
+	}
+	else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2]))
+	{
+		// A third (w) coordinate may follow, it is ignored.
+		type = OBJ_LINE_TEXTURE_COORDINATES;
+		valid = parse_floats(p + 3, line_end, values, 2);
+	}
+	else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2]))
+	{
+		type = OBJ_LINE_NORMAL;
+		valid = parse_floats(p + 3, line_end, values, 3);
+	}
+	else if (line_end - p >= 2 && p[0] == 'f' && is_space(p[1]))
+	{
+		type = OBJ_LINE_FACE;
+		valid = parse_face(p + 2, line_end, position_count, texture_coordinates_count, normal_count, polygon);
+	}
+	else if (is_statement(p, line_end, "usemtl"))
+		type = OBJ_LINE_MATERIAL;
+	else if (is_statement(p, line_end, "mtllib"))
+		type = OBJ_LINE_MATERIAL_LIBRARY;
+
+	return valid ? type : OBJ_LINE_INVALID;
+}
+
+// Triangulates the polygon as a fan.
+static void push_triangles(Obj_Corner** corners, const Obj_Corner* polygon)
+{
+	for (u32 i = 1; i + 1 < array_length(polygon); ++i)
+	{
+		array_push(*corners, polygon[0]);
+		array_push(*corners, polygon[i]);
+		array_push(*corners, polygon[i + 1]);
+	}
+}
+
+static void parse_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Obj_Context* ctx = (Obj_Context*)data;
+	Obj_Corner* polygon = array_new(Obj_Corner);
+
+	for (s32 c = begin; c < end; ++c)
+	{
+		Obj_Chunk* chunk = &ctx->chunks[c];
+		const s8* line = chunk->begin;
+
+		while (line < chunk->end)
+		{
+			const s8* line_end = (const s8*)memchr(line, '\n', chunk->end - line);
+			if (!line_end)
+				line_end = chunk->end;
+
+			r32 values[3];
+			switch (parse_line(line, line_end, array_length(chunk->positions), array_length(chunk->texture_coordinates),
+				array_length(chunk->normals), values, &polygon))
+			{
+				case OBJ_LINE_POSITION:
+					array_push(chunk->positions, ((vec3){values[0], values[1], values[2]}));
+					break;
+				case OBJ_LINE_TEXTURE_COORDINATES:
+					array_push(chunk->texture_coordinates, ((vec2){values[0], values[1]}));
+					break;
+				case OBJ_LINE_NORMAL:
+					array_push(chunk->normals, ((vec3){values[0], values[1], values[2]}));
+					break;
+				case OBJ_LINE_FACE:
+					push_triangles(&chunk->corners, polygon);
+					break;
+				case OBJ_LINE_MATERIAL:
+				{
+					Obj_Material_Use use = { (u32)array_length(chunk->corners) / 3, get_statement_name(line, line_end), 0 };
+					array_push(chunk->material_uses, use);
+				} break;
+				case OBJ_LINE_MATERIAL_LIBRARY:
+					array_push(chunk->material_libraries, get_statement_name(line, line_end));
+					break;
+				case OBJ_LINE_INVALID:
+					++chunk->invalid_lines;
+					break;
+				default:
+					break;
 			}
+			line = line_end + 1;
+		}
+	}
 
-			int f0 = idx0.vertex_index;
-			int f1 = idx1.vertex_index;
-			int f2 = idx2.vertex_index;
-
-			v[0].position.x = attrib.vertices[3 * f0 + 0];
-			v[0].position.y = attrib.vertices[3 * f0 + 1];
-			v[0].position.z = attrib.vertices[3 * f0 + 2];
-			v[1].position.x = attrib.vertices[3 * f1 + 0];
-			v[1].position.y = attrib.vertices[3 * f1 + 1];
-			v[1].position.z = attrib.vertices[3 * f1 + 2];
-			v[2].position.x = attrib.vertices[3 * f2 + 0];
-			v[2].position.y = attrib.vertices[3 * f2 + 1];
-			v[2].position.z = attrib.vertices[3 * f2 + 2];
-
-			if (!generate_normals)
+	array_free(polygon);
+}
+
+// Merging
+
+static s32 get_global_index(s32 index, u32 offset, u32 count, bool relative, u32* invalid_indices)
+{
+	if (index == OBJ_MISSING_INDEX && !relative)
+		return OBJ_MISSING_INDEX;
+	s64 global = (s64)index + (relative ? offset : 0);
+	if (global < 0 || global >= count)
+	{
+		++*invalid_indices;
+		return OBJ_MISSING_INDEX;
+	}
+	return (s32)global;
+}
+
+static void merge_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Obj_Context* ctx = (Obj_Context*)data;
+
+	for (s32 c = begin; c < end; ++c)
+	{
+		Obj_Chunk* chunk = &ctx->chunks[c];
+		memcpy(ctx->positions + chunk->position_offset, chunk->positions, array_length(chunk->positions) * sizeof(vec3));
+		memcpy(ctx->texture_coordinates + chunk->texture_coordinates_offset, chunk->texture_coordinates,
+			array_length(chunk->texture_coordinates) * sizeof(vec2));
+		memcpy(ctx->normals + chunk->normal_offset, chunk->normals, array_length(chunk->normals) * sizeof(vec3));
+
+		if (ctx->triangle_materials)
+		{
+			u32 material = chunk->initial_material;
+			u32 next_use = 0;
+			for (u32 t = 0; t < array_length(chunk->corners) / 3; ++t)
 			{
-				int nf0 = idx0.normal_index;
-				int nf1 = idx1.normal_index;
-				int nf2 = idx2.normal_index;
-
-				v[0].normal.x = attrib.normals[3 * nf0 + 0];
-				v[0].normal.y = attrib.normals[3 * nf0 + 1];
-				v[0].normal.z = attrib.normals[3 * nf0 + 2];
-				v[1].normal.x = attrib.normals[3 * nf1 + 0];
-				v[1].normal.y = attrib.normals[3 * nf1 + 1];
-				v[1].normal.z = attrib.normals[3 * nf1 + 2];
-				v[2].normal.x = attrib.normals[3 * nf2 + 0];
-				v[2].normal.y = attrib.normals[3 * nf2 + 1];
-				v[2].normal.z = attrib.normals[3 * nf2 + 2];
+				while (next_use < array_length(chunk->material_uses) &&
+					chunk->material_uses[next_use].first_triangle == t)
+					material = chunk->material_uses[next_use++].material;
+				ctx->triangle_materials[chunk->corner_offset / 3 + t] = material;
 			}
+		}
+
+		for (u32 i = 0; i < array_length(chunk->corners); ++i)
+		{
+			Obj_Corner corner = chunk->corners[i];
+			Obj_Corner* out = &ctx->corners[chunk->corner_offset + i];
+			out->position = get_global_index(corner.position, chunk->position_offset, ctx->position_count,
+				corner.relative_mask & 1, &chunk->invalid_indices);
+			out->texture_coordinates = get_global_index(corner.texture_coordinates, chunk->texture_coordinates_offset,
+				ctx->texture_coordinates_count, corner.relative_mask & 2, &chunk->invalid_indices);
+			out->normal = get_global_index(corner.normal, chunk->normal_offset, ctx->normal_count,
+				corner.relative_mask & 4, &chunk->invalid_indices);
+		}
+
+		array_free(chunk->positions);
+		array_free(chunk->texture_coordinates);
+		array_free(chunk->normals);
+		array_free(chunk->corners);
+		array_free(chunk->material_uses);
+		array_free(chunk->material_libraries);
+	}
+}
+
+static void gather_job(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Obj_Context* ctx = (Obj_Context*)data;
+
+	for (s32 t = begin; t < end; ++t)
+	{
+		Vertex* v = ctx->output + t * 3;
+		bool missing_normal = false;
+
+		for (s32 i = 0; i < 3; ++i)
+		{
+			const Obj_Corner* corner = &ctx->corners[t * 3 + i];
+			memset(&v[i], 0, sizeof(Vertex));
+
+			if (corner->position != OBJ_MISSING_INDEX)
+				v[i].position = ctx->positions[corner->position];
+			// Faces without texture coordinates get (0, 0), so their corners can still be merged.
+			if (corner->texture_coordinates != OBJ_MISSING_INDEX)
+				v[i].texture_coordinates = ctx->texture_coordinates[corner->texture_coordinates];
+			if (corner->normal != OBJ_MISSING_INDEX)
+				v[i].normal = ctx->normals[corner->normal];
 			else
+				missing_normal = true;
+		}
+
+		// Faces without normals in a file that has them get flat normals. Files without normals at all get smooth
+		// normals once every corner is known.
+		if (missing_normal && ctx->normal_count > 0)
+		{
+			vec3 face_normal = get_face_normal(v);
+			for (s32 i = 0; i < 3; ++i)
+				if (ctx->corners[t * 3 + i].normal == OBJ_MISSING_INDEX)
+					v[i].normal = face_normal;
+		}
+	}
+}
+
+// Materials
+
+static bool names_equal(Obj_Name a, Obj_Name b)
+{
+	return a.length == b.length && !memcmp(a.name, b.name, a.length);
+}
+
+static u32 get_material(Obj_Name** names, Obj_Name name)
+{
+	for (u32 i = 0; i < array_length(*names); ++i)
+		if (names_equal((*names)[i], name))
+			return i;
+	array_push(*names, name);
+	return array_length(*names) - 1;
+}
+
+// Paths in material libraries are relative to the directory of the file referencing them.
+static void get_relative_path(const s8* base_path, Obj_Name name, s8* path)
+{
+	const s8* directory_end = base_path + strlen(base_path);
+	while (directory_end > base_path && directory_end[-1] != '/' && directory_end[-1] != '\\')
+		--directory_end;
+	snprintf(path, OBJ_MAX_PATH_LENGTH, "%.*s%.*s", (s32)(directory_end - base_path), base_path, (s32)name.length,
+		name.name);
+}
+
+// Fills the materials of the library that are in names. Only the diffuse color, opacity and diffuse map are read.
+// Returns whether any of them is defined.
+static bool load_material_library(const s8* path, const Obj_Name* names, Obj_Submesh* materials)
+{
+	u64 file_size;
+	const s8* file = (const s8*)util_map_file(path, &file_size);
+	if (!file)
+	{
+		printf("Warning: could not load material library %s\n", path);
+		return false;
+	}
+
+	bool found = false;
+	Obj_Submesh* material = 0;
+	const s8* file_end = file + file_size;
+	for (const s8* line = file; line < file_end;)
+	{
+		const s8* line_end = (const s8*)memchr(line, '\n', file_end - line);
+		if (!line_end)
+			line_end = file_end;
+
+		const s8* p = skip_spaces(line, line_end);
+		r32 value;
+		if (is_statement(p, line_end, "newmtl"))
+		{
+			material = 0;
+			Obj_Name name = get_statement_name(line, line_end);
+			// Index 0 is for faces without a material.
+			for (u32 i = 1; i < array_length(names) && !material; ++i)
+				if (names_equal(names[i], name))
+					material = &materials[i];
+			found = found || material;
+		}
+		else if (material && is_statement(p, line_end, "Kd"))
+			parse_floats(p + 2, line_end, (r32*)&material->diffuse_color, 3);
+		else if (material && is_statement(p, line_end, "d") && parse_floats(p + 1, line_end, &value, 1))
+			material->diffuse_color.w = value;
+		else if (material && is_statement(p, line_end, "Tr") && parse_floats(p + 2, line_end, &value, 1))
+			material->diffuse_color.w = 1.0f - value;
+		else if (material && is_statement(p, line_end, "map_Kd"))
+		{
+			// Options (-s, -o, ...) may come first; the file name is the last argument.
+			Obj_Name name = get_statement_name(line, line_end);
+			const s8* name_begin = name.name + name.length;
+			while (name_begin > name.name && !is_space(name_begin[-1]))
+				--name_begin;
+			name.length -= (u32)(name_begin - name.name);
+			name.name = name_begin;
+			get_relative_path(path, name, material->diffuse_map_path);
+		}
+
+		line = line_end + 1;
+	}
+
+	util_unmap_file((const u8*)file, file_size);
+	return found;
+}
+
+int obj_parse_with_options(const char* obj_path, const Obj_Options* options, Vertex** vertices, u32** indexes)
+{
+	Obj_Submesh* submeshes;
+	int result = obj_parse_with_materials(obj_path, options, vertices, indexes, &submeshes, 0);
+	array_free(submeshes);
+	return result;
+}
+
+int obj_parse_with_materials(const char* obj_path, const Obj_Options* options, Vertex** vertices, u32** indexes,
+	Obj_Submesh** submeshes, Obj_Material_Library** material_libraries)
+{
+	u64 file_size;
+	const s8* file = (const s8*)util_map_file(obj_path, &file_size);
+	if (!file)
+	{
+		printf("Error loading obj %s\n", obj_path);
+		exit(1);
+	}
+
+	// Chunk boundaries are moved forward to the next line start.
+	u32 chunk_count = (u32)(file_size / OBJ_MIN_CHUNK_SIZE);
+	u32 max_chunk_count = (u32)(jobs_get_worker_count() + 1) * 4;
+	chunk_count = chunk_count > max_chunk_count ? max_chunk_count : (chunk_count == 0 ? 1 : chunk_count);
+
+	Obj_Context ctx;
+	ctx.chunks = (Obj_Chunk*)calloc(chunk_count, sizeof(Obj_Chunk));
+	const s8* file_end = file + file_size;
+	const s8* chunk_begin = file;
+	for (u32 c = 0; c < chunk_count; ++c)
+	{
+		const s8* chunk_end = file + file_size * (c + 1) / chunk_count;
+		if (chunk_end < chunk_begin)
+			chunk_end = chunk_begin;
+		if (chunk_end < file_end)
+		{
+			const s8* line_end = (const s8*)memchr(chunk_end, '\n', file_end - chunk_end);
+			chunk_end = line_end ? line_end + 1 : file_end;
+		}
+
+		Obj_Chunk* chunk = &ctx.chunks[c];
+		chunk->begin = chunk_begin;
+		chunk->end = chunk_end;
+		chunk->positions = array_new(vec3);
+		chunk->texture_coordinates = array_new(vec2);
+		chunk->normals = array_new(vec3);
+		chunk->corners = array_new(Obj_Corner);
+		chunk->material_uses = array_new(Obj_Material_Use);
+		chunk->material_libraries = array_new(Obj_Name);
+		chunk_begin = chunk_end;
+	}
+
+	jobs_parallel_for(chunk_count, 1, parse_job, &ctx);
+
+	// Material names in order of first use. The state of usemtl carries over chunk boundaries.
+	Obj_Name* material_names = array_new(Obj_Name);
+	Obj_Name no_material = { 0, 0 };
+	array_push(material_names, no_material);
+	u32 material = 0;
+	bool has_materials = false;
+	for (u32 c = 0; c < chunk_count; ++c)
+	{
+		Obj_Chunk* chunk = &ctx.chunks[c];
+		chunk->initial_material = material;
+		for (u32 i = 0; i < array_length(chunk->material_uses); ++i)
+		{
+			material = get_material(&material_names, chunk->material_uses[i].name);
+			chunk->material_uses[i].material = material;
+			has_materials = true;
+		}
+	}
+
+	// Prefix sums give every chunk the place of its items in the merged arrays.
+	u32 corner_count = 0;
+	ctx.position_count = ctx.texture_coordinates_count = ctx.normal_count = 0;
+	for (u32 c = 0; c < chunk_count; ++c)
+	{
+		Obj_Chunk* chunk = &ctx.chunks[c];
+		chunk->position_offset = ctx.position_count;
+		chunk->texture_coordinates_offset = ctx.texture_coordinates_count;
+		chunk->normal_offset = ctx.normal_count;
+		chunk->corner_offset = corner_count;
+		ctx.position_count += array_length(chunk->positions);
+		ctx.texture_coordinates_count += array_length(chunk->texture_coordinates);
+		ctx.normal_count += array_length(chunk->normals);
+		corner_count += array_length(chunk->corners);
+	}
+
+	ctx.positions = (vec3*)malloc(ctx.position_count * sizeof(vec3) + 1);
+	ctx.texture_coordinates = (vec2*)malloc(ctx.texture_coordinates_count * sizeof(vec2) + 1);
+	ctx.normals = (vec3*)malloc(ctx.normal_count * sizeof(vec3) + 1);
+	ctx.corners = (Obj_Corner*)malloc(corner_count * sizeof(Obj_Corner) + 1);
+	ctx.triangle_materials = has_materials ? (u32*)malloc(corner_count / 3 * sizeof(u32) + 1) : 0;
+
+	// Faces without a known material are white. If no material is known at all, usually because the material
+	// libraries are missing, the file is treated as having no materials.
+	bool found_materials = false;
+	if (material_libraries)
+		*material_libraries = array_new(Obj_Material_Library);
+	Obj_Submesh* materials = (Obj_Submesh*)calloc(array_length(material_names), sizeof(Obj_Submesh));
+	for (u32 i = 0; i < array_length(material_names); ++i)
+		materials[i].diffuse_color = (vec4){1.0f, 1.0f, 1.0f, 1.0f};
+	for (u32 c = 0; c < chunk_count && has_materials; ++c)
+	{
+		for (u32 i = 0; i < array_length(ctx.chunks[c].material_libraries); ++i)
+		{
+			// A single mtllib statement may name several files.
+			Obj_Name libraries = ctx.chunks[c].material_libraries[i];
+			const s8* end = libraries.name + libraries.length;
+			for (const s8* p = libraries.name; p < end;)
 			{
-				v[0].normal = (vec3){0.0f, 0.0f, 0.0f};
-				v[1].normal = (vec3){0.0f, 0.0f, 0.0f};
-				v[2].normal = (vec3){0.0f, 0.0f, 0.0f};
+				const s8* name_end = p;
+				while (name_end < end && !is_space(*name_end))
+					++name_end;
+				Obj_Name library = { p, (u32)(name_end - p) };
+				Obj_Material_Library material_library;
+				get_relative_path(obj_path, library, material_library.path);
+				if (load_material_library(material_library.path, material_names, materials))
+					found_materials = true;
+				if (material_libraries)
+					array_push(*material_libraries, material_library);
+				p = skip_spaces(name_end, end);
 			}
+		}
+	}
+
+	if (!found_materials)
+	{
+		has_materials = false;
+		free(ctx.triangle_materials);
+		ctx.triangle_materials = 0;
+	}
+
+	jobs_parallel_for(chunk_count, 1, merge_job, &ctx);
+	u32 material_count = array_length(material_names);
+	array_free(material_names);
+	util_unmap_file((const u8*)file, file_size);
+
+	u32 invalid_lines = 0, invalid_indices = 0;
+	for (u32 c = 0; c < chunk_count; ++c)
+	{
+		invalid_lines += ctx.chunks[c].invalid_lines;
+		invalid_indices += ctx.chunks[c].invalid_indices;
+	}
+	if (invalid_lines > 0 || invalid_indices > 0)
+		printf("Warning: %s has %u invalid lines and %u invalid indices\n", obj_path, invalid_lines, invalid_indices);
 
-			array_push(*vertices, v[0]);
-			array_push(*vertices, v[1]);
-			array_push(*vertices, v[2]);
+	bool generate_normals = ctx.normal_count == 0;
+
+	if (generate_normals)
+		printf("normals not found in model.. will be generated\n");
+	else
+		printf("normals are present in model\n");
+
+	// Triangles are sorted by material with a counting sort, which keeps their order within each material.
+	*submeshes = array_new(Obj_Submesh);
+	if (has_materials)
+	{
+		u32 triangle_count = corner_count / 3;
+		u32* next_triangle = (u32*)calloc(material_count, sizeof(u32));
+		for (u32 t = 0; t < triangle_count; ++t)
+			++next_triangle[ctx.triangle_materials[t]];
+		u32 first_triangle = 0;
+		for (u32 m = 0; m < material_count; ++m)
+		{
+			if (next_triangle[m] > 0)
+			{
+				Obj_Submesh submesh = materials[m];
+				submesh.first_index = first_triangle * 3;
+				submesh.index_count = next_triangle[m] * 3;
+				array_push(*submeshes, submesh);
+			}
+			u32 count = next_triangle[m];
+			next_triangle[m] = first_triangle;
+			first_triangle += count;
 		}
+
+		Obj_Corner* sorted_corners = (Obj_Corner*)malloc(corner_count * sizeof(Obj_Corner) + 1);
+		for (u32 t = 0; t < triangle_count; ++t)
+			memcpy(sorted_corners + next_triangle[ctx.triangle_materials[t]]++ * 3, ctx.corners + t * 3,
+				3 * sizeof(Obj_Corner));
+		free(ctx.corners);
+		ctx.corners = sorted_corners;
+		free(next_triangle);
 	}
+	free(ctx.triangle_materials);
+	free(materials);
+
+	// Obj files index positions, texture coordinates and normals independently, so first every triangle corner gets
+	// its own vertex. Corners are then merged by mesh_weld_vertices, which only reuses a vertex if all attributes match.
+	Vertex* corners = array_new(Vertex);
+	array_allocate(corners, corner_count);
+	array_length(corners) = corner_count;
+	ctx.output = corners;
+	jobs_parallel_for(corner_count / 3, OBJ_MIN_TRIANGLES_PER_JOB, gather_job, &ctx);
+
+	free(ctx.chunks);
+	free(ctx.positions);
+	free(ctx.texture_coordinates);
+	free(ctx.normals);
+	free(ctx.corners);
 
 	if (generate_normals)
+		mesh_generate_normals(corners, array_length(corners), &options->normals);
+
+	if (options->weld)
+	{
+		mesh_weld_vertices(corners, array_length(corners), options->weld_epsilon, vertices, indexes);
+		array_free(corners);
+	}
+	else
 	{
-		// Calculate normals
-		size_t indexes_length = array_length(*indexes);
+		*vertices = corners;
+		*indexes = array_new(u32);
+		for (u32 i = 0; i < array_length(corners); ++i)
+			array_push(*indexes, i);
+	}
+
+	mesh_generate_tangents(vertices, *indexes);
+
+	return 0;
+}
+
+// Streaming
+
+typedef struct
+{
+	FILE* file;
+	s8* buffer;
+	// Unread bytes of the buffer.
+	u32 begin;
+	u32 end;
+	bool eof;
+} Obj_Line_Reader;
+
+static void line_reader_rewind(Obj_Line_Reader* reader)
+{
+	fseek(reader->file, 0, SEEK_SET);
+	reader->begin = reader->end = 0;
+	reader->eof = false;
+}
 
-		for (size_t i = 0; i < indexes_length; i += 3)
+// Lines point into the buffer and are valid until the next call. Lines longer than the buffer are cut.
+static bool line_reader_next(Obj_Line_Reader* reader, const s8** line, const s8** line_end)
+{
+	for (;;)
+	{
+		s8* start = reader->buffer + reader->begin;
+		s8* newline = (s8*)memchr(start, '\n', reader->end - reader->begin);
+		bool full = reader->begin == 0 && reader->end == OBJ_STREAM_READ_BUFFER_SIZE;
+		if (newline || reader->eof || full)
 		{
-			Vertex* vertex_a, *vertex_b, *vertex_c;
-			unsigned int i1 = (*indexes)[i + 0];
-			unsigned int i2 = (*indexes)[i + 1];
-			unsigned int i3 = (*indexes)[i + 2];
+			if (!newline && reader->begin == reader->end)
+				return false;
+			*line = start;
+			*line_end = newline ? newline : reader->buffer + reader->end;
+			reader->begin = newline ? (u32)(newline + 1 - reader->buffer) : reader->end;
+			return true;
+		}
 
-			// Find vertices
-			vertex_a = *vertices + i1;
-			vertex_b = *vertices + i2;
-			vertex_c = *vertices + i3;
+		// Keeps the partial line and refills the rest of the buffer.
+		memmove(reader->buffer, start, reader->end - reader->begin);
+		reader->end -= reader->begin;
+		reader->begin = 0;
+		size_t read = fread(reader->buffer + reader->end, 1, OBJ_STREAM_READ_BUFFER_SIZE - reader->end, reader->file);
+		reader->end += (u32)read;
+		reader->eof = read == 0;
+	}
+}
 
-			// Manually calculate triangle's normal
-			vec3 A = (vec3) {vertex_a->position.x, vertex_a->position.y, vertex_a->position.z};
-			vec3 B = (vec3) {vertex_b->position.x, vertex_b->position.y, vertex_b->position.z};
-			vec3 C = (vec3) {vertex_c->position.x, vertex_c->position.y, vertex_c->position.z};
-			vec3 first_edge = (vec3){B.x - A.x, B.y - A.y, B.z - A.z};
-			vec3 second_edge = (vec3){C.x - A.x, C.y - A.y, C.z - A.z};
-			vec4 normal;
-			normal.x = first_edge.y * second_edge.z - first_edge.z * second_edge.y;
-			normal.y = first_edge.z * second_edge.x - first_edge.x * second_edge.z;
-			normal.z = first_edge.x * second_edge.y - first_edge.y * second_edge.x;
+static void accumulate_normals(Obj_Context* ctx, const Obj_Corner* corners, Mesh_Normals_Weighting weighting)
+{
+	vec3 p[3];
+	for (u32 i = 0; i < 3; ++i)
+	{
+		if (corners[i].position == OBJ_MISSING_INDEX)
+			return;
+		p[i] = ctx->positions[corners[i].position];
+	}
 
-			// Assign normals
-			vertex_a->normal = (vec3){vertex_a->normal.x + normal.x, vertex_a->normal.y + normal.y, vertex_a->normal.z + normal.z};
-			vertex_b->normal = (vec3){vertex_b->normal.x + normal.x, vertex_b->normal.y + normal.y, vertex_b->normal.z + normal.z};
-			vertex_c->normal = (vec3){vertex_c->normal.x + normal.x, vertex_c->normal.y + normal.y, vertex_c->normal.z + normal.z};
+	vec3 normal = gm_vec3_cross(gm_vec3_subtract(p[1], p[0]), gm_vec3_subtract(p[2], p[0]));
+	r32 length = gm_vec3_length(normal);
+	if (length == 0.0f)
+		return;
+	normal = gm_vec3_scalar_product(1.0f / length, normal);
+
+	for (u32 i = 0; i < 3; ++i)
+	{
+		r32 weight = length;
+		if (weighting == MESH_NORMALS_WEIGHT_ANGLE)
+		{
+			vec3 a = gm_vec3_normalize(gm_vec3_subtract(p[(i + 1) % 3], p[i]));
+			vec3 b = gm_vec3_normalize(gm_vec3_subtract(p[(i + 2) % 3], p[i]));
+			r32 cosine = gm_vec3_dot(a, b);
+			weight = acosf(cosine < -1.0f ? -1.0f : (cosine > 1.0f ? 1.0f : cosine));
 		}
+		vec3* sum = &ctx->normals[corners[i].position];
+		*sum = gm_vec3_add(*sum, gm_vec3_scalar_product(weight, normal));
 	}
+}
 
-	return 0;
+// Turns the corners of a window into vertices and indices and hands them to the sink. Vertices are not shared
+// between windows.
+static bool emit_window(Obj_Context* ctx, u32 corner_count, const Obj_Options* options, const Obj_Stream_Sink* sink,
+	Obj_Stream_Report* report)
+{
+	Vertex* corners = array_new(Vertex);
+	array_allocate(corners, corner_count);
+	array_length(corners) = corner_count;
+	ctx->output = corners;
+	jobs_parallel_for(corner_count / 3, OBJ_MIN_TRIANGLES_PER_JOB, gather_job, ctx);
+
+	Vertex* vertices;
+	u32* indices;
+	if (options->weld)
+	{
+		mesh_weld_vertices(corners, corner_count, options->weld_epsilon, &vertices, &indices);
+		array_free(corners);
+	}
+	else
+	{
+		vertices = corners;
+		indices = array_new(u32);
+		for (u32 i = 0; i < corner_count; ++i)
+			array_push(indices, i);
+	}
+
+	mesh_generate_tangents(&vertices, indices);
+	mesh_optimize(vertices, indices, 0);
+
+	for (u32 i = 0; i < array_length(indices); ++i)
+		indices[i] += report->vertex_count;
+	bool success = sink->emit(vertices, array_length(vertices), indices, array_length(indices), sink->data);
+
+	report->vertex_count += array_length(vertices);
+	++report->window_count;
+	array_free(vertices);
+	array_free(indices);
+	return success;
+}
+
+bool obj_stream(const char* obj_path, const Obj_Options* options, u64 memory_limit, const Obj_Stream_Sink* sink,
+	Obj_Stream_Report* report)
+{
+	memset(report, 0, sizeof(Obj_Stream_Report));
+	Obj_Line_Reader reader;
+	reader.file = fopen(obj_path, "rb");
+	if (!reader.file)
+	{
+		printf("Error loading obj %s\n", obj_path);
+		return false;
+	}
+	reader.buffer = (s8*)malloc(OBJ_STREAM_READ_BUFFER_SIZE);
+	line_reader_rewind(&reader);
+
+	Obj_Corner* polygon = array_new(Obj_Corner);
+	const s8* line;
+	const s8* line_end;
+	r32 values[3];
+	u32 invalid_lines = 0, invalid_indices = 0;
+
+	// First pass: counts, so the attributes can be stored in arrays of the exact size.
+	u32 position_count = 0, texture_coordinates_count = 0, normal_count = 0;
+	while (line_reader_next(&reader, &line, &line_end))
+	{
+		switch (parse_line(line, line_end, position_count, texture_coordinates_count, normal_count, values, &polygon))
+		{
+			case OBJ_LINE_POSITION: ++position_count; break;
+			case OBJ_LINE_TEXTURE_COORDINATES: ++texture_coordinates_count; break;
+			case OBJ_LINE_NORMAL: ++normal_count; break;
+			case OBJ_LINE_FACE: report->triangle_count += array_length(polygon) - 2; break;
+			case OBJ_LINE_INVALID: ++invalid_lines; break;
+			default: break;
+		}
+	}
+
+	// Files without normals get one smooth normal per position.
+	bool generate_normals = normal_count == 0;
+	u32 stored_normal_count = generate_normals ? position_count : normal_count;
+	u64 attribute_size = (u64)position_count * sizeof(vec3) + (u64)texture_coordinates_count * sizeof(vec2) +
+		(u64)stored_normal_count * sizeof(vec3);
+	u64 fixed_size = attribute_size + OBJ_STREAM_READ_BUFFER_SIZE;
+	u64 window_triangle_count = memory_limit > fixed_size ? (memory_limit - fixed_size) / OBJ_STREAM_BYTES_PER_TRIANGLE : 0;
+	if (window_triangle_count < OBJ_STREAM_MIN_WINDOW_TRIANGLES)
+	{
+		printf("Error streaming obj %s: a memory limit of at least %llu bytes is needed\n", obj_path,
+			(unsigned long long)(fixed_size + OBJ_STREAM_MIN_WINDOW_TRIANGLES * OBJ_STREAM_BYTES_PER_TRIANGLE));
+		array_free(polygon);
+		free(reader.buffer);
+		fclose(reader.file);
+		return false;
+	}
+	if (window_triangle_count > report->triangle_count)
+		window_triangle_count = report->triangle_count > 0 ? report->triangle_count : 1;
+	report->window_triangle_count = (u32)window_triangle_count;
+	report->memory_budget = fixed_size + window_triangle_count * OBJ_STREAM_BYTES_PER_TRIANGLE;
+
+	// Second pass: attributes.
+	Obj_Context ctx;
+	ctx.chunks = 0;
+	ctx.triangle_materials = 0;
+	ctx.position_count = ctx.texture_coordinates_count = ctx.normal_count = 0;
+	ctx.positions = (vec3*)malloc((u64)position_count * sizeof(vec3) + 1);
+	ctx.texture_coordinates = (vec2*)malloc((u64)texture_coordinates_count * sizeof(vec2) + 1);
+	ctx.normals = (vec3*)calloc((u64)stored_normal_count + 1, sizeof(vec3));
+	line_reader_rewind(&reader);
+	while (line_reader_next(&reader, &line, &line_end))
+	{
+		switch (parse_line(line, line_end, ctx.position_count, ctx.texture_coordinates_count, ctx.normal_count, values,
+			&polygon))
+		{
+			case OBJ_LINE_POSITION:
+				ctx.positions[ctx.position_count++] = (vec3){values[0], values[1], values[2]};
+				break;
+			case OBJ_LINE_TEXTURE_COORDINATES:
+				ctx.texture_coordinates[ctx.texture_coordinates_count++] = (vec2){values[0], values[1]};
+				break;
+			case OBJ_LINE_NORMAL:
+				ctx.normals[ctx.normal_count++] = (vec3){values[0], values[1], values[2]};
+				break;
+			default:
+				break;
+		}
+	}
+	if (generate_normals)
+		ctx.normal_count = position_count;
+
+	// Faces are read once more for the generated normals, and then in windows of at most window_triangle_count
+	// triangles, each of which is processed and emitted on its own.
+	ctx.corners = (Obj_Corner*)malloc(window_triangle_count * 3 * sizeof(Obj_Corner));
+	bool success = sink->begin(report->triangle_count * 3, sink->data);
+	for (u32 pass = generate_normals ? 0 : 1; pass < 2 && success; ++pass)
+	{
+		u32 window_corner_count = 0;
+		u32 line_position_count = 0, line_texture_coordinates_count = 0, line_normal_count = 0;
+		line_reader_rewind(&reader);
+		while (success && line_reader_next(&reader, &line, &line_end))
+		{
+			Obj_Line_Type type = parse_line(line, line_end, line_position_count, line_texture_coordinates_count,
+				line_normal_count, values, &polygon);
+			line_position_count += type == OBJ_LINE_POSITION;
+			line_texture_coordinates_count += type == OBJ_LINE_TEXTURE_COORDINATES;
+			line_normal_count += type == OBJ_LINE_NORMAL;
+			if (type != OBJ_LINE_FACE)
+				continue;
+
+			// Indices were resolved against the counts at this line, so they are global already.
+			// Invalid ones are counted in the last pass only.
+			u32 ignored_invalid_indices = 0;
+			u32* counted_invalid_indices = pass == 1 ? &invalid_indices : &ignored_invalid_indices;
+			for (u32 i = 0; i < array_length(polygon); ++i)
+			{
+				Obj_Corner* corner = &polygon[i];
+				corner->position = get_global_index(corner->position, 0, position_count, false, counted_invalid_indices);
+				corner->texture_coordinates = get_global_index(corner->texture_coordinates, 0, texture_coordinates_count,
+					false, counted_invalid_indices);
+				corner->normal = generate_normals ? corner->position :
+					get_global_index(corner->normal, 0, normal_count, false, counted_invalid_indices);
+			}
+
+			for (u32 i = 1; i + 1 < array_length(polygon) && success; ++i)
+			{
+				Obj_Corner triangle[3] = { polygon[0], polygon[i], polygon[i + 1] };
+				if (pass == 0)
+				{
+					accumulate_normals(&ctx, triangle, options->normals.weighting);
+					continue;
+				}
+
+				memcpy(ctx.corners + window_corner_count, triangle, sizeof(triangle));
+				window_corner_count += 3;
+				if (window_corner_count == window_triangle_count * 3)
+				{
+					success = emit_window(&ctx, window_corner_count, options, sink, report);
+					window_corner_count = 0;
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (u32 i = 0; i < position_count; ++i)
+			{
+				r32 length = gm_vec3_length(ctx.normals[i]);
+				if (length > 0.0f)
+					ctx.normals[i] = gm_vec3_scalar_product(1.0f / length, ctx.normals[i]);
+			}
+		}
+		else if (success && window_corner_count > 0)
+			success = emit_window(&ctx, window_corner_count, options, sink, report);
+	}
+
+	if (invalid_lines > 0 || invalid_indices > 0)
+		printf("Warning: %s has %u invalid lines and %u invalid indices\n", obj_path, invalid_lines, invalid_indices);
+
+	free(ctx.positions);
+	free(ctx.texture_coordinates);
+	free(ctx.normals);
+	free(ctx.corners);
+	array_free(polygon);
+	free(reader.buffer);
+	fclose(reader.file);
+
+	report->peak_resident_memory = util_get_peak_resident_memory();
+	return success;
 }
\ No newline at end of file
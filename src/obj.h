@@ -3,7 +3,78 @@
 
 #include "common.h"
 #include "graphics.h"
+#include "mesh/normals.h"
 
+typedef struct
+{
+	// Merge corners that share position, normal and texture coordinates into one vertex (see mesh/weld.h).
+	// Without it, every triangle gets three vertices of its own.
+	bool weld;
+	// 0 merges only identical attributes.
+	r32 weld_epsilon;
+	// Used when the file has no normals at all (see mesh/normals.h).
+	Mesh_Normals_Options normals;
+} Obj_Options;
+
+#define OBJ_MAX_PATH_LENGTH 256
+
+// Triangles using one material, which are contiguous in the index data.
+typedef struct
+{
+	u32 first_index;
+	u32 index_count;
+	// Kd, with the alpha from d (or 1 - Tr). Faces without a known material are white.
+	vec4 diffuse_color;
+	// map_Kd, relative to the working directory. Empty if the material has no diffuse map.
+	s8 diffuse_map_path[OBJ_MAX_PATH_LENGTH];
+} Obj_Submesh;
+
+// Material library named by an mtllib statement, relative to the working directory. It may not exist.
+typedef struct
+{
+	s8 path[OBJ_MAX_PATH_LENGTH];
+} Obj_Material_Library;
+
+Obj_Options obj_get_default_options();
 int obj_parse(const char* obj_path, Vertex** vertices, u32** indexes);
+int obj_parse_with_options(const char* obj_path, const Obj_Options* options, Vertex** vertices, u32** indexes);
+// Also loads the materials of the mtllib files and sorts the triangles by material, in order of first use. Files
+// without usemtl statements, or whose materials are not defined in any library, give no submeshes. submeshes is a
+// light_array. If material_libraries is not 0, it gets a light_array of the libraries that were looked up.
+int obj_parse_with_materials(const char* obj_path, const Obj_Options* options, Vertex** vertices, u32** indexes,
+	Obj_Submesh** submeshes, Obj_Material_Library** material_libraries);
+
+// Receives the output of obj_stream. Either function may return false to stop the import.
+typedef struct
+{
+	// Called once, before any block, with the number of indices that will be emitted in total.
+	bool (*begin)(u32 index_count, void* data);
+	// Indices refer to all vertices emitted so far, including the ones of this block.
+	bool (*emit)(const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count, void* data);
+	void* data;
+} Obj_Stream_Sink;
+
+typedef struct
+{
+	u32 window_count;
+	u32 window_triangle_count;
+	u32 triangle_count;
+	u32 vertex_count;
+	// Memory the import was planned to use: the attributes, the read buffer and one window.
+	u64 memory_budget;
+	// Of the whole process, measured when the import ends (see util_get_peak_resident_memory).
+	u64 peak_resident_memory;
+} Obj_Stream_Report;
+
+// Imports files that do not fit in memory as a whole. Only the attributes (positions, texture coordinates and
+// normals) are kept for the whole import; faces are read in windows sized to stay under memory_limit, and each
+// window is welded, gets tangents, is optimized and is emitted on its own. The file is read a few times, through a
+// fixed size buffer. Returns false if memory_limit cannot even hold the attributes and a minimal window.
+// Unlike obj_parse, vertices are not shared between windows and materials are ignored. Generated normals are smoothed
+// per position index of the file and options->normals.crease_angle is ignored, so hard edges come out smooth:
+// splitting normals at creases needs the faces around each position, which may be in any window, and keeping them
+// would grow with the face count, i.e. defeat the memory limit.
+bool obj_stream(const char* obj_path, const Obj_Options* options, u64 memory_limit, const Obj_Stream_Sink* sink,
+	Obj_Stream_Report* report);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "shader_cache.h"
+#include "util.h"
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHADER_CACHE_MAGIC 0x48435342	// "BSCH"
+#define SHADER_CACHE_VERSION 1
+
+#pragma pack(push, 1)
+typedef struct
+{
+	u32 magic;
+	u32 version;
+	u64 key;
+	u32 binary_format;
+	u32 binary_length;
+} Shader_Cache_Header;
+#pragma pack(pop)
+
+static s8* build_cache_file_path(s8* buffer, u64 key)
+{
+	sprintf(buffer, "%s/%016llx.bin", SHADER_CACHE_DIRECTORY, (unsigned long long)key);
+	return buffer;
+}
+
+bool shader_cache_is_supported()
+{
+	static s32 supported = -1;
+
+	if (supported == -1)
+	{
+		GLint number_of_formats = 0;
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &number_of_formats);
+		supported = number_of_formats > 0;
+	}
+
+	return supported;
+}
+
+u64 shader_cache_key(const s8* vertex_shader_code, const s8* fragment_shader_code, const s8* defines)
+{
+	const s8* vendor = (const s8*)glGetString(GL_VENDOR);
+	const s8* renderer = (const s8*)glGetString(GL_RENDERER);
+	const s8* version = (const s8*)glGetString(GL_VERSION);
+
+	// The terminators are hashed as well, so that moving text from one string to the next changes the key.
+	u64 key = UTIL_HASH_SEED;
+	key = util_hash(vertex_shader_code, strlen(vertex_shader_code) + 1, key);
+	key = util_hash(fragment_shader_code, strlen(fragment_shader_code) + 1, key);
+	if (defines)
+		key = util_hash(defines, strlen(defines) + 1, key);
+	if (vendor)
+		key = util_hash(vendor, strlen(vendor) + 1, key);
+	if (renderer)
+		key = util_hash(renderer, strlen(renderer) + 1, key);
+	if (version)
+		key = util_hash(version, strlen(version) + 1, key);
+
+	return key;
+}
+
+void shader_cache_prepare_program(u32 program)
+{
+	if (shader_cache_is_supported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+u32 shader_cache_load(u64 key)
+{
+	if (!shader_cache_is_supported())
+		return 0;
+
+	s8 path[256];
+	FILE* file = fopen(build_cache_file_path(path, key), "rb");
+	if (!file)
+		return 0;
+
+	Shader_Cache_Header header;
+	void* binary = 0;
+	bool valid = fread(&header, sizeof(Shader_Cache_Header), 1, file) == 1 &&
+		header.magic == SHADER_CACHE_MAGIC &&
+		header.version == SHADER_CACHE_VERSION &&
+		header.key == key &&
+		header.binary_length > 0;
+
+	if (valid)
+	{
+		binary = malloc(header.binary_length);
+		valid = fread(binary, header.binary_length, 1, file) == 1;
+	}
+
+	fclose(file);
+
+	GLuint program = 0;
+	if (valid)
+	{
+		program = glCreateProgram();
+		glProgramBinary(program, header.binary_format, binary, header.binary_length);
+
+		// Drivers are allowed to reject binaries at any time (e.g. after an update that kept the version string).
+		GLint success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glDeleteProgram(program);
+			program = 0;
+			valid = false;
+		}
+	}
+
+	free(binary);
+
+	if (!valid)
+	{
+		printf("Discarding stale shader cache entry %s\n", path);
+		remove(path);
+	}
+
+	return program;
+}
+
+void shader_cache_store(u64 key, u32 program)
+{
+	if (!shader_cache_is_supported())
+		return;
+
+	GLint binary_length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+	if (binary_length <= 0)
+		return;
+
+	if (!util_create_directory(SHADER_CACHE_DIRECTORY))
+	{
+		printf("Error creating shader cache directory %s\n", SHADER_CACHE_DIRECTORY);
+		return;
+	}
+
+	Shader_Cache_Header header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+
+	void* binary = malloc(binary_length);
+	GLsizei written_length = 0;
+	GLenum binary_format = 0;
+	glGetProgramBinary(program, binary_length, &written_length, &binary_format, binary);
+	header.binary_format = binary_format;
+	header.binary_length = written_length;
+
+	// Written aside and moved into place, so that other instances never load a partially written entry.
+	s8 path[256], temporary_path[256];
+	FILE* file = util_open_temporary_file(build_cache_file_path(path, key), temporary_path, sizeof(temporary_path));
+	bool success = file != 0;
+	if (file)
+	{
+		success = fwrite(&header, sizeof(Shader_Cache_Header), 1, file) == 1;
+		success = success && fwrite(binary, written_length, 1, file) == 1;
+		success = fclose(file) == 0 && success;
+		if (success)
+			success = util_replace_file(temporary_path, path);
+		else
+			remove(temporary_path);
+	}
+	if (!success)
+		printf("Error writing shader cache entry %s\n", path);
+
+	free(binary);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef BASIC_ENGINE_SHADER_CACHE_H
+#define BASIC_ENGINE_SHADER_CACHE_H
+#include "common.h"
+
+#define SHADER_CACHE_DIRECTORY "./cache/shaders"
+
+// Linked programs are persisted with glGetProgramBinary and restored with glProgramBinary on later launches.
+// The key covers the shader sources, the injected defines and the driver vendor/renderer/version strings,
+// so any of those changing simply produces a cache miss.
+bool shader_cache_is_supported();
+u64 shader_cache_key(const s8* vertex_shader_code, const s8* fragment_shader_code, const s8* defines);
+// Must be called before linking, otherwise some drivers will refuse to hand out the program binary.
+void shader_cache_prepare_program(u32 program);
+// Returns 0 if there is no valid binary for this key. Stale or rejected binaries are deleted from disk.
+u32 shader_cache_load(u64 key);
+void shader_cache_store(u64 key, u32 program);
+
+#endif
\ No newline at end of file
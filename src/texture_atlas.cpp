@@ -0,0 +1,140 @@
+#include "texture_atlas.h"
+#include <GL/glew.h>
+#include <light_array.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "vendor/imstb_rectpack.h"
+
+// Copies the image into the layer at (x, y), expanded to RGBA and surrounded by 'padding' texels repeating its edges.
+static void blit_padded(u8* layer, s32 layer_size, s32 x, s32 y, const Image_Data* image, s32 padding)
+{
+	for (s32 row = -padding; row < image->height + padding; ++row)
+	{
+		s32 image_y = row < 0 ? 0 : (row >= image->height ? image->height - 1 : row);
+		u8* out = layer + ((size_t)(y + padding + row) * layer_size + x) * 4;
+		for (s32 column = -padding; column < image->width + padding; ++column, out += 4)
+		{
+			s32 image_x = column < 0 ? 0 : (column >= image->width ? image->width - 1 : column);
+			const u8* texel = image->data + ((size_t)image_y * image->width + image_x) * image->channels;
+			switch (image->channels)
+			{
+				case 1: out[0] = texel[0]; out[1] = texel[0]; out[2] = texel[0]; out[3] = 255; break;
+				case 2: out[0] = texel[0]; out[1] = texel[0]; out[2] = texel[0]; out[3] = texel[1]; break;
+				case 3: out[0] = texel[0]; out[1] = texel[1]; out[2] = texel[2]; out[3] = 255; break;
+				default: out[0] = texel[0]; out[1] = texel[1]; out[2] = texel[2]; out[3] = texel[3]; break;
+			}
+		}
+	}
+}
+
+Texture_Atlas texture_atlas_create(const Image_Data* images, s32 image_count, s32 layer_size, s32 padding)
+{
+	Texture_Atlas atlas;
+	atlas.layer_size = layer_size;
+	atlas.layer_count = 0;
+	atlas.regions = array_new(Texture_Atlas_Region);
+
+	// Level n of the mip chain is only safe if rectangles start and end on multiples of 2^n (so no texel of that
+	// level covers two images) and if the padding is still at least one texel wide at that level.
+	s32 max_level = 0;
+	while ((2 << max_level) <= padding)
+		++max_level;
+	s32 alignment = 1 << max_level;
+
+	// Rectangles are packed in units of 'alignment' texels.
+	stbrp_rect* rects = (stbrp_rect*)malloc(image_count * sizeof(stbrp_rect));
+	s32 rect_count = 0;
+	for (s32 i = 0; i < image_count; ++i)
+	{
+		Texture_Atlas_Region region;
+		region.uv_offset = (vec2) { 0.0f, 0.0f };
+		region.uv_scale = (vec2) { 0.0f, 0.0f };
+		region.layer = -1;
+		array_push(atlas.regions, region);
+
+		s32 width = (images[i].width + 2 * padding + alignment - 1) / alignment;
+		s32 height = (images[i].height + 2 * padding + alignment - 1) / alignment;
+		if (width * alignment > layer_size || height * alignment > layer_size)
+		{
+			printf("Image %d (%dx%d) does not fit in a %dx%d texture atlas layer\n", i, images[i].width, images[i].height,
+				layer_size, layer_size);
+			continue;
+		}
+
+		rects[rect_count].id = i;
+		rects[rect_count].w = width;
+		rects[rect_count].h = height;
+		rects[rect_count].was_packed = 0;
+		++rect_count;
+	}
+
+	// One layer at a time, packing whatever did not fit in the previous ones.
+	s32 node_count = layer_size / alignment;
+	stbrp_node* nodes = (stbrp_node*)malloc(node_count * sizeof(stbrp_node));
+	u8* layers = 0;
+	s32 remaining = rect_count;
+	while (remaining > 0)
+	{
+		stbrp_context context;
+		stbrp_init_target(&context, node_count, node_count, nodes, node_count);
+		stbrp_pack_rects(&context, rects, remaining);
+
+		size_t layer_bytes = (size_t)layer_size * layer_size * 4;
+		layers = (u8*)realloc(layers, layer_bytes * (atlas.layer_count + 1));
+		u8* layer = layers + layer_bytes * atlas.layer_count;
+		memset(layer, 0, layer_bytes);
+
+		s32 not_packed = 0;
+		for (s32 i = 0; i < remaining; ++i)
+		{
+			if (!rects[i].was_packed)
+			{
+				rects[not_packed++] = rects[i];
+				continue;
+			}
+
+			const Image_Data* image = &images[rects[i].id];
+			s32 x = rects[i].x * alignment, y = rects[i].y * alignment;
+			blit_padded(layer, layer_size, x, y, image, padding);
+
+			Texture_Atlas_Region* region = &atlas.regions[rects[i].id];
+			region->uv_offset = (vec2) { (r32)(x + padding) / layer_size, (r32)(y + padding) / layer_size };
+			region->uv_scale = (vec2) { (r32)image->width / layer_size, (r32)image->height / layer_size };
+			region->layer = atlas.layer_count;
+		}
+
+		remaining = not_packed;
+		++atlas.layer_count;
+	}
+
+	free(nodes);
+	free(rects);
+
+	glGenTextures(1, &atlas.texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layer_size, layer_size, atlas.layer_count > 0 ? atlas.layer_count : 1, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, layers);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, max_level);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+	// No anisotropic filtering: its footprint is wider than the padding accounts for.
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	free(layers);
+
+	return atlas;
+}
+
+void texture_atlas_destroy(Texture_Atlas* atlas)
+{
+	glDeleteTextures(1, &atlas->texture);
+	array_free(atlas->regions);
+}
\ No newline at end of file
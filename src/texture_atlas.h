@@ -0,0 +1,25 @@
+#ifndef BASIC_ENGINE_TEXTURE_ATLAS_H
+#define BASIC_ENGINE_TEXTURE_ATLAS_H
+#include "graphics.h"
+
+#define TEXTURE_ATLAS_DEFAULT_LAYER_SIZE 2048
+#define TEXTURE_ATLAS_DEFAULT_PADDING 4
+
+typedef struct
+{
+	u32 texture;	// GL_TEXTURE_2D_ARRAY, RGBA8
+	s32 layer_size;
+	s32 layer_count;
+	// One per packed image, in the order they were given. Images that did not fit have layer -1.
+	Texture_Atlas_Region* regions;
+} Texture_Atlas;
+
+// Packs the images into as many layer_size x layer_size layers of a texture array as needed.
+// Each image is surrounded by 'padding' texels that repeat its edges, and image positions are aligned so that
+// mipmapping never blends neighbouring images: the mip chain stops at the level where the padding shrinks to one texel.
+// Texture coordinates must stay in [0, 1] (i.e. no repeating textures) and are remapped with
+// uv * region.uv_scale + region.uv_offset.
+Texture_Atlas texture_atlas_create(const Image_Data* images, s32 image_count, s32 layer_size, s32 padding);
+void texture_atlas_destroy(Texture_Atlas* atlas);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,438 @@
+#include "texture_compression.h"
+#include "jobs.h"
+#include <light_array.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSION_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define DDS_MAGIC 0x20534444	// "DDS "
+#define DDS_FOURCC(a, b, c, d) ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16) | ((u32)(d) << 24))
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+
+#pragma pack(push, 1)
+typedef struct
+{
+	u32 size;
+	u32 flags;
+	u32 four_cc;
+	u32 rgb_bit_count;
+	u32 bit_masks[4];
+} DDS_Pixel_Format;
+
+typedef struct
+{
+	u32 magic;
+	u32 size;
+	u32 flags;
+	u32 height;
+	u32 width;
+	u32 pitch_or_linear_size;
+	u32 depth;
+	u32 mip_map_count;
+	u32 reserved1[11];
+	DDS_Pixel_Format pixel_format;
+	u32 caps[4];
+	u32 reserved2;
+} DDS_Header;
+#pragma pack(pop)
+
+typedef struct
+{
+	const Image_Data* image;
+	Texture_Compression_Format format;
+	u8* output;
+	s32 blocks_x;
+} Compression_Job;
+
+u32 texture_compression_get_block_size(Texture_Compression_Format format)
+{
+	return format == TEXTURE_COMPRESSION_BC1 ? 8 : 16;
+}
+
+// Copies a 4x4 block as RGBA. Texels outside the image repeat the last row/column.
+static void gather_block(const Image_Data* image, s32 block_x, s32 block_y, u8 block[64])
+{
+	for (s32 y = 0; y < 4; ++y)
+	{
+		s32 image_y = block_y * 4 + y < image->height ? block_y * 4 + y : image->height - 1;
+		for (s32 x = 0; x < 4; ++x)
+		{
+			s32 image_x = block_x * 4 + x < image->width ? block_x * 4 + x : image->width - 1;
+			const u8* texel = image->data + ((size_t)image_y * image->width + image_x) * image->channels;
+			u8* out = block + (y * 4 + x) * 4;
+			switch (image->channels)
+			{
+				case 1: out[0] = texel[0]; out[1] = texel[0]; out[2] = texel[0]; out[3] = 255; break;
+				case 2: out[0] = texel[0]; out[1] = texel[1]; out[2] = 0; out[3] = 255; break;
+				case 3: out[0] = texel[0]; out[1] = texel[1]; out[2] = texel[2]; out[3] = 255; break;
+				default: out[0] = texel[0]; out[1] = texel[1]; out[2] = texel[2]; out[3] = texel[3]; break;
+			}
+		}
+	}
+}
+
+static void block_get_min_max(const u8 block[64], u8 min[4], u8 max[4])
+{
+#ifdef TEXTURE_COMPRESSION_USE_SSE2
+	__m128i row0 = _mm_loadu_si128((const __m128i*)(block + 0));
+	__m128i row1 = _mm_loadu_si128((const __m128i*)(block + 16));
+	__m128i row2 = _mm_loadu_si128((const __m128i*)(block + 32));
+	__m128i row3 = _mm_loadu_si128((const __m128i*)(block + 48));
+	__m128i block_min = _mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+	__m128i block_max = _mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+	// Reduce the four texels left in each register.
+	block_min = _mm_min_epu8(block_min, _mm_shuffle_epi32(block_min, _MM_SHUFFLE(1, 0, 3, 2)));
+	block_min = _mm_min_epu8(block_min, _mm_shuffle_epi32(block_min, _MM_SHUFFLE(2, 3, 0, 1)));
+	block_max = _mm_max_epu8(block_max, _mm_shuffle_epi32(block_max, _MM_SHUFFLE(1, 0, 3, 2)));
+	block_max = _mm_max_epu8(block_max, _mm_shuffle_epi32(block_max, _MM_SHUFFLE(2, 3, 0, 1)));
+	s32 packed_min = _mm_cvtsi128_si32(block_min);
+	s32 packed_max = _mm_cvtsi128_si32(block_max);
+	memcpy(min, &packed_min, 4);
+	memcpy(max, &packed_max, 4);
+#else
+	for (s32 c = 0; c < 4; ++c)
+	{
+		min[c] = 255;
+		max[c] = 0;
+	}
+	for (s32 i = 0; i < 16; ++i)
+	{
+		for (s32 c = 0; c < 4; ++c)
+		{
+			if (block[i * 4 + c] < min[c]) min[c] = block[i * 4 + c];
+			if (block[i * 4 + c] > max[c]) max[c] = block[i * 4 + c];
+		}
+	}
+#endif
+}
+
+// dots[i] = dot(texel_i.rgb - origin, direction)
+static void block_project(const u8 block[64], const s32 origin[3], const s32 direction[3], s32 dots[16])
+{
+#ifdef TEXTURE_COMPRESSION_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i origin_16 = _mm_setr_epi16((s16)origin[0], (s16)origin[1], (s16)origin[2], 0,
+		(s16)origin[0], (s16)origin[1], (s16)origin[2], 0);
+	__m128i direction_16 = _mm_setr_epi16((s16)direction[0], (s16)direction[1], (s16)direction[2], 0,
+		(s16)direction[0], (s16)direction[1], (s16)direction[2], 0);
+	for (s32 i = 0; i < 4; ++i)
+	{
+		__m128i texels = _mm_loadu_si128((const __m128i*)(block + i * 16));
+		__m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(texels, zero), origin_16);
+		__m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(texels, zero), origin_16);
+		// (r*dr + g*dg, b*db) per texel, then the two halves are added together.
+		low = _mm_madd_epi16(low, direction_16);
+		high = _mm_madd_epi16(high, direction_16);
+		low = _mm_add_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+		high = _mm_add_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+		__m128i result = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high),
+			_MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_si128((__m128i*)(dots + i * 4), result);
+	}
+#else
+	for (s32 i = 0; i < 16; ++i)
+		dots[i] = (block[i * 4 + 0] - origin[0]) * direction[0] +
+			(block[i * 4 + 1] - origin[1]) * direction[1] +
+			(block[i * 4 + 2] - origin[2]) * direction[2];
+#endif
+}
+
+static u16 color_to_565(const u8 color[3])
+{
+	return (u16)((((color[0] * 31 + 127) / 255) << 11) | (((color[1] * 63 + 127) / 255) << 5) | ((color[2] * 31 + 127) / 255));
+}
+
+static void color_from_565(u16 color, s32 result[3])
+{
+	s32 r = (color >> 11) & 0x1F, g = (color >> 5) & 0x3F, b = color & 0x1F;
+	result[0] = (r << 3) | (r >> 2);
+	result[1] = (g << 2) | (g >> 4);
+	result[2] = (b << 3) | (b >> 2);
+}
+
+// Bounding box endpoints, as in "Real-Time DXT Compression" (van Waveren). Always uses the 4-color mode.
+static void encode_color_block(const u8 block[64], const u8 block_min[4], const u8 block_max[4], u8* output)
+{
+	u8 min[3], max[3];
+	s32 center[3];
+	for (s32 c = 0; c < 3; ++c)
+	{
+		// Inset the box a bit, the extremes are rarely the best endpoints.
+		s32 inset = (block_max[c] - block_min[c]) >> 4;
+		min[c] = (u8)(block_min[c] + inset);
+		max[c] = (u8)(block_max[c] - inset);
+		center[c] = (block_min[c] + block_max[c] + 1) / 2;
+	}
+
+	// The box diagonal from min to max only fits positively correlated channels. Flip red and blue if they go against green.
+	s32 covariance_rg = 0, covariance_bg = 0;
+	for (s32 i = 0; i < 16; ++i)
+	{
+		s32 g = block[i * 4 + 1] - center[1];
+		covariance_rg += (block[i * 4 + 0] - center[0]) * g;
+		covariance_bg += (block[i * 4 + 2] - center[2]) * g;
+	}
+	if (covariance_rg < 0) { u8 t = min[0]; min[0] = max[0]; max[0] = t; }
+	if (covariance_bg < 0) { u8 t = min[2]; min[2] = max[2]; max[2] = t; }
+
+	u16 color0 = color_to_565(max);
+	u16 color1 = color_to_565(min);
+	u32 indices = 0;
+
+	if (color0 < color1)
+	{
+		u16 t = color0; color0 = color1; color1 = t;
+	}
+
+	if (color0 != color1)
+	{
+		s32 endpoint0[3], endpoint1[3], direction[3];
+		color_from_565(color0, endpoint0);
+		color_from_565(color1, endpoint1);
+		for (s32 c = 0; c < 3; ++c)
+			direction[c] = endpoint0[c] - endpoint1[c];
+		s32 length_squared = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+
+		s32 dots[16];
+		block_project(block, endpoint1, direction, dots);
+
+		// Position along the segment (0 = color1, 3 = color0) to palette index.
+		static const u32 index_from_step[4] = { 1, 3, 2, 0 };
+		for (s32 i = 0; i < 16; ++i)
+		{
+			s32 step = dots[i] <= 0 ? 0 : (dots[i] * 3 + length_squared / 2) / length_squared;
+			if (step > 3) step = 3;
+			indices |= index_from_step[step] << (2 * i);
+		}
+	}
+
+	output[0] = (u8)(color0 & 0xFF);
+	output[1] = (u8)(color0 >> 8);
+	output[2] = (u8)(color1 & 0xFF);
+	output[3] = (u8)(color1 >> 8);
+	memcpy(output + 4, &indices, 4);
+}
+
+// BC4 block (BC3 alpha, BC5 red/green) for one channel of the block. Always uses the 8-value mode.
+static void encode_channel_block(const u8 block[64], s32 channel, u8 min, u8 max, u8* output)
+{
+	output[0] = max;
+	output[1] = min;
+
+	u64 indices = 0;
+	s32 range = max - min;
+	if (range > 0)
+	{
+		for (s32 i = 0; i < 16; ++i)
+		{
+			// Position along the segment (0 = max, 7 = min) to palette index.
+			s32 step = ((max - block[i * 4 + channel]) * 7 + range / 2) / range;
+			u64 index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+			indices |= index << (3 * i);
+		}
+	}
+
+	for (s32 i = 0; i < 6; ++i)
+		output[2 + i] = (u8)(indices >> (8 * i));
+}
+
+static void compress_block_rows(void* data, s32 begin, s32 end, s32 chunk_index)
+{
+	Compression_Job* job = (Compression_Job*)data;
+	u32 block_size = texture_compression_get_block_size(job->format);
+
+	u8 block[64], min[4], max[4];
+	for (s32 block_y = begin; block_y < end; ++block_y)
+	{
+		u8* output = job->output + (size_t)block_y * job->blocks_x * block_size;
+		for (s32 block_x = 0; block_x < job->blocks_x; ++block_x, output += block_size)
+		{
+			gather_block(job->image, block_x, block_y, block);
+			block_get_min_max(block, min, max);
+			switch (job->format)
+			{
+				case TEXTURE_COMPRESSION_BC1:
+					encode_color_block(block, min, max, output);
+					break;
+				case TEXTURE_COMPRESSION_BC3:
+					encode_channel_block(block, 3, min[3], max[3], output);
+					encode_color_block(block, min, max, output + 8);
+					break;
+				case TEXTURE_COMPRESSION_BC5:
+					encode_channel_block(block, 0, min[0], max[0], output);
+					encode_channel_block(block, 1, min[1], max[1], output + 8);
+					break;
+			}
+		}
+	}
+}
+
+static u32 get_level_size(Texture_Compression_Format format, s32 width, s32 height)
+{
+	return (u32)((width + 3) / 4) * (u32)((height + 3) / 4) * texture_compression_get_block_size(format);
+}
+
+static Compressed_Image_Level compress_level(const Image_Data* image, Texture_Compression_Format format)
+{
+	Compressed_Image_Level level;
+	level.width = image->width;
+	level.height = image->height;
+	level.size = get_level_size(format, image->width, image->height);
+	level.data = (u8*)malloc(level.size);
+
+	Compression_Job job;
+	job.image = image;
+	job.format = format;
+	job.output = level.data;
+	job.blocks_x = (image->width + 3) / 4;
+	jobs_parallel_for((image->height + 3) / 4, 4, compress_block_rows, &job);
+
+	return level;
+}
+
+Compressed_Image_Data texture_compression_compress(const Image_Data* levels, Texture_Compression_Format format)
+{
+	Compressed_Image_Data result;
+	result.format = format;
+	result.levels = array_new(Compressed_Image_Level);
+
+	for (u32 i = 0; i < array_length(levels); ++i)
+	{
+		Compressed_Image_Level level = compress_level(&levels[i], format);
+		array_push(result.levels, level);
+	}
+
+	return result;
+}
+
+static bool format_to_four_cc(Texture_Compression_Format format, u32* four_cc)
+{
+	switch (format)
+	{
+		case TEXTURE_COMPRESSION_BC1: *four_cc = DDS_FOURCC('D', 'X', 'T', '1'); return true;
+		case TEXTURE_COMPRESSION_BC3: *four_cc = DDS_FOURCC('D', 'X', 'T', '5'); return true;
+		case TEXTURE_COMPRESSION_BC5: *four_cc = DDS_FOURCC('A', 'T', 'I', '2'); return true;
+	}
+	return false;
+}
+
+static bool four_cc_to_format(u32 four_cc, Texture_Compression_Format* format)
+{
+	if (four_cc == DDS_FOURCC('D', 'X', 'T', '1'))
+		*format = TEXTURE_COMPRESSION_BC1;
+	else if (four_cc == DDS_FOURCC('D', 'X', 'T', '5'))
+		*format = TEXTURE_COMPRESSION_BC3;
+	else if (four_cc == DDS_FOURCC('A', 'T', 'I', '2') || four_cc == DDS_FOURCC('B', 'C', '5', 'U'))
+		*format = TEXTURE_COMPRESSION_BC5;
+	else
+		return false;
+	return true;
+}
+
+bool texture_compression_save(const s8* path, const Compressed_Image_Data* image_data)
+{
+	u32 level_count = array_length(image_data->levels);
+	if (level_count == 0)
+		return false;
+
+	DDS_Header header;
+	memset(&header, 0, sizeof(DDS_Header));
+	header.magic = DDS_MAGIC;
+	header.size = sizeof(DDS_Header) - sizeof(u32);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.height = image_data->levels[0].height;
+	header.width = image_data->levels[0].width;
+	header.pitch_or_linear_size = image_data->levels[0].size;
+	header.mip_map_count = level_count;
+	header.pixel_format.size = sizeof(DDS_Pixel_Format);
+	header.pixel_format.flags = DDPF_FOURCC;
+	format_to_four_cc(image_data->format, &header.pixel_format.four_cc);
+	header.caps[0] = DDSCAPS_TEXTURE | (level_count > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Error writing compressed texture %s\n", path);
+		return false;
+	}
+
+	bool success = fwrite(&header, sizeof(DDS_Header), 1, file) == 1;
+	for (u32 i = 0; success && i < level_count; ++i)
+		success = fwrite(image_data->levels[i].data, image_data->levels[i].size, 1, file) == 1;
+	fclose(file);
+
+	if (!success)
+		printf("Error writing compressed texture %s\n", path);
+
+	return success;
+}
+
+Compressed_Image_Data texture_compression_load(const s8* path)
+{
+	Compressed_Image_Data result;
+	result.format = TEXTURE_COMPRESSION_BC1;
+	result.levels = array_new(Compressed_Image_Level);
+
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("Error loading compressed texture %s\n", path);
+		return result;
+	}
+
+	DDS_Header header;
+	bool valid = fread(&header, sizeof(DDS_Header), 1, file) == 1 &&
+		header.magic == DDS_MAGIC &&
+		header.size == sizeof(DDS_Header) - sizeof(u32) &&
+		(header.pixel_format.flags & DDPF_FOURCC) &&
+		four_cc_to_format(header.pixel_format.four_cc, &result.format) &&
+		header.width > 0 && header.height > 0;
+
+	u32 level_count = (header.flags & DDSD_MIPMAPCOUNT) && header.mip_map_count > 0 ? header.mip_map_count : 1;
+	s32 width = header.width, height = header.height;
+	for (u32 i = 0; valid && i < level_count; ++i)
+	{
+		Compressed_Image_Level level;
+		level.width = width;
+		level.height = height;
+		level.size = get_level_size(result.format, width, height);
+		level.data = (u8*)malloc(level.size);
+		array_push(result.levels, level);
+		valid = fread(level.data, level.size, 1, file) == 1;
+
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		printf("Error loading compressed texture %s: unsupported or corrupted file\n", path);
+		texture_compression_free(&result);
+		result.levels = array_new(Compressed_Image_Level);
+	}
+
+	return result;
+}
+
+void texture_compression_free(Compressed_Image_Data* image_data)
+{
+	for (u32 i = 0; i < array_length(image_data->levels); ++i)
+		free(image_data->levels[i].data);
+	array_free(image_data->levels);
+}
\ No newline at end of file
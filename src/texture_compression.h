@@ -0,0 +1,36 @@
+#ifndef BASIC_ENGINE_TEXTURE_COMPRESSION_H
+#define BASIC_ENGINE_TEXTURE_COMPRESSION_H
+#include "graphics.h"
+
+typedef enum {
+	TEXTURE_COMPRESSION_BC1,	// RGB, 8 bytes per 4x4 block. Alpha is dropped.
+	TEXTURE_COMPRESSION_BC3,	// RGBA, 16 bytes per 4x4 block.
+	TEXTURE_COMPRESSION_BC5		// RG, 16 bytes per 4x4 block. For tangent space normal maps, z is rebuilt when sampling.
+} Texture_Compression_Format;
+
+typedef struct
+{
+	u8* data;
+	s32 width, height;
+	u32 size;
+} Compressed_Image_Level;
+
+typedef struct Compressed_Image_Data
+{
+	Texture_Compression_Format format;
+	// Level 0 first. Empty if loading or compressing failed.
+	Compressed_Image_Level* levels;
+} Compressed_Image_Data;
+
+#define TEXTURE_COMPRESSION_FILE_EXTENSION ".dds"
+
+u32 texture_compression_get_block_size(Texture_Compression_Format format);
+// Compresses every level of a mip chain (see mipmap.h) on the job workers.
+// Images with 1, 2 or 3 channels are expanded as (r,r,r,255), (r,g,0,255) and (r,g,b,255).
+Compressed_Image_Data texture_compression_compress(const Image_Data* levels, Texture_Compression_Format format);
+// Compressed images are stored as DDS files (FourCC DXT1, DXT5 and ATI2), which most texture tools can open.
+bool texture_compression_save(const s8* path, const Compressed_Image_Data* image_data);
+Compressed_Image_Data texture_compression_load(const s8* path);
+void texture_compression_free(Compressed_Image_Data* image_data);
+
+#endif
\ No newline at end of file
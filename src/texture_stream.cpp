@@ -0,0 +1,397 @@
+#include "texture_stream.h"
+#include "graphics.h"
+#include "jobs.h"
+#include "mipmap.h"
+#include <GL/glew.h>
+#include <light_array.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+typedef enum {
+	TEXTURE_STREAM_DECODING,
+	TEXTURE_STREAM_DECODED,
+	TEXTURE_STREAM_FAILED,
+	TEXTURE_STREAM_STREAMING,
+	TEXTURE_STREAM_LOADING_LEVEL,
+	TEXTURE_STREAM_LEVEL_LOADED
+} Texture_Stream_State;
+
+typedef struct {
+	u32 texture;
+	s8* path;
+	Texture_Usage usage;
+	// Mip chain, level 0 first. Only the dimensions are kept: the data of the levels finer than the tail is dropped
+	// after decoding, and the tail's once it is uploaded.
+	Image_Data* mips;
+	// Level read by the worker in the TEXTURE_STREAM_LOADING_LEVEL state, and kept until it is fully uploaded.
+	s32 loading_level;
+	Image_Data level_data;
+	// Levels finer than this could not be loaded again, so they are not requested anymore.
+	s32 finest_level;
+	// Written by the worker when decoding or loading a level ends, everything else is only touched by the render
+	// thread while no job is running.
+	std::atomic<s32> state;
+	bool cancelled;
+	u32 format;
+	u32 internal_format;
+	s32 tail_level;
+	s32 resident_level;
+	// Level being uploaded (-1 if none) and the next row of it to upload.
+	s32 uploading_level;
+	s32 next_row;
+	// Finest level requested since the last update.
+	s32 requested_level;
+	u64 last_detail_request_frame;
+} Texture_Stream;
+
+typedef struct {
+	Texture_Stream** streams;
+	u32 pbo;
+	u64 frame;
+	bool initialized;
+} Texture_Stream_Ctx;
+
+static Texture_Stream_Ctx stream_ctx;
+
+static const u8 placeholder_color[4] = { 128, 128, 128, 255 };
+
+static void init_texture_stream()
+{
+	if (!stream_ctx.initialized)
+	{
+		stream_ctx.streams = array_new(Texture_Stream*);
+		glGenBuffers(1, &stream_ctx.pbo);
+		stream_ctx.frame = 0;
+		stream_ctx.initialized = true;
+	}
+}
+
+static s32 get_tail_level(const Image_Data* mips)
+{
+	s32 tail_level = array_length(mips) - 1;
+	while (tail_level > 0 &&
+		mips[tail_level - 1].width <= TEXTURE_STREAM_MIP_TAIL_SIZE &&
+		mips[tail_level - 1].height <= TEXTURE_STREAM_MIP_TAIL_SIZE)
+		--tail_level;
+	return tail_level;
+}
+
+static void decode_job(void* data)
+{
+	Texture_Stream* stream = (Texture_Stream*)data;
+	stream->mips = graphics_image_load_with_mips(stream->path, stream->usage);
+	if (stream->mips)
+	{
+		stream->tail_level = get_tail_level(stream->mips);
+		for (s32 level = 0; level < stream->tail_level; ++level)
+		{
+			free(stream->mips[level].data);
+			stream->mips[level].data = 0;
+		}
+	}
+	stream->state = stream->mips ? TEXTURE_STREAM_DECODED : TEXTURE_STREAM_FAILED;
+}
+
+static void load_level_job(void* data)
+{
+	Texture_Stream* stream = (Texture_Stream*)data;
+	stream->level_data = graphics_image_load_mip_level(stream->path, stream->usage, stream->loading_level);
+	stream->state = TEXTURE_STREAM_LEVEL_LOADED;
+}
+
+static void stream_free(Texture_Stream* stream)
+{
+	if (stream->mips)
+		mipmap_free(stream->mips);
+	free(stream->level_data.data);
+	free(stream->path);
+	delete stream;
+}
+
+static Texture_Stream* find_stream(u32 texture)
+{
+	if (!stream_ctx.initialized)
+		return 0;
+
+	for (u32 i = 0; i < array_length(stream_ctx.streams); ++i)
+		if (stream_ctx.streams[i]->texture == texture && !stream_ctx.streams[i]->cancelled)
+			return stream_ctx.streams[i];
+
+	return 0;
+}
+
+u32 texture_stream_create(const s8* texture_path, Texture_Usage usage)
+{
+	init_texture_stream();
+
+	u32 texture_id;
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder_color);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+
+	// Anisotropic Filtering
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4.0f);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	Texture_Stream* stream = new Texture_Stream;
+	stream->texture = texture_id;
+	stream->path = strdup(texture_path);
+	stream->usage = usage;
+	stream->mips = 0;
+	stream->loading_level = -1;
+	stream->level_data.data = 0;
+	stream->finest_level = 0;
+	stream->state = TEXTURE_STREAM_DECODING;
+	stream->cancelled = false;
+	stream->tail_level = 0;
+	stream->resident_level = -1;
+	stream->uploading_level = -1;
+	stream->next_row = 0;
+	stream->requested_level = 0x7FFFFFFF;
+	stream->last_detail_request_frame = 0;
+	array_push(stream_ctx.streams, stream);
+
+	jobs_submit(decode_job, stream);
+
+	return texture_id;
+}
+
+static void set_resident_level(Texture_Stream* stream, s32 level)
+{
+	stream->resident_level = level;
+	glBindTexture(GL_TEXTURE_2D, stream->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, array_length(stream->mips) - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Uploads every level of the mip tail at once. They are small, so this does not go through the budget.
+static s32 upload_mip_tail(Texture_Stream* stream)
+{
+	s32 level_count = array_length(stream->mips);
+	Texture_Format texture_format = graphics_texture_choose_format(stream->mips[0].channels, stream->usage);
+	stream->internal_format = texture_format.internal_format;
+	stream->format = texture_format.format;
+
+	s32 uploaded_size = 0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_2D, stream->texture);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, texture_format.swizzle);
+	for (s32 level = stream->tail_level; level < level_count; ++level)
+	{
+		Image_Data* mip = &stream->mips[level];
+		glTexImage2D(GL_TEXTURE_2D, level, stream->internal_format, mip->width, mip->height, 0,
+			stream->format, GL_UNSIGNED_BYTE, mip->data);
+		uploaded_size += mip->width * mip->height * mip->channels;
+		free(mip->data);
+		mip->data = 0;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	set_resident_level(stream, stream->tail_level);
+	stream->last_detail_request_frame = stream_ctx.frame;
+	return uploaded_size;
+}
+
+static void begin_level_upload(Texture_Stream* stream, s32 level)
+{
+	const Image_Data* mip = &stream->level_data;
+	glBindTexture(GL_TEXTURE_2D, stream->texture);
+	glTexImage2D(GL_TEXTURE_2D, level, stream->internal_format, mip->width, mip->height, 0, stream->format, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	stream->uploading_level = level;
+	stream->next_row = 0;
+}
+
+// Uploads up to upload_budget bytes (at least one row) of the level being streamed. Returns the number of bytes uploaded.
+static s32 upload_rows(Texture_Stream* stream, s32 upload_budget)
+{
+	const Image_Data* mip = &stream->level_data;
+	s32 row_size = mip->width * mip->channels;
+	s32 row_count = upload_budget / row_size;
+	if (row_count < 1)
+		row_count = 1;
+	if (row_count > mip->height - stream->next_row)
+		row_count = mip->height - stream->next_row;
+	s32 slice_size = row_count * row_size;
+
+	// Orphaning the buffer lets the driver hand out fresh memory while the previous slice is still being transferred.
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream_ctx.pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, slice_size, 0, GL_STREAM_DRAW);
+	void* pbo_data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slice_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (pbo_data)
+	{
+		memcpy(pbo_data, mip->data + (size_t)stream->next_row * row_size, slice_size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D, stream->texture);
+		glTexSubImage2D(GL_TEXTURE_2D, stream->uploading_level, 0, stream->next_row, mip->width, row_count,
+			stream->format, GL_UNSIGNED_BYTE, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		stream->next_row += row_count;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (stream->next_row == mip->height)
+	{
+		set_resident_level(stream, stream->uploading_level);
+		stream->uploading_level = -1;
+		free(stream->level_data.data);
+		stream->level_data.data = 0;
+	}
+
+	return slice_size;
+}
+
+// Drops the finest resident level. Levels below GL_TEXTURE_BASE_LEVEL do not take part in texture completeness,
+// so redefining the level with a zero size releases its memory without affecting sampling.
+static void evict_finest_level(Texture_Stream* stream)
+{
+	s32 level = stream->resident_level;
+	set_resident_level(stream, level + 1);
+	glBindTexture(GL_TEXTURE_2D, stream->texture);
+	glTexImage2D(GL_TEXTURE_2D, level, stream->internal_format, 0, 0, 0, stream->format, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void texture_stream_update(s32 upload_budget)
+{
+	if (!stream_ctx.initialized)
+		return;
+
+	++stream_ctx.frame;
+
+	// Streams are served in creation order.
+	for (u32 i = 0; i < array_length(stream_ctx.streams);)
+	{
+		Texture_Stream* stream = stream_ctx.streams[i];
+		s32 state = stream->state;
+
+		// The worker owns the stream until its job ends.
+		if (state == TEXTURE_STREAM_DECODING || state == TEXTURE_STREAM_LOADING_LEVEL)
+		{
+			++i;
+			continue;
+		}
+
+		if (stream->cancelled || state == TEXTURE_STREAM_FAILED)
+		{
+			stream_free(stream);
+			array_remove_ordered(stream_ctx.streams, i);
+			continue;
+		}
+
+		if (state == TEXTURE_STREAM_DECODED)
+		{
+			upload_budget -= upload_mip_tail(stream);
+			stream->state = TEXTURE_STREAM_STREAMING;
+		}
+
+		if (state == TEXTURE_STREAM_LEVEL_LOADED)
+		{
+			if (stream->level_data.data)
+				begin_level_upload(stream, stream->loading_level);
+			else
+			{
+				printf("Error loading mip level %d of texture %s\n", stream->loading_level, stream->path);
+				stream->finest_level = stream->loading_level + 1;
+			}
+			stream->loading_level = -1;
+			stream->state = TEXTURE_STREAM_STREAMING;
+		}
+
+		s32 requested_level = stream->requested_level;
+		stream->requested_level = 0x7FFFFFFF;
+
+		if (requested_level <= stream->resident_level)
+			stream->last_detail_request_frame = stream_ctx.frame;
+
+		if (stream->uploading_level == -1 && requested_level < stream->resident_level &&
+			stream->resident_level > stream->finest_level)
+		{
+			stream->loading_level = stream->resident_level - 1;
+			stream->state = TEXTURE_STREAM_LOADING_LEVEL;
+			jobs_submit(load_level_job, stream);
+		}
+		else if (stream->uploading_level == -1 && stream->resident_level < stream->tail_level &&
+			stream_ctx.frame - stream->last_detail_request_frame > TEXTURE_STREAM_EVICTION_FRAMES)
+		{
+			evict_finest_level(stream);
+			// Give the next level a full window as well.
+			stream->last_detail_request_frame = stream_ctx.frame;
+		}
+
+		if (stream->uploading_level != -1 && upload_budget > 0)
+			upload_budget -= upload_rows(stream, upload_budget);
+
+		++i;
+	}
+}
+
+void texture_stream_request(u32 texture, r32 screen_size)
+{
+	Texture_Stream* stream = find_stream(texture);
+	if (!stream || stream->resident_level == -1)
+		return;
+
+	// One texel per pixel along the largest dimension.
+	s32 level_count = array_length(stream->mips);
+	s32 size = stream->mips[0].width > stream->mips[0].height ? stream->mips[0].width : stream->mips[0].height;
+	s32 level = screen_size >= 1.0f ? (s32)floorf(log2f((r32)size / screen_size)) : level_count - 1;
+	if (level < 0)
+		level = 0;
+	if (level > level_count - 1)
+		level = level_count - 1;
+
+	if (level < stream->requested_level)
+		stream->requested_level = level;
+}
+
+bool texture_stream_is_resident(u32 texture)
+{
+	Texture_Stream* stream = find_stream(texture);
+	return !stream || stream->resident_level != -1;
+}
+
+s32 texture_stream_get_resident_level(u32 texture)
+{
+	Texture_Stream* stream = find_stream(texture);
+	return stream ? stream->resident_level : -1;
+}
+
+void texture_stream_cancel(u32 texture)
+{
+	Texture_Stream* stream = find_stream(texture);
+	if (stream)
+		stream->cancelled = true;
+}
+
+void texture_stream_destroy()
+{
+	if (!stream_ctx.initialized)
+		return;
+
+	for (u32 i = 0; i < array_length(stream_ctx.streams); ++i)
+	{
+		Texture_Stream* stream = stream_ctx.streams[i];
+		while (stream->state == TEXTURE_STREAM_DECODING || stream->state == TEXTURE_STREAM_LOADING_LEVEL)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		stream_free(stream);
+	}
+
+	array_free(stream_ctx.streams);
+	glDeleteBuffers(1, &stream_ctx.pbo);
+	stream_ctx.initialized = false;
+}
\ No newline at end of file
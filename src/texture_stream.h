@@ -0,0 +1,37 @@
+#ifndef BASIC_ENGINE_TEXTURE_STREAM_H
+#define BASIC_ENGINE_TEXTURE_STREAM_H
+#include "graphics.h"
+
+// Default amount of texture data uploaded per frame by texture_stream_update.
+#define TEXTURE_STREAM_DEFAULT_UPLOAD_BUDGET (4 * 1024 * 1024)
+// Mip levels whose largest dimension is at most this size form the mip tail, which is uploaded as soon as the
+// image is decoded.
+#define TEXTURE_STREAM_MIP_TAIL_SIZE 64
+// Number of frames the finest resident mip level may go without being requested before it is evicted.
+#define TEXTURE_STREAM_EVICTION_FRAMES 300
+
+// Asynchronous, mip-level granular texture streaming.
+// The image is decoded and its mip chain built on a worker thread. The small mip tail is uploaded first; finer levels
+// are only streamed in (coarse to fine, through a pixel buffer object and under a per-frame budget) once something
+// requests them via texture_stream_request, and are evicted again when they stop being requested.
+// No level is kept in system memory once it is on the GPU: each finer level is read again on a worker thread when
+// it is needed, from the mip chain cache (see graphics_image_load_with_mips).
+// GL_TEXTURE_BASE_LEVEL always points at the finest level that is fully resident.
+// The returned texture can be used right away: it samples as a 1x1 gray placeholder until the mip tail is resident.
+u32 texture_stream_create(const s8* texture_path, Texture_Usage usage);
+// Streams pending mip levels and evicts unused ones, spending at most upload_budget bytes.
+// Must be called once per frame by the render thread.
+void texture_stream_update(s32 upload_budget);
+// Tells the streamer that the texture is being drawn covering roughly screen_size pixels (along its largest
+// dimension), which determines the mip level it needs. Must be called every frame the texture is drawn.
+void texture_stream_request(u32 texture, r32 screen_size);
+// True once the texture holds real data (i.e. at least its mip tail). Also true for textures not created here.
+bool texture_stream_is_resident(u32 texture);
+// Finest mip level currently resident, or -1 if the texture is not streamed or still showing its placeholder.
+s32 texture_stream_get_resident_level(u32 texture);
+// Stops streaming into the texture and releases its data. Called by graphics_texture_delete.
+void texture_stream_cancel(u32 texture);
+// Waits for in-flight decodes and releases all streaming resources.
+void texture_stream_destroy();
+
+#endif
\ No newline at end of file
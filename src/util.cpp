@@ -1,6 +1,20 @@
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -40,6 +54,162 @@ void util_free_file(s8* file)
 	free(file);
 }
 
+#ifdef _WIN32
+const u8* util_map_file(const s8* path, u64* file_size)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return 0;
+	}
+
+	// The view keeps the mapping alive, so both handles can be closed right away.
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+	if (!mapping)
+		return 0;
+	const u8* data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return 0;
+
+	*file_size = size.QuadPart;
+	return data;
+}
+
+void util_unmap_file(const u8* data, u64 file_size)
+{
+	UnmapViewOfFile(data);
+}
+#else
+const u8* util_map_file(const s8* path, u64* file_size)
+{
+	s32 file = open(path, O_RDONLY);
+	if (file < 0)
+		return 0;
+
+	struct stat file_info;
+	if (fstat(file, &file_info) || file_info.st_size == 0)
+	{
+		close(file);
+		return 0;
+	}
+
+	// The mapping stays valid after the descriptor is closed.
+	void* data = mmap(0, file_info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+		return 0;
+
+	*file_size = file_info.st_size;
+	return (const u8*)data;
+}
+
+void util_unmap_file(const u8* data, u64 file_size)
+{
+	munmap((void*)data, file_size);
+}
+#endif
+
+u64 util_get_peak_resident_memory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+	// Kilobytes on Linux, bytes on macOS.
+#ifdef __APPLE__
+	return (u64)usage.ru_maxrss;
+#else
+	return (u64)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static bool make_directory(const s8* path)
+{
+#ifdef _WIN32
+	s32 result = _mkdir(path);
+#else
+	s32 result = mkdir(path, 0755);
+#endif
+	return result == 0 || errno == EEXIST;
+}
+
+bool util_create_directory(const s8* path)
+{
+	s8 buffer[256];
+	if (strlen(path) >= sizeof(buffer))
+		return false;
+
+	strcpy(buffer, path);
+	for (s8* c = buffer + 1; *c; ++c)
+	{
+		if (*c == '/')
+		{
+			*c = '\0';
+			if (!make_directory(buffer))
+				return false;
+			*c = '/';
+		}
+	}
+
+	return make_directory(buffer);
+}
+
+FILE* util_open_temporary_file(const s8* path, s8* temporary_path, s32 temporary_path_size)
+{
+	// The process id keeps instances sharing the same cache apart, the counter keeps the threads of one instance apart.
+	static std::atomic<u32> counter(0);
+#ifdef _WIN32
+	u32 process_id = (u32)GetCurrentProcessId();
+#else
+	u32 process_id = (u32)getpid();
+#endif
+	s32 length = snprintf(temporary_path, temporary_path_size, "%s.%u.%u.tmp", path, process_id, counter++);
+	if (length < 0 || length >= temporary_path_size)
+		return 0;
+
+	return fopen(temporary_path, "wb");
+}
+
+bool util_replace_file(const s8* temporary_path, const s8* path)
+{
+#ifdef _WIN32
+	// rename does not replace existing files on Windows.
+	bool success = MoveFileExA(temporary_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool success = rename(temporary_path, path) == 0;
+#endif
+	if (!success)
+		remove(temporary_path);
+	return success;
+}
+
+u64 util_hash(const void* data, u64 size, u64 seed)
+{
+	const u8* bytes = (const u8*)data;
+	u64 hash = seed;
+
+	for (u64 i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 // Convert window coords to NDC (from [0, WinWidth],[0, WinHeight] to [-1, 1])
 void util_normalize_window_coords_to_ndc(r32 x, r32 y, s32 window_width, s32 window_height, r32* x_ndc, r32* y_ndc)
 {
@@ -2,9 +2,27 @@
 #define BASIC_ENGINE_UTIL_H
 #include "common.h"
 #include "camera/camera.h"
+#include <stdio.h>
 
 s8* util_read_file(const s8* path, s32* file_length);
 void util_free_file(s8* file);
+// Maps the whole file read-only. Pages are loaded by the OS on first access, so no copy is made up front.
+// Returns 0 if the file cannot be opened or is empty. Must be released with util_unmap_file.
+const u8* util_map_file(const s8* path, u64* file_size);
+void util_unmap_file(const u8* data, u64 file_size);
+// Highest resident memory of the process so far, in bytes. 0 if it cannot be queried.
+u64 util_get_peak_resident_memory();
+// Creates the directory and every missing parent directory. Returns true if it exists afterwards.
+bool util_create_directory(const s8* path);
+// Opens a new file next to path for writing, with a name unique to this call, and returns its name in temporary_path.
+// Once it is fully written and closed, util_replace_file moves it over path in one step, so that readers of path
+// (possibly on other threads) never see a partially written file. Returns 0 if the file cannot be created.
+FILE* util_open_temporary_file(const s8* path, s8* temporary_path, s32 temporary_path_size);
+// Renames temporary_path to path, replacing path if it exists. On failure, temporary_path is removed.
+bool util_replace_file(const s8* temporary_path, const s8* path);
+// 64-bit FNV-1a. Pass the result of a previous call as seed to hash non-contiguous data.
+u64 util_hash(const void* data, u64 size, u64 seed);
+#define UTIL_HASH_SEED 0xcbf29ce484222325ULL
 r32 util_random_float(r32 min, r32 max);
 void util_normalize_window_coords_to_ndc(r32 x, r32 y, s32 window_width, s32 window_height, r32* x_ndc, r32* y_ndc);
 void util_mouse_get_ray_world_coords(const Camera* camera, r32 mouse_x, r32 mouse_y, s32 window_width, s32 window_height,
@@ -0,0 +1,111 @@
+// Measures the throughput of the u8 <-> float image conversion kernels (see src/image_convert.h) against plain
+// scalar loops, and checks both produce the same values.
+// Usage: benchmark_image_convert [width] [height] [channels] [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "image_convert.h"
+#include "jobs.h"
+
+static void reference_u8_to_float(const u8* in, r32* out, s32 count)
+{
+	for (s32 i = 0; i < count; ++i)
+		out[i] = in[i] / 255.0f;
+}
+
+static void reference_float_to_u8(const r32* in, u8* out, s32 count)
+{
+	for (s32 i = 0; i < count; ++i)
+	{
+		r32 value = in[i] > 0.0f ? in[i] : 0.0f;
+		value = value < 1.0f ? value : 1.0f;
+		out[i] = (u8)(value * 255.0f + 0.5f);
+	}
+}
+
+static r64 elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<r64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const s8* name, r64 ms, s32 iterations, size_t bytes)
+{
+	r64 ms_per_iteration = ms / iterations;
+	printf("  %-28s %8.2f ms  %8.2f GB/s\n", name, ms_per_iteration, bytes / (ms_per_iteration * 1.0e6));
+}
+
+int main(int argc, char** argv)
+{
+	s32 width = argc > 1 ? atoi(argv[1]) : 4096;
+	s32 height = argc > 2 ? atoi(argv[2]) : 4096;
+	s32 channels = argc > 3 ? atoi(argv[3]) : 4;
+	s32 iterations = argc > 4 ? atoi(argv[4]) : 10;
+	if (width <= 0 || height <= 0 || channels <= 0 || iterations <= 0)
+	{
+		fprintf(stderr, "usage: %s [width] [height] [channels] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	s32 count = width * height * channels;
+	u8* image = (u8*)malloc(count);
+	u8* image_reference = (u8*)malloc(count);
+	r32* float_image = (r32*)malloc(count * sizeof(r32));
+	r32* float_image_reference = (r32*)malloc(count * sizeof(r32));
+	for (s32 i = 0; i < count; ++i)
+		image[i] = (u8)(rand() & 0xFF);
+
+	printf("%dx%d, %d channels, %d iterations, %d threads\n", width, height, channels, iterations,
+		jobs_get_worker_count() + 1);
+	// Throughput counts bytes read plus bytes written.
+	size_t bytes = (size_t)count * (1 + sizeof(r32));
+
+	printf("u8 -> float\n");
+	auto start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		reference_u8_to_float(image, float_image_reference, count);
+	report("scalar loop", elapsed_ms(start), iterations, bytes);
+
+	start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		image_convert_u8_to_float_row(image, float_image, count);
+	report("kernel, single thread", elapsed_ms(start), iterations, bytes);
+
+	start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		image_convert_u8_to_float(image, float_image, width, height, channels);
+	report("kernel, job workers", elapsed_ms(start), iterations, bytes);
+
+	bool match = !memcmp(float_image, float_image_reference, count * sizeof(r32));
+
+	// Push some values out of range so clamping is exercised as well.
+	for (s32 i = 0; i < count; i += 7)
+		float_image[i] = float_image[i] * 1.5f - 0.25f;
+
+	printf("float -> u8\n");
+	start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		reference_float_to_u8(float_image, image_reference, count);
+	report("scalar loop", elapsed_ms(start), iterations, bytes);
+
+	start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		image_convert_float_to_u8_row(float_image, image, count);
+	report("kernel, single thread", elapsed_ms(start), iterations, bytes);
+
+	start = std::chrono::steady_clock::now();
+	for (s32 i = 0; i < iterations; ++i)
+		image_convert_float_to_u8(float_image, image, width, height, channels);
+	report("kernel, job workers", elapsed_ms(start), iterations, bytes);
+
+	match = match && !memcmp(image, image_reference, count);
+	printf(match ? "results match the scalar loops\n" : "error: results differ from the scalar loops\n");
+
+	free(image);
+	free(image_reference);
+	free(float_image);
+	free(float_image_reference);
+	jobs_destroy();
+
+	return match ? 0 : 1;
+}
\ No newline at end of file
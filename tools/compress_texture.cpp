@@ -0,0 +1,73 @@
+// Offline texture compressor: loads an image, builds its mip chain and writes it block-compressed to a .dds file,
+// which graphics_texture_create uploads directly with glCompressedTexImage2D.
+// Usage: compress_texture <input image> <output.dds> [bc1|bc3|bc5]
+// Without a format, bc3 is picked for images with alpha and bc1 for everything else.
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#include <light_array.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "texture_compression.h"
+#include "mipmap.h"
+#include "jobs.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s <input image> <output.dds> [bc1|bc3|bc5]\n", argv[0]);
+		return 1;
+	}
+
+	Image_Data image;
+	image.data = stbi_load(argv[1], &image.width, &image.height, &image.channels, 0);
+	if (!image.data)
+	{
+		fprintf(stderr, "error: could not load %s: %s\n", argv[1], stbi_failure_reason());
+		return 1;
+	}
+
+	Texture_Compression_Format format = image.channels == 2 || image.channels == 4 ?
+		TEXTURE_COMPRESSION_BC3 : TEXTURE_COMPRESSION_BC1;
+	if (argc > 3)
+	{
+		if (!strcmp(argv[3], "bc1"))
+			format = TEXTURE_COMPRESSION_BC1;
+		else if (!strcmp(argv[3], "bc3"))
+			format = TEXTURE_COMPRESSION_BC3;
+		else if (!strcmp(argv[3], "bc5"))
+			format = TEXTURE_COMPRESSION_BC5;
+		else
+		{
+			fprintf(stderr, "error: unknown format %s\n", argv[3]);
+			return 1;
+		}
+	}
+
+	// BC5 is meant for tangent space normal maps, which are not filtered in sRGB space.
+	Mipmap_Options mipmap_options = mipmap_get_default_options(format == TEXTURE_COMPRESSION_BC5 ?
+		TEXTURE_USAGE_NORMAL : TEXTURE_USAGE_ALBEDO);
+
+	auto start = std::chrono::steady_clock::now();
+	Image_Data* levels = mipmap_generate(&image, &mipmap_options);
+	Compressed_Image_Data compressed = texture_compression_compress(levels, format);
+	auto end = std::chrono::steady_clock::now();
+
+	u32 compressed_size = 0;
+	for (u32 i = 0; i < array_length(compressed.levels); ++i)
+		compressed_size += compressed.levels[i].size;
+
+	printf("%s: %dx%d, %u levels, %u bytes (%.1fx smaller than RGBA8 with mips), %.1f ms on %d threads\n",
+		argv[2], image.width, image.height, (u32)array_length(compressed.levels), compressed_size,
+		(image.width * image.height * 4.0 * 4.0 / 3.0) / compressed_size,
+		std::chrono::duration<double, std::milli>(end - start).count(), jobs_get_worker_count() + 1);
+
+	bool success = texture_compression_save(argv[2], &compressed);
+	texture_compression_free(&compressed);
+	mipmap_free(levels);
+	stbi_image_free(image.data);
+	jobs_destroy();
+
+	return success ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+// Build-time helper: turns the shader files given on the command line into a C++ source file holding their contents,
+// so the engine does not depend on the working directory (or on any file I/O) to find its shaders.
+// Usage: embed_shaders <output.cpp> <shader files...>
+#include <stdio.h>
+#include <string.h>
+
+static const char* get_file_name(const char* path)
+{
+	const char* name = path;
+	for (const char* c = path; *c; ++c)
+		if (*c == '/' || *c == '\\')
+			name = c + 1;
+	return name;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <output.cpp> <shader files...>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* out = fopen(argv[1], "wb");
+	if (!out)
+	{
+		fprintf(stderr, "error: could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	fprintf(out, "// Generated by tools/embed_shaders.cpp, do not edit.\n");
+	fprintf(out, "#include \"embedded_shaders.h\"\n\n");
+
+	for (int i = 2; i < argc; ++i)
+	{
+		FILE* in = fopen(argv[i], "rb");
+		if (!in)
+		{
+			fprintf(stderr, "error: could not open %s\n", argv[i]);
+			fclose(out);
+			remove(argv[1]);
+			return 1;
+		}
+
+		// Byte arrays instead of string literals: no escaping issues and no limits on literal length.
+		// Unsigned, so bytes above 0x7f (e.g. UTF-8 in comments) are not narrowing conversions.
+		fprintf(out, "static const unsigned char shader_%d[] = {", i - 2);
+		int c, column = 0;
+		while ((c = fgetc(in)) != EOF)
+		{
+			if (column++ % 16 == 0)
+				fprintf(out, "\n\t");
+			fprintf(out, "0x%02x, ", c);
+		}
+		fprintf(out, "0x00\n};\n\n");
+		fclose(in);
+	}
+
+	fprintf(out, "const Embedded_Shader embedded_shaders[] = {\n");
+	for (int i = 2; i < argc; ++i)
+		fprintf(out, "\t{ \"%s\", (const s8*)shader_%d, sizeof(shader_%d) - 1 },\n", get_file_name(argv[i]), i - 2, i - 2);
+	fprintf(out, "\t{ 0, 0, 0 }\n};\n");
+
+	fclose(out);
+	return 0;
+}